@@ -44,6 +44,14 @@ enum {
     DEC,
     CALL,
     INT,
+    /*
+    Superinstructions, only emitted by the assembler (parser.cpp)
+    */
+    SARITH, // pop b, pop a, <op> a b, push a. a and b are dst and src, the op is the value
+    LDMI,   // push loc, push pos, ldm. loc is the value, pos is dst << 8 | src
+    STMI,   // push loc, push pos, stm, like LDMI
+    MODES,  // int 1/2 and int 9/10/11/22 at once, the memory mode code in dst, the arith mode code in src
+    VEC,    // vector instructions on memory locations (vadd, vdot, ...), the operation is the value, see Vector.h
     /* 
     Internal opcodes    
     */ 
@@ -61,12 +69,23 @@ enum {
     R8,
     R9,
     R10, 
+    // vector instructions, all assembled to VEC with the operation as the value (Vector.h in the vm)
+    VADD,
+    VSUB,
+    VMUL,
+    VDIV,
+    VSCALE,
+    VDOT,
+    VSUM,
+    VMIN,
+    VMAX,
     // LEXER INTERNALS
     EOL, 
     LABEL, 
     COLON, 
     INTEGER,
-    STRING
+    STRING,
+    FLOAT
 };
 
 class Lexer {
@@ -74,6 +93,7 @@ class Lexer {
     FILE * f;    
     int last;
     int readChar();     
+    int readFraction(const std::string & digits);
        
     public:   
         Lexer(const std::string & fname);
@@ -85,6 +105,7 @@ class Lexer {
     
     std::string lastIdentifier;
     unsigned int lastInteger; 
+    double lastFloat; // a number with a '.', like 3.14 or -2.5e-3
     std::string lastString; // deprecated
     int lastToken;
     
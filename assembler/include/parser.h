@@ -8,9 +8,13 @@ class Parser {
     public:
         void parseFile(const std::string & in, const std::string & out);
         void setDebug(bool yes);
+        void setSymbols(const std::string & file);
+        void setOptimize(bool yes);
         
     private:
         bool debug = false;
+        std::string symbols; // write the labels to this file, if set
+        bool optimize = false; // run the peephole optimizer before the superinstructions are fused
 };
 
 #endif
\ No newline at end of file
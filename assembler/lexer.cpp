@@ -25,6 +25,27 @@ int Lexer::peek() {
     return i;
 }
 
+/* the rest of a float literal behind the digits before the '.', which is in last */
+int Lexer::readFraction(const std::string & digits) {
+    std::string number = digits + ".";
+    while( isdigit(last = readChar()) || last == '_' ) 
+        if(last != '_') number += last;
+    if(last == 'e' || last == 'E') {
+        number += 'e';
+        last = readChar();
+        if(last == '-' || last == '+') {
+            number += last;
+            last = readChar();
+        }
+        while(isdigit(last)) {
+            number += last;
+            last = readChar();
+        }
+    }
+    lastFloat = strtod(number.c_str(), NULL);
+    return FLOAT;
+}
+
 int Lexer::getToken() {
 
     // whitespaces
@@ -128,6 +149,15 @@ int Lexer::getToken() {
         if(lastIdentifier == "dec") return DEC; 
         if(lastIdentifier == "call") return CALL;
         if(lastIdentifier == "int") return INT;  
+        if(lastIdentifier == "vadd") return VADD;
+        if(lastIdentifier == "vsub") return VSUB;
+        if(lastIdentifier == "vmul") return VMUL;
+        if(lastIdentifier == "vdiv") return VDIV;
+        if(lastIdentifier == "vscale") return VSCALE;
+        if(lastIdentifier == "vdot") return VDOT;
+        if(lastIdentifier == "vsum") return VSUM;
+        if(lastIdentifier == "vmin") return VMIN;
+        if(lastIdentifier == "vmax") return VMAX;
 		return LABEL;
 	}
     
@@ -136,14 +166,18 @@ int Lexer::getToken() {
             int p = peek();
             last = readChar(); // eat it            
             lastInteger = last - '0';            
+            std::string digits = "-";
+            digits += (char)last;
             while(true) {        
                 if( (last = readChar()) == '_' ) continue;                        
                 if( isdigit(last) ) {
                     lastInteger *= 10;
                     lastInteger += last - '0';   
+                    digits += (char)last;
                 }            
                 else break;            
             }        
+            if(last == '.') return readFraction(digits);
             lastInteger *= -1;       
             return INTEGER;            
         } else {        
@@ -195,14 +229,17 @@ int Lexer::getToken() {
             }  
             
             lastInteger = last - '0';            
+            std::string digits(1, (char)last);
             while(true) {        
                 if( (last = readChar()) == '_' ) continue;                        
                 if( isdigit(last) ) {
                     lastInteger *= 10;
                     lastInteger += last - '0';
+                    digits += (char)last;
                 }            
                 else break;            
             } 
+            if(last == '.') return readFraction(digits);
             //printf("lastinteger: %d, peek was '%c'\n", lastInteger, p);       
             return INTEGER;            
         } 
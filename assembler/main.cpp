@@ -2,16 +2,12 @@
 #include <cstdio>
 #include <string.h>
 
-int findLastIndex(char *str, const char x) { 
+// the file name up to its last '.', the whole name if it has none
+std::string stem(const std::string & name) {
 
-    int index = -1; 
-    for (int i = 0; i < strlen(str); i++) { 
-        if (str[i] == x) 
-            index = i; 
-    } 
-    return index; 
-    
-} 
+    return name.substr(0, name.rfind('.'));
+
+}
 
 int main(int argc, char ** argv) {
 
@@ -21,26 +17,44 @@ int main(int argc, char ** argv) {
     
     printf("VM Assembler v1.0 (https://github.com/zarat/vm)\n");
     
-    if(argc == 3) {
+    // -s writes the labels to <outfile>.sym for the profiler of the vm, -O optimizes the code
+    bool symbols = false;
+    char *files[2] = {0};
+    int fileCount = 0;
+    
+    for(int a = 1; a < argc; a++) {
+        if(strcmp(argv[a], "-s") == 0) symbols = true;
+        else if(strcmp(argv[a], "-O") == 0) parser.setOptimize(true);
+        else if(fileCount < 2) files[fileCount++] = argv[a];
+        else fileCount++;
+    }
+    
+    std::string newfilename;
+    
+    if(fileCount == 2) {
         
-        printf("Parsing '%s', write output to '%s'\n", argv[1], argv[2]);
-        parser.parseFile(argv[1], argv[2]);
+        newfilename = files[1];
     
-    } else if(argc == 2) {
+    } else if(fileCount == 1) {
         
-        char *filename = argv[1];
-        char newfilename[128] = {0};
-        int index = findLastIndex(filename, '.');
-        sprintf(newfilename, "%.*s.zvm", index, filename);
-        printf("Parsing '%s', write output to '%s'\n", argv[1], newfilename);
-        parser.parseFile(argv[1], newfilename);
+        newfilename = stem(files[0]) + ".zvm";
     
     } else {
         
-        printf("Usage: %s <assembly|infile> <executable|outfile>", argv[0]);
+        printf("Usage: %s [-s] [-O] <assembly|infile> <executable|outfile>", argv[0]);
+        return 0;
     
     }
     
+    if(symbols) {
+        
+        parser.setSymbols(stem(newfilename) + ".sym");
+        
+    }
+    
+    printf("Parsing '%s', write output to '%s'\n", files[0], newfilename.c_str());
+    parser.parseFile(files[0], newfilename);
+    
     return 0;
     
 }
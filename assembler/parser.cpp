@@ -4,6 +4,7 @@ This class parses the AST tree, translates the instructions and save it as a byt
 #include "parser.h"
 #include "lexer.h"
 #include <cstdlib>
+#include <cstring>
 #include <vector>
 
 /*
@@ -37,8 +38,9 @@ struct Label {
 struct Opcode {
     int instr;
     int value;
-    Opcode() : instr(0), value(0) {}
-    Opcode(int i, int v) : instr(i), value(v) {}
+    bool label; // value is the position of a label
+    Opcode() : instr(0), value(0), label(false) {}
+    Opcode(int i, int v, bool l = false) : instr(i), value(v), label(l) {}
 };
 
 struct Labels {
@@ -52,10 +54,243 @@ struct Labels {
     }
 };
 
+static int opcode(const Opcode & op) { return (op.instr >> 24) & 0xFF; }
+static int dst(const Opcode & op) { return (op.instr >> 16) & 0xFF; }
+static int src(const Opcode & op) { return (op.instr >> 8) & 0xFF; }
+
+/*
+the low byte of the instruction word flags the value of mov, push and add/sub/mul/div/mod as a float
+literal (the bits of a float). the vm converts it to the mode it runs in (IMAGE_FLOAT in vm.c)
+*/
+#define IMAGE_FLOAT 1
+
+static bool isFloatLiteral(const Opcode & op) { return (op.instr & IMAGE_FLOAT) != 0; }
+
+/* the value of a float literal */
+static int floatBits(double d) {
+    float f = (float)d;
+    int bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+/* int 1/2 (memory) and int 9/10/11/22 (arithmetic) */
+static bool isModeSwitch(const Opcode & op) {
+    return opcode(op) == INT && dst(op) == 0 && (op.value == 1 || op.value == 2 || (op.value >= 9 && op.value <= 11) || op.value == 22);
+}
+
+/* push of an immediate value, not of a register, a label or a float literal */
+static bool isPushImmediate(const Opcode & op) {
+    return opcode(op) == PUSH && dst(op) == 0 && !op.label && !isFloatLiteral(op);
+}
+
+/* the longest sequence fused into one superinstruction */
+#define FUSE_MAX 8
+
+/*
+the number of instructions at code[i] the vm can run as one superinstruction (see Common.h), 0 if none.
+only the next left instructions are looked at, fused is set to the superinstruction
+*/
+static int superinstruction(const std::vector<Opcode> & code, unsigned int i, unsigned int left, Opcode & fused) {
+    // pop b, pop a, <op> a b, push a
+    if(left >= 4 && opcode(code[i]) == POP && opcode(code[i + 1]) == POP && opcode(code[i + 3]) == PUSH) {
+        int b = dst(code[i]), a = dst(code[i + 1]), op = opcode(code[i + 2]);
+        if(a != 0 && b != 0 && (op == ADD || op == SUB || op == MUL || op == DIV || op == MOD) 
+            && dst(code[i + 2]) == a && src(code[i + 2]) == b && dst(code[i + 3]) == a) {
+            fused = Opcode(SARITH << 24 | a << 16 | b << 8, op);
+            return 4;
+        }
+    }
+    // push loc, push pos, ldm/stm
+    if(left >= 3 && isPushImmediate(code[i]) && isPushImmediate(code[i + 1]) 
+        && (opcode(code[i + 2]) == LDM || opcode(code[i + 2]) == STM)) {
+        int pos = code[i + 1].value;
+        if(pos >= 0 && pos <= 0xFFFF) {
+            int op = opcode(code[i + 2]) == LDM ? LDMI : STMI;
+            fused = Opcode(op << 24 | (pos >> 8) << 16 | (pos & 0xFF) << 8, code[i].value);
+            return 3;
+        }
+    }
+    // a run of mode switches, the last memory and the last arithmetic mode win
+    if(left >= 2 && isModeSwitch(code[i]) && isModeSwitch(code[i + 1])) {
+        int memory = 0, arith = 0;
+        unsigned int n = 0;
+        for(; n < left && isModeSwitch(code[i + n]); n++) {
+            if(code[i + n].value <= 2) memory = code[i + n].value;
+            else arith = code[i + n].value;
+        }
+        fused = Opcode(MODES << 24 | memory << 16 | arith << 8, 0);
+        return n;
+    }
+    return 0;
+}
+
+/* the positions labels point to, pushed labels and the targets of jumps and calls are labels too */
+static std::vector<bool> targets(const std::vector<Opcode> & code, const Labels & labels) {
+    std::vector<bool> target(code.size() + 1, false);
+    for(unsigned int i=0; i<labels.labels.size(); ++i)
+        target[labels.labels[i].pos] = true;
+    return target;
+}
+
+/*
+replace code by out, moved is the new position of every old one (the next kept instruction if it was removed).
+labels, jumps, calls and pushed labels are moved along
+*/
+static void relocate(std::vector<Opcode> & code, std::vector<Opcode> & out, const std::vector<int> & moved, Labels & labels) {
+    for(unsigned int i=0; i<out.size(); ++i)
+        if(out[i].label)
+            out[i].value = moved[out[i].value];
+    for(unsigned int i=0; i<labels.labels.size(); ++i)
+        labels.labels[i].pos = moved[labels.labels[i].pos];
+    code.swap(out);
+}
+
+/*
+replace sequences of instructions by superinstructions
+a sequence is only fused if no label points into it. labels, jumps, calls and pushed labels
+are moved to the new positions
+*/
+static void fuse(std::vector<Opcode> & code, Labels & labels) {
+    std::vector<bool> target = targets(code, labels);
+    std::vector<int> moved(code.size() + 1);
+    std::vector<Opcode> out;
+    for(unsigned int i=0; i<code.size(); ) {
+        /* up to the next label */
+        unsigned int left = 1;
+        while(left < FUSE_MAX && i + left < code.size() && !target[i + left])
+            left++;
+        Opcode fused;
+        int n = superinstruction(code, i, left, fused);
+        if(n <= 1) {
+            n = 1;
+            fused = code[i];
+        }
+        for(int k = 0; k < n; k++)
+            moved[i + k] = out.size();
+        out.push_back(fused);
+        i += n;
+    }
+    moved[code.size()] = out.size();
+    relocate(code, out, moved, labels);
+}
+
+/* jmp, jz, jnz and call to a jmp go to where that jmp goes */
+static void threadJumps(std::vector<Opcode> & code) {
+    for(unsigned int i=0; i<code.size(); ++i) {
+        int op = opcode(code[i]);
+        if(!code[i].label || (op != JMP && op != JZ && op != JNZ && op != CALL))
+            continue;
+        /* a loop of jumps is left as it is */
+        int to = code[i].value;
+        for(unsigned int n = 0; n < code.size() && opcode(code[to]) == JMP; n++)
+            to = code[to].value;
+        if(opcode(code[to]) != JMP)
+            code[i].value = to;
+    }
+}
+
+/* the mode an int switches to, memory modes are 1/2, arithmetic modes 9/10/11/22 */
+static bool isMemoryMode(const Opcode & op) { return isModeSwitch(op) && op.value <= 2; }
+
+/* the program may run in float mode (int 11), where mov converts an integer but push doesn't */
+static bool usesFloats(const std::vector<Opcode> & code) {
+    for(unsigned int i=0; i<code.size(); ++i)
+        if(opcode(code[i]) == INT && (dst(code[i]) != 0 || code[i].value == 11))
+            return true;
+    return false;
+}
+
+/*
+one pass of the peephole optimizer, returns the number of removed instructions
+- int 1/2/9/10/11/22 is removed if the mode is already active. the vm starts in char/char,
+  the modes are unknown again at a label, after a call and after int <register>
+- push imm / pop reg becomes mov reg imm, push imm / pop is removed
+- ldr reg / pop reg and ldr reg / pop are removed, ldr a / pop b becomes mov b a
+- code after jmp and ret is removed up to the next label
+a pair is left alone if a label points to its second instruction. push reg is no mov, it clears reg.
+mov converts an integer in float mode and push doesn't, push imm / pop reg stays where the mode may
+be float unless imm is a float literal
+*/
+static int peephole(std::vector<Opcode> & code, Labels & labels) {
+    std::vector<bool> target = targets(code, labels);
+    std::vector<int> moved(code.size() + 1);
+    std::vector<Opcode> out;
+    int memory = 1, arith = 9; // 0 is unknown
+    bool floats = usesFloats(code);
+    bool reachable = true;
+    /* the last instruction is the end of the program, it stays */
+    unsigned int last = code.size() - 1;
+    for(unsigned int i=0; i<code.size(); ) {
+        if(target[i]) {
+            memory = arith = 0;
+            reachable = true;
+        }
+        moved[i] = out.size();
+        const Opcode & op = code[i];
+        if(!reachable && i != last) {
+            i++;
+            continue;
+        }
+        if(isModeSwitch(op)) {
+            int & mode = isMemoryMode(op) ? memory : arith;
+            if(mode != op.value)
+                out.push_back(op);
+            mode = op.value;
+            i++;
+            continue;
+        }
+        if(i + 1 < last && !target[i + 1] && opcode(code[i + 1]) == POP) {
+            int to = dst(code[i + 1]);
+            bool same = !floats || (arith != 0 && arith != 11) || isFloatLiteral(op);
+            if(opcode(op) == PUSH && dst(op) == 0 && (to == 0 || same)) {
+                // push imm / pop reg, a pushed label stays a label, a float literal stays one
+                moved[i + 1] = out.size();
+                if(to != 0)
+                    out.push_back(Opcode(MOV << 24 | to << 16 | (op.instr & IMAGE_FLOAT), op.value, op.label));
+                i += 2;
+                continue;
+            }
+            if(opcode(op) == LDR) {
+                moved[i + 1] = out.size();
+                if(to != 0 && to != dst(op))
+                    out.push_back(Opcode(MOV << 24 | to << 16 | dst(op) << 8, 0));
+                i += 2;
+                continue;
+            }
+        }
+        out.push_back(op);
+        if(opcode(op) == CALL || (opcode(op) == INT && dst(op) != 0))
+            memory = arith = 0;
+        if(opcode(op) == JMP || opcode(op) == RET)
+            reachable = false;
+        i++;
+    }
+    moved[code.size()] = out.size();
+    int removed = code.size() - out.size();
+    relocate(code, out, moved, labels);
+    return removed;
+}
+
+/* the optimizer of -O, runs before the superinstructions are fused */
+static void optimizeCode(std::vector<Opcode> & code, Labels & labels) {
+    threadJumps(code);
+    while(peephole(code, labels) > 0)
+        ;
+}
+
 void Parser::setDebug(bool dbg) {
     debug = dbg;
 }
 
+void Parser::setSymbols(const std::string & file) {
+    symbols = file;
+}
+
+void Parser::setOptimize(bool yes) {
+    optimize = yes;
+}
+
 void Parser::parseFile(const std::string & fname, const std::string & out) {
 
     Lexer lex(fname);
@@ -86,9 +321,13 @@ void Parser::parseFile(const std::string & fname, const std::string & out) {
                         
 			if(isRegister(cur)) instr |= registerValue(cur) << 8;  
 			else if(cur == INTEGER) value = lex.lastInteger;
+            else if(cur == FLOAT) {
+                value = floatBits(lex.lastFloat);
+                instr |= IMAGE_FLOAT;
+            }
             
 			else {
-                fprintf(stderr, "Integer or Register expected as second argument to mov (line:%d pos:%d)\n", curLineCount, curLinePos);
+                fprintf(stderr, "Integer, Float or Register expected as second argument to mov (line:%d pos:%d)\n", curLineCount, curLinePos);
                 exit(EXIT_FAILURE);
 			}                        
 		}
@@ -97,12 +336,22 @@ void Parser::parseFile(const std::string & fname, const std::string & out) {
             instr = cur << 24;            
 		}
 
+        /* vadd ... vmax, the operands are on the stack */
+        if(cur >= VADD && cur <= VMAX) {
+            instr = VEC << 24;
+            value = cur - VADD;
+		}
+
         if(cur == PUSH) { 
                
             instr = PUSH << 24;            
             cur = lex.getToken();            
             if(cur == INTEGER) value = lex.lastInteger;
             else if(isRegister(cur)) instr |= registerValue(cur) << 16;
+            else if(cur == FLOAT) {
+                value = floatBits(lex.lastFloat);
+                instr |= IMAGE_FLOAT;
+            }
 
             else if(cur == STRING) {
                 
@@ -122,8 +371,22 @@ void Parser::parseFile(const std::string & fname, const std::string & out) {
                 
             }
 
+            // the position of a label, the entry point of int 13 (spawn)
+            else if(cur == LABEL) {
+                int p = labels.findLabel(lex.lastIdentifier);
+                if(p != -1) {
+                    value = labels.labels[p].pos;
+                } else {
+                    value = 0xFFFFFFFF;
+                    labels.unknown.push_back(Label(lex.lastIdentifier, instructions.size()));
+                }
+                instructions.push_back(Opcode(instr, value, true));
+                instr = cur = value = 0;
+                continue;
+            }
+
             else {
-                fprintf(stderr, "Integer or Register rexpected to push (line:%d pos:%d)\n", curLineCount, curLinePos);
+                fprintf(stderr, "Integer, Float, Register or Label expected to push (line:%d pos:%d)\n", curLineCount, curLinePos);
                 exit(EXIT_FAILURE);
 			}
             
@@ -175,8 +438,12 @@ void Parser::parseFile(const std::string & fname, const std::string & out) {
 			cur = lex.getToken();            
 			if(isRegister(cur)) instr |= registerValue(cur) << 8;  
 			else if(cur == INTEGER) value = lex.lastInteger;
+            else if(cur == FLOAT) {
+                value = floatBits(lex.lastFloat);
+                instr |= IMAGE_FLOAT;
+            }
 			else {
-                fprintf(stderr, "Integer or Register expected as second argument to add/sub/mul/div/mod (line:%d pos:%d)\n", curLineCount, curLinePos);
+                fprintf(stderr, "Integer, Float or Register expected as second argument to add/sub/mul/div/mod (line:%d pos:%d)\n", curLineCount, curLinePos);
                 exit(EXIT_FAILURE);
 			}         
         }
@@ -277,7 +544,7 @@ void Parser::parseFile(const std::string & fname, const std::string & out) {
 		}
 		
 		if(cur != LABEL) 
-            instructions.push_back(Opcode(instr, value));
+            instructions.push_back(Opcode(instr, value, cur == JZ || cur == JNZ || cur == JMP || cur == CALL));
 
         // clear after each loop
         instr = cur = value = 0;
@@ -308,6 +575,11 @@ void Parser::parseFile(const std::string & fname, const std::string & out) {
         
 	}
 
+    if(optimize)
+        optimizeCode(instructions, labels);
+
+    fuse(instructions, labels);
+
 	FILE * f = fopen(out.c_str(), "wb");
     
     if(debug) {
@@ -337,4 +609,21 @@ void Parser::parseFile(const std::string & fname, const std::string & out) {
   
 	fclose(f);
     
+    /* the symbol file, one "<pc> <label>" per line, pc is the index of the instruction */
+    if(!symbols.empty()) {
+    
+        FILE * s = fopen(symbols.c_str(), "w");
+        
+        if(!s) {
+            fprintf(stderr, "Could not write symbols to '%s'\n", symbols.c_str());
+            exit(EXIT_FAILURE);
+        }
+        
+        for(unsigned int i=0; i<labels.labels.size(); ++i) 
+            fprintf(s, "%d %s\n", labels.labels[i].pos, labels.labels[i].name.c_str());
+        
+        fclose(s);
+        
+    }
+    
 }
@@ -0,0 +1,5 @@
+gcc -O2 -Wall bench.c -o bench
+
+bench
+
+pause
\ No newline at end of file
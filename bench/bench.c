@@ -0,0 +1,313 @@
+/*
+
+Benchmarks for the vm, the assembler and zlang
+
+Usage: bench [-n runs] [-o results.json] [-l label] [-f "vm flags"] [bindir]
+
+bindir contains vm, as and zlang, it defaults to ".." where the _make.bat files copy them.
+The programs in workloads/ are assembled into work/ and run with 'vm -s', which reports the executed
+instructions, the run time and the allocations of the memory store. The storage workloads run in
+work/storage with a writeable bootfile, once writing through and once with write-back (-b).
+zlang compiles a generated program and the assembler assembles what zlang emitted.
+
+The harness measures the wall time and the peak RSS of every process, the fastest of n runs is
+reported. Results are printed as a table and appended to the results file, one JSON object per line,
+so changes in vm.c, Memory.h and Storage.h can be compared over time.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#define EXE ".exe"
+#else
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#define EXE ""
+#endif
+
+/* statements of the generated zlang program */
+#define ZLANG_STATEMENTS 5000
+
+struct workload {
+    const char *name;
+    const char *file;  // workloads/<file>.asm
+    const char *flags; // extra vm flags
+    int storage;       // run with a writeable bootfile
+};
+
+struct workload workloads[] = {
+    {"arith_char", "arith_char", "", 0},
+    {"arith_int", "arith_int", "", 0},
+    {"arith_float", "arith_float", "", 0},
+    {"arith_double", "arith_double", "", 0},
+    {"arith_double_loop", "arith_double_loop", "", 0},
+    {"memory", "memory", "", 0},
+    {"vector", "vector", "", 0},
+    {"strings", "strings", "", 0},
+    {"recursion", "recursion", "", 0},
+    {"contention", "contention", "", 0},
+    {"storage", "storage", "", 1},
+    {"storage_wb", "storage", "-b", 1},
+};
+
+struct result {
+    double wall;                 // seconds, the whole process
+    double seconds;              // vm: seconds spent in run()
+    unsigned long long instructions;
+    unsigned long long allocations;
+    long rss;                    // peak resident set in KB, -1 if unknown
+    long lines;                  // as, zlang: lines of input
+};
+
+char vmPath[1024], asPath[1024], zlangPath[1024];
+char vmFlags[256] = "";
+int runs = 3;
+
+static double now() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void makeDir(const char *path) {
+#ifdef _WIN32
+    _mkdir(path);
+#else
+    mkdir(path, 0755);
+#endif
+}
+
+/*
+run argv[0] with the working directory dir, stdout and stderr go to the given files
+returns the exit status, the wall time and the peak RSS of the process
+*/
+static int runProcess(char **argv, const char *dir, const char *out, const char *err, double *wall, long *rss) {
+    double start = now();
+#ifdef _WIN32
+    char cmd[4096] = "";
+    snprintf(cmd, sizeof(cmd), "cd /d \"%s\" &&", dir);
+    for(int i = 0; argv[i] != NULL; i++) {
+        strcat(cmd, " \"");
+        strcat(cmd, argv[i]);
+        strcat(cmd, "\"");
+    }
+    char redirect[2048];
+    snprintf(redirect, sizeof(redirect), " > \"%s\" 2> \"%s\"", out, err);
+    strcat(cmd, redirect);
+    int status = system(cmd);
+    *wall = now() - start;
+    *rss = -1;
+    return status;
+#else
+    pid_t pid = fork();
+    if(pid < 0)
+        return -1;
+    if(pid == 0) {
+        if(chdir(dir) != 0) _exit(127);
+        int fo = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int fe = open(err, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fo < 0 || fe < 0) _exit(127);
+        dup2(fo, 1);
+        dup2(fe, 2);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    int status;
+    struct rusage ru;
+    wait4(pid, &status, 0, &ru);
+    *wall = now() - start;
+    *rss = ru.ru_maxrss; // KB on linux
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#endif
+}
+
+static void absolutePath(const char *dir, const char *name, char *path) {
+    char tmp[1024];
+    snprintf(tmp, sizeof(tmp), "%s/%s" EXE, dir, name);
+#ifdef _WIN32
+    if(_fullpath(path, tmp, 1024) == NULL)
+#else
+    if(realpath(tmp, path) == NULL)
+#endif
+        snprintf(path, 1024, "%s", tmp);
+}
+
+/* the [stats] line of vm -s */
+static int readStats(const char *file, struct result *r) {
+    FILE *f = fopen(file, "r");
+    if(!f)
+        return 0;
+    char line[1024];
+    int found = 0;
+    while(fgets(line, sizeof(line), f)) {
+        char *p = strstr(line, "[stats] ");
+        if(p && sscanf(p, "[stats] instructions=%llu seconds=%lf allocations=%llu", &r->instructions, &r->seconds, &r->allocations) == 3)
+            found = 1;
+    }
+    fclose(f);
+    return found;
+}
+
+static long countLines(const char *file) {
+    FILE *f = fopen(file, "r");
+    if(!f)
+        return 0;
+    long n = 0;
+    int c;
+    while((c = fgetc(f)) != EOF)
+        if(c == '\n') n++;
+    fclose(f);
+    return n;
+}
+
+/* run a process 'runs' times and keep the fastest run */
+static int measure(char **argv, const char *dir, const char *out, const char *err, const char *reset, struct result *best) {
+    memset(best, 0, sizeof(struct result));
+    best->wall = -1;
+    for(int i = 0; i < runs; i++) {
+        struct result r;
+        memset(&r, 0, sizeof(r));
+        if(reset != NULL)
+            remove(reset);
+        int status = runProcess(argv, dir, out, err, &r.wall, &r.rss);
+        if(status != 0) {
+            fprintf(stderr, "[bench] '%s' failed with status %d, see %s\n", argv[0], status, err);
+            return 0;
+        }
+        char stats[1024];
+        snprintf(stats, sizeof(stats), "%s/%s", dir, err);
+        readStats(stats, &r);
+        if(best->wall < 0 || r.wall < best->wall)
+            *best = r;
+    }
+    return 1;
+}
+
+static void report(FILE *json, const char *label, const char *name, struct result *r) {
+    double ips = r->seconds > 0 ? r->instructions / r->seconds : 0;
+    double lps = r->wall > 0 ? r->lines / r->wall : 0;
+    printf("%-14s %10.4f %14.0f %10ld %12llu %14.0f\n", name, r->wall, ips, r->rss, r->allocations, lps);
+    if(json)
+        fprintf(json, "{\"label\":\"%s\",\"time\":%lld,\"name\":\"%s\",\"runs\":%d,\"wall\":%.6f,\"seconds\":%.6f,"
+            "\"instructions\":%llu,\"instructions_per_sec\":%.0f,\"rss_kb\":%ld,\"allocations\":%llu,\"lines\":%ld,\"lines_per_sec\":%.0f}\n",
+            label, (long long)time(NULL), name, runs, r->wall, r->seconds, r->instructions, ips, r->rss, r->allocations, r->lines, lps);
+}
+
+/* a zlang program with assignments, arithmetic and loops */
+static void generateZlang(const char *file, int statements) {
+    FILE *f = fopen(file, "w");
+    if(!f)
+        return;
+    for(int i = 0; i < statements; i++) {
+        int v = i % 50;
+        if(i % 2 == 0)
+            fprintf(f, "v%d = %d * 3 + v%d - 1; \n", v, i, (v + 1) % 50);
+        else
+            fprintf(f, "while (v%d < %d) { v%d = v%d + 1; } \n", v, i, v, v);
+    }
+    fclose(f);
+}
+
+int main(int argc, char **argv) {
+
+    const char *bindir = "..";
+    const char *results = "results.json";
+    const char *label = "";
+
+    for(int a = 1; a < argc; a++) {
+        if(strcmp(argv[a], "-n") == 0 && a + 1 < argc) runs = atoi(argv[++a]);
+        else if(strcmp(argv[a], "-o") == 0 && a + 1 < argc) results = argv[++a];
+        else if(strcmp(argv[a], "-l") == 0 && a + 1 < argc) label = argv[++a];
+        else if(strcmp(argv[a], "-f") == 0 && a + 1 < argc) snprintf(vmFlags, sizeof(vmFlags), "%s", argv[++a]);
+        else if(argv[a][0] == '-') {
+            printf("Usage: %s [-n runs] [-o results.json] [-l label] [-f \"vm flags\"] [bindir]\n", argv[0]);
+            return 1;
+        }
+        else bindir = argv[a];
+    }
+    if(runs < 1) runs = 1;
+
+    absolutePath(bindir, "vm", vmPath);
+    absolutePath(bindir, "as", asPath);
+    absolutePath(bindir, "zlang", zlangPath);
+
+    makeDir("work");
+    makeDir("work/storage");
+    FILE *ini = fopen("work/storage/vm.ini", "w");
+    if(ini) {
+        fprintf(ini, "[general]\nbootfile = storage.dat\nwriteable = true\n");
+        fclose(ini);
+    }
+
+    FILE *json = fopen(results, "a");
+    if(!json)
+        fprintf(stderr, "[bench] could not open '%s', results are only printed\n", results);
+
+    printf("%-14s %10s %14s %10s %12s %14s\n", "benchmark", "wall (s)", "instr/s", "rss (KB)", "allocations", "lines/s");
+
+    char in[1024], out[1024], err[1024];
+    struct result r;
+
+    /* zlang compile time, its output is the input of the assembler benchmark */
+    generateZlang("work/zlang.z", ZLANG_STATEMENTS);
+    {
+        char *args[] = {zlangPath, "zlang.z", NULL};
+        if(measure(args, "work", "zlang.asm", "zlang.err", NULL, &r)) {
+            r.lines = countLines("work/zlang.z");
+            report(json, label, "zlang", &r);
+        }
+    }
+    {
+        char *args[] = {asPath, "zlang.asm", "zlang.zvm", NULL};
+        if(measure(args, "work", "as.out", "as.err", NULL, &r)) {
+            r.lines = countLines("work/zlang.asm");
+            report(json, label, "as", &r);
+        }
+    }
+
+    /* vm workloads */
+    for(unsigned int i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+        struct workload *w = &workloads[i];
+        double wall;
+        long rss;
+        snprintf(in, sizeof(in), "../workloads/%s.asm", w->file);
+        snprintf(out, sizeof(out), "%s.zvm", w->file);
+        char *asArgs[] = {asPath, in, out, NULL};
+        if(runProcess(asArgs, "work", "as.out", "as.err", &wall, &rss) != 0) {
+            fprintf(stderr, "[bench] could not assemble %s\n", in);
+            continue;
+        }
+        /* the vm takes one flag per argument */
+        char *args[16];
+        int n = 0;
+        args[n++] = vmPath;
+        args[n++] = "-s";
+        char flags[512];
+        snprintf(flags, sizeof(flags), "%s %s", vmFlags, w->flags);
+        for(char *t = strtok(flags, " "); t != NULL && n < 13; t = strtok(NULL, " "))
+            args[n++] = t;
+        char program[1024];
+        snprintf(program, sizeof(program), w->storage ? "../%s.zvm" : "%s.zvm", w->file);
+        args[n++] = program;
+        args[n] = NULL;
+        snprintf(out, sizeof(out), "%s.out", w->name);
+        snprintf(err, sizeof(err), "%s.err", w->name);
+        if(measure(args, w->storage ? "work/storage" : "work", out, err, w->storage ? "work/storage/storage.dat" : NULL, &r))
+            report(json, label, w->name, &r);
+    }
+
+    if(json)
+        fclose(json);
+
+    return 0;
+
+}
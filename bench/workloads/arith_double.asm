@@ -0,0 +1,25 @@
+; arithmetic in double mode (int 22) on the double registers, the loop counter is kept in int mode
+int 10
+mov r1 0
+int 22
+mov ax 1.0
+mov bx 3.0
+int 10
+loop:
+    int 22
+    add ax bx
+    mul ax 3
+    sub ax 7
+    div ax 5
+    int 10
+    inc r1
+    ldr r1
+    push 3000000
+    lt
+    jnz loop
+int 22
+ldr ax
+push 'f'
+print
+push 10
+printc
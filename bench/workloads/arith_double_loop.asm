@@ -0,0 +1,23 @@
+; arith_double with the loop head and its backward jump in double mode, only the counter goes through int mode
+int 10
+mov r1 0
+int 22
+mov ax 1.0
+mov bx 3.0
+loop:
+    add ax bx
+    mul ax 3
+    sub ax 7
+    div ax 5
+    int 10
+    inc r1
+    ldr r1
+    push 3000000
+    lt
+    int 22
+    jnz loop
+ldr ax
+push 'f'
+print
+push 10
+printc
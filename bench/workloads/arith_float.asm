@@ -0,0 +1,23 @@
+; arithmetic in float mode (int 11), the loop counter is kept in int mode
+int 10
+mov r1 0
+mov ax 1.0
+mov bx 3.0
+loop:
+    int 11
+    add ax bx
+    mul ax 3
+    sub ax 7
+    div ax 5
+    int 10
+    inc r1
+    ldr r1
+    push 3000000
+    lt
+    jnz loop
+int 11
+ldr ax
+push 'f'
+print
+push 10
+printc
@@ -0,0 +1,21 @@
+; arithmetic in int mode (int 10)
+int 10
+mov r1 0
+mov ax 1
+mov bx 3
+loop:
+    add ax bx
+    mul ax 3
+    sub ax 7
+    div ax 5
+    mod ax 100003
+    inc r1
+    ldr r1
+    push 4000000
+    lt
+    jnz loop
+ldr ax
+push 'd'
+print
+push 10
+printc
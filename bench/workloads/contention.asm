@@ -0,0 +1,103 @@
+; 4 green threads on shared memory, stm/ldm of neighbouring cells in one location
+; and puts replacing a location of their own every 64 iterations
+int 10
+int 2
+push 0
+push 1
+push 1
+puts
+; grow location 1 to 4 cells
+push 0
+push 1
+push 12
+stm
+push 0
+push 1
+push worker
+int 13
+pop r6
+push 1
+push 1
+push worker
+int 13
+pop r7
+push 2
+push 1
+push worker
+int 13
+pop r8
+push 3
+push 1
+push worker
+int 13
+pop r9
+ldr r6
+int 14
+ldr r7
+int 14
+ldr r8
+int 14
+ldr r9
+int 14
+; sum of the 4 results
+pop ax
+pop bx
+add ax bx
+pop bx
+add ax bx
+pop bx
+add ax bx
+ldr ax
+push 'd'
+print
+push 10
+printc
+jmp done
+
+; the thread id on the stack, returns the last value of its cell
+worker:
+    pop r1
+    mov r3 r1
+    mul r3 4
+    mov r4 r1
+    inc r4
+    mod r4 4
+    mul r4 4
+    mov r5 r1
+    add r5 10
+    mov r2 0
+    mov bx 0
+w_loop:
+    ldr r2
+    push 1
+    ldr r3
+    stm
+    push 1
+    ldr r4
+    ldm
+    pop ax
+    add bx ax
+    mov ax r2
+    mod ax 64
+    ldr ax
+    push 0
+    eq
+    jz w_puts
+w_next:
+    inc r2
+    ldr r2
+    push 500000
+    lt
+    jnz w_loop
+    push 1
+    ldr r3
+    ldm
+    ret
+w_puts:
+    ldr r2
+    push 1
+    ldr r5
+    puts
+    jmp w_next
+
+done:
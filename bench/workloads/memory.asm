@@ -0,0 +1,32 @@
+; stm/ldm of 4 byte cells in a 16k memory location
+int 10
+int 2
+push 0
+push 1
+push 1
+puts
+mov r1 0
+mov bx 0
+loop:
+    mov r2 r1
+    mod r2 4096
+    mul r2 4
+    ldr r1
+    push 1
+    ldr r2
+    stm
+    push 1
+    ldr r2
+    ldm
+    pop ax
+    add bx ax
+    inc r1
+    ldr r1
+    push 2000000
+    lt
+    jnz loop
+ldr bx
+push 'd'
+print
+push 10
+printc
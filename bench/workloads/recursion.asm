@@ -0,0 +1,34 @@
+; recursive fibonacci, call/ret and the stack
+int 10
+push 27
+call fib
+push 'd'
+print
+push 10
+printc
+jmp done
+fib:
+    pop r1
+    ldr r1
+    push 2
+    lt
+    jz fib_rec
+    push 1
+    ret
+fib_rec:
+    ldr r1
+    dec r1
+    ldr r1
+    call fib
+    pop r2
+    pop r1
+    ldr r2
+    sub r1 2
+    ldr r1
+    call fib
+    pop r2
+    pop r3
+    add r2 r3
+    ldr r2
+    ret
+done:
@@ -0,0 +1,20 @@
+; stm to a memory location of a writeable bootfile, every write gets persisted
+int 10
+push 0
+push 1
+push 1
+puts
+mov r1 0
+loop:
+    mov r2 r1
+    mod r2 256
+    ldr r1
+    push 1
+    ldr r2
+    stm
+    inc r1
+    ldr r1
+    push 20000
+    lt
+    jnz loop
+int 12
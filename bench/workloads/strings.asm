@@ -0,0 +1,31 @@
+; copy a string between two memory locations with gets/puts
+int 10
+mov r1 0
+push 0
+push "The quick brown fox jumps over the lazy dog"
+si ax
+ldr ax
+push 2
+puts
+loop:
+    push 2
+    gets
+    si ax
+    ldr ax
+    push 3
+    puts
+    push 3
+    gets
+    si ax
+    ldr ax
+    push 2
+    puts
+    inc r1
+    ldr r1
+    push 400000
+    lt
+    jnz loop
+push 2
+write
+push 10
+printc
@@ -0,0 +1,60 @@
+; vector instructions over two 4096 cell memory locations, filled with stm once
+int 10
+int 2
+push 0
+push 1
+push 1
+puts
+push 0
+push 1
+push 2
+puts
+mov r1 0
+fill:
+    mov r2 r1
+    mul r2 4
+    ldr r1
+    push 1
+    ldr r2
+    stm
+    mov ax 4096
+    sub ax r1
+    push ax
+    push 2
+    ldr r2
+    stm
+    inc r1
+    ldr r1
+    push 4096
+    lt
+    jnz fill
+mov r1 0
+mov bx 0
+loop:
+    push 3
+    push 1
+    push 2
+    vadd
+    push 3
+    push 3
+    push 2
+    vmul
+    push 3
+    push 1
+    vdot
+    pop ax
+    add bx ax
+    push 3
+    vmax
+    pop ax
+    add bx ax
+    inc r1
+    ldr r1
+    push 20000
+    lt
+    jnz loop
+ldr bx
+push 'd'
+print
+push 10
+printc
@@ -0,0 +1,89 @@
+; 4 green threads count to 10000 each on shared memory, without locks
+; cell 0 of location 1 with fetch-add (int 18), cell 4 with a compare-and-swap loop (int 19)
+
+int 10
+; 4 byte cells
+int 2
+push 0
+push 0
+push 2
+push 1
+puts
+
+push 0
+push worker
+int 13
+pop r5
+push 0
+push worker
+int 13
+pop r6
+push 0
+push worker
+int 13
+pop r7
+push 0
+push worker
+int 13
+pop r8
+ldr r5
+int 14
+pop
+ldr r6
+int 14
+pop
+ldr r7
+int 14
+pop
+ldr r8
+int 14
+pop
+
+; both print 40000
+push 1
+push 0
+int 16
+push 'd'
+print
+push 10
+printc
+push 1
+push 4
+int 16
+push 'd'
+print
+push 10
+printc
+jmp done
+
+worker:
+    mov r2 0
+w_loop:
+    push 1
+    push 1
+    push 0
+    int 18
+    pop
+    ; load, add 1 and swap it in if no other thread changed the cell in between, otherwise retry
+w_cas:
+    push 1
+    push 4
+    int 16
+    pop r3
+    ldr r3
+    inc r3
+    ldr r3
+    push 1
+    push 4
+    int 19
+    pop
+    jnz w_cas
+    inc r2
+    ldr r2
+    push 9999
+    lt
+    jnz w_loop
+    push 0
+    ret
+
+done:
@@ -2,21 +2,19 @@
 ; 9     char
 ; 10    int
 ; 11    float
+; 22    double
 
 ; switch to ARITH_FLOAT
 int 11
 
-; divide 2 integers to create the float '2.14159'
-mov r1 214159
-mov r2 100000
-div r1 r2 
+; a number with a '.' is a float literal, divide it by an integer to create the float '2.14159'
+mov r1 214159.0
+div r1 100000
 
 ; create another float '0.00159' 
-mov ax 159
-mov bx 100000
-div ax bx
+mov ax 0.00159
 
-; subtract '0.00159' to rount r1 to '2.14'
+; subtract '0.00159' to round r1 to '2.14'
 sub r1 ax ; 2.14
 
 ; add 1 so it is '3.14'
@@ -36,4 +34,25 @@ puts
 push 1
 gets
 push 'f'
-print
\ No newline at end of file
+print
+push 10
+printc
+
+; switch to ARITH_DOUBLE, the double registers are separate from the others
+; and take two words on the stack
+int 22
+mov r1 1
+div r1 3
+ldr r1
+push 'f'
+print
+push 10
+printc
+
+; convert the double on the stack to an int (int 26) and print it in int mode
+mov r2 42.75
+ldr r2
+int 26
+int 10
+push 'd'
+print
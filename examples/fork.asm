@@ -0,0 +1,95 @@
+; scatter/gather with int 21: 4 forks sum a quarter of a table each
+; the forks share the table copy on write, what they write stays in their own copy
+
+int 10
+; 4 byte cells
+int 2
+push 0
+push 1
+push 1
+puts
+mov r1 0
+fill:
+    mov r3 r1
+    mul r3 4
+    ldr r1
+    push 1
+    ldr r3
+    stm
+    inc r1
+    ldr r1
+    push 999
+    lt
+    jnz fill
+
+; r5 is the quarter of the fork, the ids of the forks stay on the stack
+mov r5 0
+forks:
+    int 21
+    pop ax
+    ldr ax
+    push 0
+    eq
+    jz worker
+    ldr ax
+    inc r5
+    ldr r5
+    push 3
+    lt
+    jnz forks
+
+mov cx 0
+mov r1 0
+gather:
+    int 14
+    pop bx
+    add cx bx
+    inc r1
+    ldr r1
+    push 3
+    lt
+    jnz gather
+
+; 499500
+ldr cx
+push 'd'
+print
+push 10
+printc
+; the forks wrote their copies only, 0
+push 1
+push 0
+ldm
+push 'd'
+print
+push 10
+printc
+jmp done
+
+; sum the cells r5 * 250 .. r5 * 250 + 249, the result is the top of the stack at END
+worker:
+    mov r1 r5
+    mul r1 250
+    mov r2 r1
+    add r2 249
+    mov bx 0
+w_loop:
+    mov r3 r1
+    mul r3 4
+    push 1
+    ldr r3
+    ldm
+    pop ax
+    add bx ax
+    inc r1
+    ldr r1
+    ldr r2
+    lt
+    jnz w_loop
+    push 77
+    push 1
+    push 0
+    stm
+    ldr bx
+
+done:
@@ -0,0 +1,54 @@
+; a table of squares is built once and written to a snapshot with int 20
+; vm --restore squares.snap continues behind the int with the table in memory and the zeroflag set
+
+int 10
+push 0
+push "squares.snap"
+si ax
+ldr ax
+push 1
+puts
+
+; 4 byte cells in location 2
+int 2
+push 0
+push 1
+push 2
+puts
+mov r1 0
+build:
+    mov r2 r1
+    mul r2 r1
+    mov r3 r1
+    mul r3 4
+    ldr r2
+    push 2
+    ldr r3
+    stm
+    inc r1
+    ldr r1
+    push 999
+    lt
+    jnz build
+
+push 1
+int 20
+jz restored
+push 'b'
+printc
+jmp lookup
+restored:
+push 'r'
+printc
+
+lookup:
+push 10
+printc
+; the square of 999
+push 2
+push 3996
+ldm
+push 'd'
+print
+push 10
+printc
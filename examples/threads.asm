@@ -0,0 +1,70 @@
+; green threads, int 13 spawns a vm at a label, int 14 joins it
+; every thread sums up 1..n, the results are joined and printed
+
+; int arithmetic, the spawned vms inherit the mode
+int 10
+
+; spawn 4 threads with 1 argument each
+push 20000
+push 1
+push sum
+int 13
+pop r5
+push 30000
+push 1
+push sum
+int 13
+pop r6
+push 40000
+push 1
+push sum
+int 13
+pop r7
+push 50000
+push 1
+push sum
+int 13
+pop r8
+
+; join them in order and print their results
+ldr r5
+int 14
+push 'd'
+print
+push 10
+printc
+ldr r6
+int 14
+push 'd'
+print
+push 10
+printc
+ldr r7
+int 14
+push 'd'
+print
+push 10
+printc
+ldr r8
+int 14
+push 'd'
+print
+push 10
+printc
+jmp done
+
+; n on the stack, leaves the sum on the stack and returns, which ends the thread
+sum:
+    pop r1
+    mov r2 0
+sum_loop:
+    add r2 r1
+    dec r1
+    ldr r1
+    push 0
+    lt
+    jz sum_loop
+    push r2
+    ret
+
+done:
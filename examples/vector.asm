@@ -0,0 +1,77 @@
+; vector instructions work on whole memory locations of 4 byte cells (int 2)
+; the cells are ints in int mode and floats in float and double mode
+
+int 2
+int 10
+
+; location 1 = 1 2 3 4 5, puts takes the last value pushed first
+push 5
+push 4
+push 3
+push 2
+push 1
+push 5
+push 1
+puts
+
+; location 2 = 10 20 30 40 50
+push 50
+push 40
+push 30
+push 20
+push 10
+push 5
+push 2
+puts
+
+; location 3 = location 1 + location 2
+push 3
+push 1
+push 2
+vadd
+
+; the sum of location 3 is 165
+push 3
+vsum
+push 'd'
+print
+push 10
+printc
+
+; location 3 = location 3 * 2
+push 3
+push 3
+push 2
+vscale
+
+; the dot product of location 1 and 3 is 1210
+push 1
+push 3
+vdot
+push 'd'
+print
+push 10
+printc
+
+; the same in float mode, location 4 = 0.5 1.5 2.5
+int 11
+push 2.5
+push 1.5
+push 0.5
+push 3
+push 4
+puts
+
+; location 5 = location 4 * 0.5
+push 5
+push 4
+push 0.5
+vscale
+
+; the biggest cell of location 5 is 1.25
+push 5
+vmax
+push 'f'
+print
+push 10
+printc
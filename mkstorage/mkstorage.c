@@ -19,6 +19,11 @@ compile with '-D _DEVEL' to use developer functions
 #include <termios.h>
 #endif
 
+/* header id of the journal format, "JRNL" */
+#define STORAGE_JOURNAL 0x4C4E524A
+/* record length of a deleted entry */
+#define STORAGE_DELETED -1
+
 /* the header of a storage file */
 struct header {
     int id;
@@ -32,216 +37,150 @@ struct entry {
     char *data;   
 };
 
-/* create an empty storage file, id 1, len 0 */
+/* a journal record, followed by len bytes of data */
+struct record {
+    int id;
+    int len;
+    unsigned int checksum;
+};
+
+/* FNV-1a over the record, has to match the vm's storageChecksum() */
+unsigned int checksum(int id, int len, const char *data) {
+    unsigned int h = 2166136261u;
+    const unsigned char *p = (const unsigned char *)&id;
+    int i;
+    for(i = 0; i < (int)sizeof(int); i++) { h ^= p[i]; h *= 16777619u; }
+    p = (const unsigned char *)&len;
+    for(i = 0; i < (int)sizeof(int); i++) { h ^= p[i]; h *= 16777619u; }
+    p = (const unsigned char *)data;
+    for(i = 0; i < len; i++) { h ^= p[i]; h *= 16777619u; }
+    return h;
+}
+
+void writeRecord(FILE *f, int id, int len, char *data) {
+    struct record r = {id, len, checksum(id, len, data)};
+    fwrite(&r, sizeof(struct record), 1, f);
+    if(len > 0)
+        fwrite(data, sizeof(char), len, f);
+}
+
+/* create an empty storage file, a journal without records */
 void create() {
     FILE *f = fopen("boot.dat", "wb");   
-    // create a header with id=1 and len=2 
-    struct header hdr = {1, 0};
+    struct header hdr = {STORAGE_JOURNAL, 0};
     fwrite(&hdr, sizeof(struct header), 1, f);    
     fclose(f);
 }
 
-/* create a file */
+/* create a file, the record is appended to the journal */
 void createFile(int newId, char *newdata, int dataLen) {
-    FILE *f = fopen("boot.dat", "rb");       
-    /* get the header */
-    struct header inhdr;
-    fread(&inhdr.id, sizeof(int), 1, f);
-    fread(&inhdr.len, sizeof(int), 1, f);
-    /* create a new list to store all existing entries */
-    struct entry list[inhdr.len];    
-    /* get the entries */
-    int id, len = 0; char *data; 
-    int inputLength = 0;
-    while(inputLength < inhdr.len) {    
-        fread(&id, sizeof(int), 1, f);
-        fread(&len, sizeof(int), 1, f);
-        /* reserve memory for <n> amount of data */
-        data = malloc((len + 1) * sizeof(char));
-        fread(data, sizeof(char), len, f);
-        struct entry e = {id, len, data};
-        list[inputLength] = e;
-        inputLength++;        
-    }    
-    fclose(f);    
-    f = fopen("boot.dat", "wb");    
-    /* increase header length by 1 and write it back to file */
-    struct header outhdr = {inhdr.id, inhdr.len + 1};
-    fwrite(&outhdr, sizeof(struct header), 1, f);    
-    /* write all pre existing data back to file */
-    int outputLength = 0;
-    while(outputLength < inputLength) {
-        fwrite(&list[outputLength].id, sizeof(int), 1, f);
-        fwrite(&list[outputLength].len, sizeof(int), 1, f);
-        fwrite(&list[outputLength].data[0], sizeof(char), list[outputLength].len, f);
-        outputLength++;
-    }
-    /* append the new one at the end */
-    struct entry e;   
-    e.id = newId;
-    e.data = newdata;
-    e.len = dataLen;
-    fwrite(&e.id, sizeof(int), 1, f);
-    fwrite(&e.len, sizeof(int), 1, f);
-    fwrite(e.data, sizeof(char), e.len, f);        
+    FILE *f = fopen("boot.dat", "ab");       
+    writeRecord(f, newId, dataLen, newdata);
     fclose(f);    
 }
 
-/* delete a file */
+/* delete a file, a deletion record is appended to the journal */
 void deleteFile(int entryId) {
-    FILE *f = fopen("boot.dat", "rb");       
-    /* get the header */
+    FILE *f = fopen("boot.dat", "ab");       
+    writeRecord(f, entryId, STORAGE_DELETED, NULL);
+    fclose(f);      
+}
+
+/* 
+compact a storage file in either format into a journal with only the live entries 
+the result is written to <src>.tmp and renamed
+*/
+void compact(char *src) {
+    FILE *f = fopen(src, "rb");
+    if(!f) {
+        printf("could not open '%s'\n", src);
+        return;
+    }
     struct header inhdr;
-    fread(&inhdr.id, sizeof(int), 1, f);
-    fread(&inhdr.len, sizeof(int), 1, f);
-    /* create a new list to store all existing entries */
-    struct entry list[inhdr.len];    
-    /* get the entries */
-    int id, len = 0; char *data; 
-    int inputLength = 0;
-    while(inputLength < inhdr.len) {    
-        fread(&id, sizeof(int), 1, f);
-        fread(&len, sizeof(int), 1, f);
-        /* reserve memory for <n> amount of data */
-        data = malloc((len + 1) * sizeof(char));
-        fread(data, sizeof(char), len, f);
-        struct entry e = {id, len, data};
-        list[inputLength] = e;
-        inputLength++;        
-    }    
-    fclose(f);
-    f = fopen("boot.dat", "wb");
-    /* decrease header length nby 1 and write it back to file */    
-    struct header outhdr;
-    outhdr.len = inhdr.len - 1;
-    fwrite(&outhdr.id, sizeof(int), 1, f);
-    fwrite(&outhdr.len, sizeof(int), 1, f);    
-    /* write all pre existed files back*/
-    int outputLength = 0;
-    while(outputLength < inputLength) {
-        if(list[outputLength].id == entryId) {
-            /* except the one to delete */
+    if(fread(&inhdr, sizeof(struct header), 1, f) != 1) {
+        fclose(f);
+        return;
+    }
+    int cap = 16, n = 0, i, j;
+    struct entry *list = malloc(cap * sizeof(struct entry));
+    while(inhdr.id == STORAGE_JOURNAL || n < inhdr.len) {
+        struct record r;
+        if(inhdr.id == STORAGE_JOURNAL) {
+            if(fread(&r, sizeof(struct record), 1, f) != 1 || r.len < STORAGE_DELETED) break;
         } else {
-            fwrite(&list[outputLength].id, sizeof(int), 1, f);
-            fwrite(&list[outputLength].len, sizeof(int), 1, f);
-            fwrite(&list[outputLength].data[0], sizeof(char), list[outputLength].len, f);
+            if(fread(&r.id, sizeof(int), 1, f) != 1 || fread(&r.len, sizeof(int), 1, f) != 1) break;
         }
-        outputLength++;
-    } 
-    fclose(f);      
+        int len = r.len > 0 ? r.len : 0;
+        char *data = malloc(len + 1);
+        if((int)fread(data, sizeof(char), len, f) != len) { free(data); break; }
+        /* a torn append ends the journal */
+        if(inhdr.id == STORAGE_JOURNAL && checksum(r.id, r.len, data) != r.checksum) { free(data); break; }
+        /* the last record of an id wins, drop the earlier one */
+        for(i = 0; i < n; i++) {
+            if(list[i].id == r.id) {
+                free(list[i].data);
+                for(j = i; j < n - 1; j++) list[j] = list[j + 1];
+                n--;
+                break;
+            }
+        }
+        if(r.len == STORAGE_DELETED) { free(data); continue; }
+        if(n == cap) {
+            cap *= 2;
+            list = realloc(list, cap * sizeof(struct entry));
+        }
+        struct entry e = {r.id, r.len, data};
+        list[n++] = e;
+    }
+    fclose(f);
+    char tmp[1024];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", src);
+    f = fopen(tmp, "wb");
+    struct header outhdr = {STORAGE_JOURNAL, n};
+    fwrite(&outhdr, sizeof(struct header), 1, f);
+    for(i = 0; i < n; i++) {
+        writeRecord(f, list[i].id, list[i].len, list[i].data);
+        free(list[i].data);
+    }
+    fclose(f);
+    free(list);
+    #ifdef _WIN32
+    remove(src);
+    #endif
+    rename(tmp, src);
+    printf("compacted '%s', %d entries\n", src, n);
 }
 
 /* this is just for devel releases */
 void createExample() {
-    FILE *f = fopen("boot.dat", "wb");   
-    // create a header with id=1 and len=2 
-    struct header hdr = {1, 10};
-    fwrite(&hdr, sizeof(struct header), 1, f);
-    char *data;
-    
-    data = "ZShell v0.1 Alpha Demo";
-    int id = 1;
-    int len = strlen(data);    
-    struct entry e = {id, len, data};
-    fwrite(&e.id, sizeof(int), 1, f);
-    fwrite(&e.len, sizeof(int), 1, f);
-    fwrite(e.data, sizeof(char), strlen(e.data), f);
-    
-    id = 2; 
-    data = "zs>";
-    len = strlen(data); 
-    e.id = id;
-    e.data = data;
-    e.len = len;
-    fwrite(&e.id, sizeof(int), 1, f);
-    fwrite(&e.len, sizeof(int), 1, f);
-    fwrite(e.data, sizeof(char), e.len, f);
-    
-    id = 3; 
-    data = "Powered by ZVM - Visit https://github.com/zarat/vm for more information"; 
-    len = strlen(data); 
-    e.id = id;
-    e.data = data;
-    e.len = len;
-    fwrite(&e.id, sizeof(int), 1, f);
-    fwrite(&e.len, sizeof(int), 1, f);
-    fwrite(e.data, sizeof(char), e.len, f);
-    
-    id = 4; 
-    data = "Available commands: info, help, exec, exit"; 
-    len = strlen(data); 
-    e.id = id;
-    e.data = data;
-    e.len = len;
-    fwrite(&e.id, sizeof(int), 1, f);
-    fwrite(&e.len, sizeof(int), 1, f);
-    fwrite(e.data, sizeof(char), e.len, f);
-    
-    id = 5; 
-    data = "info"; 
-    len = strlen(data) + 1; 
-    e.id = id;
-    e.data = data;
-    e.len = len;
-    fwrite(&e.id, sizeof(int), 1, f);
-    fwrite(&e.len, sizeof(int), 1, f);
-    fwrite(e.data, sizeof(char), e.len, f);
-    
-    id = 6; 
-    data = "help"; 
-    len = strlen(data) + 1; 
-    e.id = id;
-    e.data = data;
-    e.len = len;
-    fwrite(&e.id, sizeof(int), 1, f);
-    fwrite(&e.len, sizeof(int), 1, f);
-    fwrite(e.data, sizeof(char), e.len, f);
-    
-    id = 7; 
-    data = "exec"; 
-    len = strlen(data) + 1; 
-    e.id = id;
-    e.data = data;
-    e.len = len;
-    fwrite(&e.id, sizeof(int), 1, f);
-    fwrite(&e.len, sizeof(int), 1, f);
-    fwrite(e.data, sizeof(char), e.len, f);
-    
-    id = 8; 
-    data = "exit"; 
-    len = strlen(data) + 1; 
-    e.id = id;
-    e.data = data;
-    e.len = len;
-    fwrite(&e.id, sizeof(int), 1, f);
-    fwrite(&e.len, sizeof(int), 1, f);
-    fwrite(e.data, sizeof(char), e.len, f);
-    
-    id = 9; 
-    data = "unknown command: "; 
-    len = strlen(data); 
-    e.id = id;
-    e.data = data;
-    e.len = len;
-    fwrite(&e.id, sizeof(int), 1, f);
-    fwrite(&e.len, sizeof(int), 1, f);
-    fwrite(e.data, sizeof(char), e.len, f);
-    
-    id = 10; 
-    data = "command: "; 
-    len = strlen(data); 
-    e.id = id;
-    e.data = data;
-    e.len = len;
-    fwrite(&e.id, sizeof(int), 1, f);
-    fwrite(&e.len, sizeof(int), 1, f);
-    fwrite(e.data, sizeof(char), e.len, f);
-    
-    fclose(f);
+    char *data[] = {
+        "ZShell v0.1 Alpha Demo",
+        "zs>",
+        "Powered by ZVM - Visit https://github.com/zarat/vm for more information",
+        "Available commands: info, help, exec, exit",
+        "info",
+        "help",
+        "exec",
+        "exit",
+        "unknown command: ",
+        "command: "
+    };
+    /* the commands are stored with their \x00 terminator */
+    int terminated[] = { 0, 0, 0, 0, 1, 1, 1, 1, 0, 0 };
+    int id;
+    create();
+    for(id = 1; id <= 10; id++)
+        createFile(id, data[id - 1], strlen(data[id - 1]) + terminated[id - 1]);
 }
 
 int main(int argc, char **argv) {
     
+    /* compact a storage file, boot.dat by default */
+    if(argc >= 2 && strcmp(argv[1], "compact") == 0) {
+        compact(argc == 3 ? argv[2] : "boot.dat");
+        return 0;
+    }
+    
     /* by default just create an empty storage struct */
     if(argc == 2) {
         createExample();    
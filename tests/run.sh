@@ -0,0 +1,36 @@
+#!/bin/sh
+#
+# tests of the vm that need a writeable bootfile, run from the tests directory: ./run.sh [bindir]
+# bindir contains vm and as, it defaults to ".." like for bench
+#
+# storage_fork.asm writes the bootfile from a program and 3 forks at the same time, the file is
+# read back by storage_read.asm. races show up as lost or torn records, so it runs a few times in
+# every dispatch mode
+#
+
+BIN=$(cd "${1:-..}" && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+fail=0
+
+"$BIN/as" storage_fork.asm "$WORK/storage_fork.zvm" > /dev/null || exit 1
+"$BIN/as" storage_read.asm "$WORK/storage_read.zvm" > /dev/null || exit 1
+expected=$(grep '^; [0-9]' storage_read.asm | cut -c3-)
+
+cd "$WORK"
+printf '[general]\nbootfile = storage.dat\nwriteable = true\n' > vm.ini
+for flags in "" -t -c; do
+    for run in 1 2 3 4 5 6 7 8 9 10; do
+        rm -f storage.dat storage.dat.tmp
+        : > storage.dat
+        "$BIN/vm" $flags storage_fork.zvm
+        got=$("$BIN/vm" storage_read.zvm | tr '\n' ' ' | sed 's/ *$//')
+        if [ "$got" != "$expected" ]; then
+            echo "storage_fork $flags run $run: '$got', expected '$expected'"
+            fail=1
+        fi
+    done
+done
+
+[ $fail = 0 ] && echo "storage_fork OK"
+exit $fail
@@ -0,0 +1,64 @@
+; 3 forks and the program write the bootfile at the same time, see run.sh
+; vm k (0..3) writes location 100 + k: cell i = i * (k + 1), 300 cells with one stm each
+; every stm appends a record to the journal of the bootfile
+
+int 10
+int 2
+
+; r5 is the number of the vm, the ids of the forks stay on the stack
+mov r5 0
+forks:
+    int 21
+    pop ax
+    ldr ax
+    push 0
+    eq
+    jz fork
+    ldr ax
+    inc r5
+    ldr r5
+    push 2
+    lt
+    jnz forks
+
+; the program is vm 3
+call worker
+int 14
+pop ax
+int 14
+pop ax
+int 14
+pop ax
+jmp done
+
+worker:
+    mov r4 r5
+    add r4 100
+    push 0
+    push 1
+    ldr r4
+    puts
+    mov r6 r5
+    add r6 1
+    mov r1 0
+w_loop:
+    mov ax r1
+    mul ax r6
+    mov r3 r1
+    mul r3 4
+    push ax
+    ldr r4
+    ldr r3
+    stm
+    inc r1
+    ldr r1
+    push 299
+    lt
+    jnz w_loop
+    ret
+
+; a fork ends at done
+fork:
+    call worker
+
+done:
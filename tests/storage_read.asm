@@ -0,0 +1,17 @@
+; the sums of the locations storage_fork.asm wrote, read back from the bootfile
+; 44850 89700 134550 179400
+
+int 10
+mov r1 100
+loop:
+    ldr r1
+    vsum
+    push 'd'
+    print
+    push 10
+    printc
+    inc r1
+    ldr r1
+    push 103
+    lt
+    jnz loop
@@ -1,3 +1,3 @@
-gcc ini.c vm.c -o vm -I./include
+gcc ini.c vm.c -o vm -I./include -lpthread
 
 copy vm.exe ..
\ No newline at end of file
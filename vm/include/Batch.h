@@ -0,0 +1,149 @@
+/*
+Batch runner, vm --batch [-j<workers>] <program or directory>..
+
+Runs many programs in one process on a pool of worker threads, every job in its own VMState.
+The jobs share the workers through the scheduler (Scheduler.h), SCHEDULER_SLICE instructions at a time,
+so long running jobs don't hold up the others. Jobs read no input, read/readc get EOF.
+Directories are searched for .zvm files. vm.ini is parsed and the bootfile is mounted once, all jobs
+load their memory from the same read-only mapping, writes to the bootfile are disabled.
+The output of every job is collected in memory and written to stdout in the order of the jobs,
+as soon as all jobs before it are done. The result of every job goes to stderr.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+struct job {
+    char *file;
+    char *out;  // collected output
+    int len;
+    int status; // result of vmRun(), or BATCH_NOLOAD
+    int done;
+};
+
+/* status of a job whose program could not be read */
+#define BATCH_NOLOAD -2
+/* vms alive at the same time per worker */
+#define BATCH_ACTIVE 16
+
+struct batch {
+    struct job *jobs;
+    int count;
+    int cap;
+};
+
+static void batchAdd(struct batch *b, const char *file) {
+    if(b->count == b->cap) {
+        b->cap = b->cap ? b->cap * 2 : 64;
+        b->jobs = (struct job *)realloc(b->jobs, b->cap * sizeof(struct job));
+    }
+    memset(&b->jobs[b->count], 0, sizeof(struct job));
+    b->jobs[b->count++].file = strdup(file);
+}
+
+static int batchCompareNames(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* a program, or every .zvm file of a directory in name order */
+void batchAddPath(struct batch *b, const char *path) {
+    DIR *dir = opendir(path);
+    if(dir == NULL) {
+        batchAdd(b, path);
+        return;
+    }
+    int n = 0, cap = 64;
+    char **names = (char **)malloc(cap * sizeof(char *));
+    struct dirent *e;
+    while((e = readdir(dir)) != NULL) {
+        int len = strlen(e->d_name);
+        if(len < 4 || strcmp(e->d_name + len - 4, ".zvm") != 0)
+            continue;
+        if(n == cap) {
+            cap *= 2;
+            names = (char **)realloc(names, cap * sizeof(char *));
+        }
+        names[n++] = strdup(e->d_name);
+    }
+    closedir(dir);
+    qsort(names, n, sizeof(char *), batchCompareNames);
+    char file[4096];
+    for(int i = 0; i < n; i++) {
+        snprintf(file, sizeof(file), "%s/%s", path, names[i]);
+        batchAdd(b, file);
+        free(names[i]);
+    }
+    free(names);
+}
+
+/* create the vm of a job and hand it to the scheduler, returns 0 if the program can't be loaded */
+static int batchStart(VMScheduler *sched, struct job *j) {
+    VMState *vm = vmCreate();
+    vmSetOutput(vm, NULL);
+    vmSetInput(vm, NULL);
+    vmCloseInput(vm);
+    if(vmLoadFile(vm, j->file) != 0) {
+        vmDestroy(vm);
+        j->status = BATCH_NOLOAD;
+        j->done = 1;
+        return 0;
+    }
+    if(config.bootfile)
+        vmMount(vm, config.bootfile);
+    vmSetUserData(vm, j);
+    vmSchedule(sched, vm);
+    return 1;
+}
+
+/* keep the output of a stopped vm for its job */
+static void batchFinish(VMState *vm) {
+    struct job *j = (struct job *)vmUserData(vm);
+    int len;
+    const char *out = vmOutput(vm, &len);
+    j->out = (char *)malloc(len + 1);
+    if(len > 0)
+        memcpy(j->out, out, len);
+    j->len = len;
+    j->status = vmStatus(vm);
+    j->done = 1;
+    vmDestroy(vm);
+}
+
+/* run all jobs with the given number of workers (0: one per core), returns the number of failed jobs */
+int runBatch(struct batch *b, int workers) {
+    if(workers <= 0)
+        workers = schedulerCores();
+    /* the jobs share the mapped bootfile, nothing gets written back */
+    config.writeable = false;
+    config.writeback = false;
+    bootfilewriteable = false;
+    profile = false;
+    if(config.bootfile)
+        mountStorage(config.bootfile);
+    VMScheduler *sched = vmSchedulerCreate(workers, SCHEDULER_SLICE);
+    int next = 0, active = 0, failed = 0;
+    /* write the output of the jobs in order while the workers go on */
+    for(int i = 0; i < b->count; i++) {
+        struct job *j = &b->jobs[i];
+        while(!j->done) {
+            while(next < b->count && active < workers * BATCH_ACTIVE)
+                active += batchStart(sched, &b->jobs[next++]);
+            if(j->done)
+                break;
+            batchFinish(vmSchedulerNext(sched));
+            active--;
+        }
+        fwrite(j->out, 1, j->len, stdout);
+        fflush(stdout);
+        const char *result = j->status == VM_HALTED ? "halted" : j->status == BATCH_NOLOAD ? "could not be loaded" : "error";
+        fprintf(stderr, "[batch] %s: %s\n", j->file, result);
+        if(j->status != VM_HALTED)
+            failed++;
+        free(j->out);
+        free(j->file);
+    }
+    vmSchedulerDestroy(sched);
+    return failed;
+}
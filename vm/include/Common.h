@@ -43,6 +43,38 @@ enum {
     DEC,
     CALL,
     INT,
+    /*
+    Superinstructions, only emitted by the assembler (parser.cpp)
+    */
+    SARITH, // pop b, pop a, <op> a b, push a. a and b are dst and src, the op is the value
+    LDMI,   // push loc, push pos, ldm. loc is the value, pos is dst << 8 | src
+    STMI,   // push loc, push pos, stm, like LDMI
+    MODES,  // int 1/2 and int 9/10/11/22 at once, the memory mode code in dst, the arith mode code in src
+    VEC,    // vector instructions on memory locations (vadd, vdot, ...), the operation is the value, see Vector.h
+    /*
+    Mode specialised opcodes, never in a binary. The loader replaces the generic opcode with them where
+    it can tell the mode (specialise() in vm.c), one per arithmetic mode (char, int, float, double) or 
+    memory mode (char, int) in that order
+    */
+    ADD_CHAR, ADD_INT, ADD_FLOAT, ADD_DOUBLE,
+    SUB_CHAR, SUB_INT, SUB_FLOAT, SUB_DOUBLE,
+    MUL_CHAR, MUL_INT, MUL_FLOAT, MUL_DOUBLE,
+    DIV_CHAR, DIV_INT, DIV_FLOAT, DIV_DOUBLE,
+    MOD_CHAR, MOD_INT, MOD_FLOAT, MOD_DOUBLE,
+    INC_CHAR, INC_INT, INC_FLOAT, INC_DOUBLE,
+    DEC_CHAR, DEC_INT, DEC_FLOAT, DEC_DOUBLE,
+    PRINT_CHAR, PRINT_INT, PRINT_FLOAT, PRINT_DOUBLE,
+    SARITH_CHAR, SARITH_INT, SARITH_FLOAT, SARITH_DOUBLE,
+    MOV_CHAR, MOV_INT, MOV_FLOAT, MOV_DOUBLE,
+    PUSH_CHAR, PUSH_INT, PUSH_FLOAT, PUSH_DOUBLE,
+    POP_CHAR, POP_INT, POP_FLOAT, POP_DOUBLE,
+    LDR_CHAR, LDR_INT, LDR_FLOAT, LDR_DOUBLE,
+    LDM_CHAR, LDM_INT,
+    STM_CHAR, STM_INT,
+    PUTS_CHAR, PUTS_INT,
+    GETS_CHAR, GETS_INT,
+    LDMI_CHAR, LDMI_INT,
+    STMI_CHAR, STMI_INT,
     /* 
     Internal opcodes    
     */ 
@@ -81,27 +113,51 @@ char *int2bin(int n) {
     return strdup(test);
 }
 
-/* display an error message, if 2nd parameter is true, shut down */
+/* 
+display an error message, if 2nd parameter is true, shut down
+pending data of the vm is written first, vmFlush() is defined in vm.c
+*/
+void vmFlush();
+void vmCrashOutput();
+
 void error_exit(char *errorMessage, bool shutdown) {
+    vmFlush();
     printf("%s\n", errorMessage);
     if(shutdown) exit(1);
 }
 
+
+/*
+SIGINT/SIGTERM, set by catch_function(). the vm that sees it next at a jump or call writes what is
+pending and exits (vmSignalled() in vm.c), a second one exits at once
+*/
+volatile sig_atomic_t vmSignal = 0;
+
+/* a signal handler may only write(), stdio and locks could be in use by the interrupted thread */
+static void signalMessage(const char *msg) {
+    ssize_t n = write(STDOUT_FILENO, msg, strlen(msg));
+    (void)n;
+}
+
 void catch_function(int sig) {    
-    if(sig == SIGINT) {
-        error_exit("\n[kern] Prozess unerwartet beendet.", false);
+    if(sig == SIGINT || sig == SIGTERM) {
+        if(vmSignal == 0) {
+            vmSignal = sig;
+            return;
+        }
+        signalMessage("\n[kern] VM wird unerwartet beendet.\n\n");
+        _exit(1);
     }
     if(sig == SIGABRT) {
-        error_exit("\n[kern] VM zeigt abnormales Verhalten!\n", false);
+        signalMessage("\n[kern] VM zeigt abnormales Verhalten!\n\n");
     }
     if(sig == SIGILL) {
-        error_exit("\n[kern] Illegaler Hardwarebefehl!\n", false);
+        signalMessage("\n[kern] Illegaler Hardwarebefehl!\n\n");
     }
     if(sig == SIGSEGV) {
-        error_exit("\n[kern] Segmentfehler! VM wird beendet.\n", true);
-    }
-    if(sig == SIGTERM) {
-        error_exit("\n[kern] VM wird unerwartet beendet.\n", true);
+        vmCrashOutput();
+        signalMessage("\n[kern] Segmentfehler! VM wird beendet.\n\n");
+        _exit(1);
     }
     return;
 }
@@ -0,0 +1,214 @@
+/*
+Console output of the vm
+
+WRITE, PRINT and PRINTC don't call printf for every value. They collect their output in a buffer that
+is written with a single fwrite when it is full, before the vm reads from stdin (READ/READC),
+at the end of a program and on int 12.
+Integers and %f floats are formatted directly into the buffer, other formats fall back to snprintf.
+Every vm has its own console, writing to its own stream (stdout by default). A console without a
+stream collects the output in memory instead (vm --batch), see consoleCollected().
+READ and READC read from the input stream of the console, stdin by default. Without input stream
+they take what consoleQueue() appended and report that they have to wait if there is nothing yet.
+*/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CONSOLE_BUFFER 65536
+
+struct console {
+    char buf[CONSOLE_BUFFER];
+    int len;
+    FILE *out;
+    /* everything flushed so far if out is NULL */
+    char *collected;
+    int collectedLen;
+    int collectedCap;
+    FILE *in;
+    /* queued input if in is NULL, the unread part is queue[queuePos..queueLen] */
+    char *queue;
+    int queuePos;
+    int queueLen;
+    int queueCap;
+    unsigned long long queued; // bytes queued so far
+    int queueClosed;           // no more input will be queued
+};
+
+/* consoleReadChar() without input */
+#define CONSOLE_WAIT -2
+
+static void consoleEmit(struct console *c, const char *s, int len) {
+    if(c->out != NULL) {
+        fwrite(s, 1, len, c->out);
+        return;
+    }
+    if(c->collectedLen + len > c->collectedCap) {
+        while(c->collectedLen + len > c->collectedCap)
+            c->collectedCap = c->collectedCap ? c->collectedCap * 2 : CONSOLE_BUFFER;
+        c->collected = (char *)realloc(c->collected, c->collectedCap);
+    }
+    memcpy(c->collected + c->collectedLen, s, len);
+    c->collectedLen += len;
+}
+
+/* write the buffer to the output stream */
+void consoleFlush(struct console *c) {
+    if(c->len > 0)
+        consoleEmit(c, c->buf, c->len);
+    c->len = 0;
+    if(c->out != NULL)
+        fflush(c->out);
+}
+
+/* the collected output of a console without stream, len is set to its length */
+const char *consoleCollected(struct console *c, int *len) {
+    consoleFlush(c);
+    *len = c->collectedLen;
+    return c->collected;
+}
+
+void consoleWrite(struct console *c, const char *s, int len) {
+    if(len > CONSOLE_BUFFER - c->len) {
+        consoleFlush(c);
+        /* too big for the buffer, write it directly */
+        if(len >= CONSOLE_BUFFER) {
+            consoleEmit(c, s, len);
+            return;
+        }
+    }
+    memcpy(c->buf + c->len, s, len);
+    c->len += len;
+}
+
+void consoleChar(struct console *c, char ch) {
+    if(c->len == CONSOLE_BUFFER)
+        consoleFlush(c);
+    c->buf[c->len++] = ch;
+}
+
+/* printf into the console, for messages and dumps */
+void consolePrintf(struct console *c, const char *fmt, ...) {
+    char tmp[1024];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(tmp, sizeof(tmp), fmt, args);
+    va_end(args);
+    if(n > 0)
+        consoleWrite(c, tmp, n < (int)sizeof(tmp) ? n : (int)sizeof(tmp) - 1);
+}
+
+/* an unsigned integer in base 8, 10 or 16 */
+void consoleUnsigned(struct console *c, unsigned int v, unsigned int base, int upper) {
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char tmp[16];
+    int n = sizeof(tmp);
+    do {
+        tmp[--n] = digits[v % base];
+        v /= base;
+    } while(v > 0);
+    consoleWrite(c, tmp + n, sizeof(tmp) - n);
+}
+
+void consoleInt(struct console *c, int v) {
+    if(v < 0) {
+        consoleChar(c, '-');
+        consoleUnsigned(c, 0u - (unsigned int)v, 10, 0);
+    } else {
+        consoleUnsigned(c, (unsigned int)v, 10, 0);
+    }
+}
+
+/*
+a float like printf's %f, with 6 decimals
+f * 1000000 is exact in a double (24 + 14 significant bits), so rounding it half to even gives the
+same digits as printf. returns 0 for nan, inf and values too large, the caller falls back to snprintf
+*/
+int consoleFloat(struct console *c, float f) {
+    double d = f;
+    if(d != d || d > 9e12 || d < -9e12)
+        return 0;
+    unsigned int bits;
+    memcpy(&bits, &f, sizeof(bits));
+    int neg = bits >> 31; // includes -0.0, printf prints "-0.000000" too
+    double scaled = (neg ? -d : d) * 1000000.0;
+    long long units = (long long)scaled;
+    double frac = scaled - (double)units;
+    if(frac > 0.5 || (frac == 0.5 && (units & 1)))
+        units++;
+    char tmp[32];
+    int n = sizeof(tmp);
+    for(int i = 0; i < 6; i++) {
+        tmp[--n] = '0' + units % 10;
+        units /= 10;
+    }
+    tmp[--n] = '.';
+    do {
+        tmp[--n] = '0' + units % 10;
+        units /= 10;
+    } while(units > 0);
+    if(neg)
+        tmp[--n] = '-';
+    consoleWrite(c, tmp + n, sizeof(tmp) - n);
+    return 1;
+}
+
+/* append input for READ/READC of a console without input stream */
+void consoleQueue(struct console *c, const char *s, int len) {
+    if(c->queuePos > 0 && c->queuePos == c->queueLen)
+        c->queuePos = c->queueLen = 0;
+    if(c->queueLen + len > c->queueCap) {
+        /* drop what was read before growing */
+        memmove(c->queue, c->queue + c->queuePos, c->queueLen - c->queuePos);
+        c->queueLen -= c->queuePos;
+        c->queuePos = 0;
+        while(c->queueLen + len > c->queueCap)
+            c->queueCap = c->queueCap ? c->queueCap * 2 : 1024;
+        c->queue = (char *)realloc(c->queue, c->queueCap);
+    }
+    memcpy(c->queue + c->queueLen, s, len);
+    c->queueLen += len;
+    c->queued += len;
+}
+
+/*
+a line of input without the newline, lines longer than size - 1 are read in parts like fgets does
+returns 0 if the queue holds no complete line yet and more input can come
+*/
+int consoleReadLine(struct console *c, char *buf, int size) {
+    buf[0] = '\0';
+    if(c->in != NULL) {
+        if(fgets(buf, size, c->in) != NULL)
+            buf[strcspn(buf, "\n")] = '\0';
+        return 1;
+    }
+    int avail = c->queueLen - c->queuePos;
+    char *start = c->queue + c->queuePos;
+    char *nl = avail > 0 ? (char *)memchr(start, '\n', avail) : NULL;
+    int len = nl ? (int)(nl - start) : avail;
+    if(nl == NULL && len < size - 1 && !c->queueClosed)
+        return 0;
+    if(len > size - 1)
+        len = size - 1;
+    else if(nl != NULL)
+        c->queuePos++; // the newline
+    memcpy(buf, start, len);
+    buf[len] = '\0';
+    c->queuePos += len;
+    return 1;
+}
+
+/* a character of input, EOF at the end, CONSOLE_WAIT if the queue is empty and more input can come */
+int consoleReadChar(struct console *c) {
+    if(c->in != NULL) {
+        #ifdef _WIN32
+        if(c->in == stdin)
+            return getch();
+        #endif
+        return fgetc(c->in);
+    }
+    if(c->queuePos < c->queueLen)
+        return (unsigned char)c->queue[c->queuePos++];
+    return c->queueClosed ? EOF : CONSOLE_WAIT;
+}
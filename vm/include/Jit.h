@@ -0,0 +1,846 @@
+/*
+Native code, vm -c
+
+A template JIT for x86-64 behind the interpreter. The interpreter counts the backward jumps and the
+calls of every target, once a target gets JIT_HOT of them the loop or the function that starts there
+is translated into machine code, every instruction into a fixed template, and runs there from then on.
+Code that only runs a few times is never translated, short programs start like without -c.
+
+The arithmetic of a region is translated for the mode it runs in: the mode active when it got hot
+at its start, int 9/10/11 inside change it. Where it isn't known (behind int <register>, or where
+paths in different modes meet) the arithmetic calls back into the interpreter. Every block start is
+entered in its mode only, by the interpreter and by ret, other modes run in the interpreter and may
+get hot there. The memory instructions read the memory mode in their handlers, the code doesn't
+depend on it.
+
+The vm stays in rbx the whole time, registers, stacks, pc and zeroflag stay in the VMState, so the
+C handlers see everything as usual. mov, push, pop, ldr, si, the arithmetic, the compares, jmp,
+jz, jnz, call, ret and the mode ints are native, jumps inside the region go straight to their
+target. Everything else (memory, console, storage, other ints, stack over- and underflow, division
+by 0) calls back into eval() for that one instruction.
+
+A block runs from a jump target or from behind a jump, call, ret, int or read to the next one. Its
+instructions are counted when it starts, if they don't fit in the budget of vmRun() the native code
+stops in front of it and the interpreter runs them. The native code also stops when a callback moves
+pc, halts or blocks the vm and when it jumps out of the region, the interpreter goes on from there.
+
+Spawned and forked vms share the counters and the code of their parent. Other platforms run the
+interpreter with -c.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define JIT_X86_64
+#include <sys/mman.h>
+#endif
+
+/* backward jumps or calls of a target until it is translated */
+#define JIT_HOT 1000
+/* the most instructions of a region */
+#define JIT_REGION 8192
+
+struct jitcode {
+    unsigned char *enter; // the entry trampoline, see jitenter
+    void **entry[4];      // per arithmetic mode the code of every translated block start, or NULL
+    char *start;          // the blocks of the program, start[i] is set if a block starts at i
+    int *rest;            // instructions behind each one up to the end of its block
+    int *hot;             // backward jumps and calls of every target
+    char *tried;          // the arithmetic modes a target got hot in, bit 1 << mode
+    unsigned char **code; // the regions, unmapped with the last vm
+    long *size;
+    int regions;
+    int refs;             // vms running it
+    pthread_mutex_t lock; // translating
+};
+
+/* the code starts at native address at, returns when the interpreter has to go on at vm->pc */
+typedef void (*jitenter)(VMState *vm, void *at);
+
+struct jitcode *jitShare(struct jitcode *j) {
+    if(j != NULL)
+        __atomic_add_fetch(&j->refs, 1, __ATOMIC_RELAXED);
+    return j;
+}
+
+void jitRelease(struct jitcode *j) {
+    if(j == NULL || __atomic_sub_fetch(&j->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+#ifdef JIT_X86_64
+    munmap(j->enter, 16);
+    for(int i = 0; i < j->regions; i++)
+        munmap(j->code[i], j->size[i]);
+#endif
+    for(int m = 0; m < 4; m++)
+        free(j->entry[m]);
+    free(j->start);
+    free(j->rest);
+    free(j->hot);
+    free(j->tried);
+    free(j->code);
+    free(j->size);
+    pthread_mutex_destroy(&j->lock);
+    free(j);
+}
+
+/*
+run instruction i with the interpreter, returns 1 if the native code has to stop behind it.
+steps counts up to i like in the interpreter while it runs, vmBlock() and int 15 see the right count
+*/
+static int jitStep(VMState *vm, int i) {
+    int rest = vm->jit->rest[i];
+    vm->steps -= rest;
+    vm->instrNum = vm->program.op[i];
+    vm->reg1 = vm->program.dst[i];
+    vm->reg2 = vm->program.src[i];
+    vm->value = vm->program.imm[i];
+    vm->pc = i + 1;
+    eval(vm);
+    if(vm->pc != i + 1 || !vm->running || vm->steps == vm->limit)
+        return 1;
+    vm->steps += rest;
+    return 0;
+}
+
+static void jitSync(VMState *vm) {
+    syncCheck(vm);
+}
+
+#ifdef JIT_X86_64
+
+/*
+the machine code of a region being written, labels are offsets into it: the code of the instructions
+from..to, their slow paths and the exit
+*/
+struct jitasm {
+    unsigned char *buf;
+    long len;
+    long cap;
+    long *labels;   // -1 until bound
+    long *fixes;    // rel32 to patch, pairs of offset and label
+    int fixCount;
+    int fixCap;
+    int from;
+    int to;
+};
+
+/* x86 registers and condition codes */
+enum { EAX = 0, ECX = 1, EDX = 2 };
+enum { CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A = 0x7, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF };
+
+#define JIT_VM(field) ((int)offsetof(VMState, field))
+#define JIT_REG(r) (JIT_VM(regs) + 4 * (r))
+#define JIT_DREG(r) (JIT_VM(dregs) + 8 * (r))
+
+static void jitByte(struct jitasm *a, int b) {
+    if(a->len == a->cap) {
+        a->cap = a->cap * 2 + 256;
+        a->buf = (unsigned char *)realloc(a->buf, a->cap);
+    }
+    a->buf[a->len++] = (unsigned char)b;
+}
+
+static void jitWord(struct jitasm *a, int w) {
+    for(int k = 0; k < 4; k++)
+        jitByte(a, (unsigned int)w >> (8 * k));
+}
+
+static void jitQuad(struct jitasm *a, unsigned long long q) {
+    for(int k = 0; k < 8; k++)
+        jitByte(a, q >> (8 * k));
+}
+
+/* an opcode of up to 3 bytes, the first byte in the highest one */
+static void jitOp(struct jitasm *a, int op) {
+    if(op > 0xFFFF)
+        jitByte(a, op >> 16);
+    if(op > 0xFF)
+        jitByte(a, op >> 8);
+    jitByte(a, op);
+}
+
+/* op reg, [rbx + disp] */
+static void jitMem(struct jitasm *a, int op, int reg, int disp) {
+    jitOp(a, op);
+    jitByte(a, 0x83 | reg << 3);
+    jitWord(a, disp);
+}
+
+/* op reg, [rbx + rcx * 4 + disp], an entry of the stack or the returnstack */
+static void jitSlot(struct jitasm *a, int op, int reg, int disp) {
+    jitOp(a, op);
+    jitByte(a, 0x84 | reg << 3);
+    jitByte(a, 0x8B);
+    jitWord(a, disp);
+}
+
+static void jitBind(struct jitasm *a, int label) {
+    a->labels[label] = a->len;
+}
+
+/* jmp (cc < 0) or jcc to a label */
+static void jitJump(struct jitasm *a, int cc, int label) {
+    if(cc < 0)
+        jitByte(a, 0xE9);
+    else
+        jitOp(a, 0x0F80 | cc);
+    if(a->fixCount == a->fixCap) {
+        a->fixCap *= 2;
+        a->fixes = (long *)realloc(a->fixes, a->fixCap * 2 * sizeof(long));
+    }
+    a->fixes[a->fixCount * 2] = a->len;
+    a->fixes[a->fixCount * 2 + 1] = label;
+    a->fixCount++;
+    jitWord(a, 0);
+}
+
+/* a short jmp (cc < 0) or jcc inside a template, returns what jitLand() needs */
+static long jitShort(struct jitasm *a, int cc) {
+    jitByte(a, cc < 0 ? 0xEB : 0x70 | cc);
+    jitByte(a, 0);
+    return a->len;
+}
+
+static void jitLand(struct jitasm *a, long from) {
+    a->buf[from - 1] = (unsigned char)(a->len - from);
+}
+
+/* call fn(vm, arg) */
+static void jitCall(struct jitasm *a, void *fn, int arg) {
+    jitOp(a, 0x4889DF);       // mov rdi, rbx
+    jitByte(a, 0xBE);         // mov esi, arg
+    jitWord(a, arg);
+    jitOp(a, 0x48B8);         // mov rax, fn
+    jitQuad(a, (unsigned long long)(size_t)fn);
+    jitOp(a, 0xFFD0);         // call rax
+}
+
+static int jitLabel(struct jitasm *a, int i) {
+    return i - a->from;
+}
+
+static int jitSlow(struct jitasm *a, int i) {
+    return a->to - a->from + 1 + i - a->from;
+}
+
+static int jitExit(struct jitasm *a) {
+    return 2 * (a->to - a->from + 1);
+}
+
+/* instruction i by the interpreter, stop if it says so */
+static void jitHelper(struct jitasm *a, int i) {
+    jitCall(a, (void *)jitStep, i);
+    jitOp(a, 0x85C0);         // test eax, eax
+    jitJump(a, CC_NE, jitExit(a));
+}
+
+/* stop and let the interpreter go on at pc, rest instructions of the block were counted but don't run */
+static void jitLeave(struct jitasm *a, int pc, int rest) {
+    if(rest > 0) {
+        jitMem(a, 0x4881, 5, JIT_VM(steps));        // sub qword [steps], rest
+        jitWord(a, rest);
+    }
+    jitMem(a, 0xC7, EAX, JIT_VM(pc));
+    jitWord(a, pc);
+    jitJump(a, -1, jitExit(a));
+}
+
+/* jmp (cc < 0) or jcc to instruction to, the interpreter goes on there if it is outside the region */
+static void jitBranch(struct jitasm *a, int cc, int to) {
+    if(to >= a->from && to <= a->to) {
+        jitJump(a, cc, jitLabel(a, to));
+        return;
+    }
+    long skip = 0;
+    if(cc >= 0)
+        skip = jitShort(a, cc ^ 1);
+    jitLeave(a, to, 0);
+    if(cc >= 0)
+        jitLand(a, skip);
+}
+
+/* syncCheck() if the write-back has dirty locations or a signal arrived, like the jumps of the interpreter */
+static void jitSyncCheck(struct jitasm *a) {
+    jitMem(a, 0x488B, EAX, JIT_VM(mem));         // mov rax, [vm->mem]
+    jitOp(a, 0x83B8);                            // cmp dword [rax + dirtyCount], 0
+    jitWord(a, (int)offsetof(struct memstore, dirtyCount));
+    jitByte(a, 0);
+    long dirty = jitShort(a, CC_NE);
+    jitOp(a, 0x48B8);                            // mov rax, &vmSignal
+    jitQuad(a, (unsigned long long)(size_t)&vmSignal);
+    jitOp(a, 0x833800);                          // cmp dword [rax], 0
+    long clean = jitShort(a, CC_E);
+    jitLand(a, dirty);
+    jitCall(a, (void *)jitSync, 0);
+    jitLand(a, clean);
+}
+
+/* ecx = pstack, to slow if it has less than n values, or no room for -n more */
+static void jitStackCheck(struct jitasm *a, int n, int slow) {
+    jitMem(a, 0x8B, ECX, JIT_VM(pstack));
+    jitOp(a, 0x81F9);                             // cmp ecx, imm32
+    jitWord(a, n > 0 ? n : STACK_SIZE + n + 1);
+    jitJump(a, n > 0 ? CC_L : CC_GE, slow);
+}
+
+/* eax/ecx = the second operand of an arithmetic instruction, a register or the immediate value */
+static void jitOperand(struct jitasm *a, int reg, int src, int value, bool asChar) {
+    if(src != 0) {
+        if(asChar)
+            jitMem(a, 0x0FBE, reg, JIT_REG(src));    // movsx reg, byte [src]
+        else
+            jitMem(a, 0x8B, reg, JIT_REG(src));
+    } else {
+        jitByte(a, 0xB8 | reg);                    // mov reg, imm32
+        jitWord(a, asChar ? (char)value : value);
+    }
+}
+
+/* add, sub, mul, div and mod in char or int mode, asChar only changes the low byte of dst */
+static void jitArith(struct jitasm *a, int op, int dst, int src, int value, bool asChar, int slow) {
+    if(op == ADD || op == SUB) {
+        jitMem(a, asChar ? 0x8A : 0x8B, EAX, JIT_REG(dst));
+        if(src != 0) {
+            int code = op == ADD ? (asChar ? 0x02 : 0x03) : (asChar ? 0x2A : 0x2B);
+            jitMem(a, code, EAX, JIT_REG(src));
+        } else if(asChar) {
+            jitByte(a, op == ADD ? 0x04 : 0x2C);       // add/sub al, imm8
+            jitByte(a, value);
+        } else {
+            jitByte(a, op == ADD ? 0x05 : 0x2D);       // add/sub eax, imm32
+            jitWord(a, value);
+        }
+        jitMem(a, asChar ? 0x88 : 0x89, EAX, JIT_REG(dst));
+        return;
+    }
+    if(op == MUL) {
+        /* the low byte of the product only depends on the low bytes */
+        jitMem(a, 0x8B, EAX, JIT_REG(dst));
+        if(src != 0) {
+            jitMem(a, 0x0FAF, EAX, JIT_REG(src));     // imul eax, [src]
+        } else {
+            jitOp(a, 0x69C0);                         // imul eax, eax, imm32
+            jitWord(a, value);
+        }
+        jitMem(a, asChar ? 0x88 : 0x89, EAX, JIT_REG(dst));
+        return;
+    }
+    /* div and mod, division by 0 and by -1 are left to the interpreter */
+    if(asChar)
+        jitMem(a, 0x0FBE, EAX, JIT_REG(dst));
+    else
+        jitMem(a, 0x8B, EAX, JIT_REG(dst));
+    jitOperand(a, ECX, src, value, asChar);
+    jitOp(a, 0x85C9);                                 // test ecx, ecx
+    jitJump(a, CC_E, slow);
+    jitOp(a, 0x83F9FF);                               // cmp ecx, -1
+    jitJump(a, CC_E, slow);
+    jitByte(a, 0x99);                                 // cdq
+    jitOp(a, 0xF7F9);                                 // idiv ecx
+    int result = op == DIV ? EAX : EDX;
+    jitMem(a, asChar ? 0x88 : 0x89, result, JIT_REG(dst));
+}
+
+/*
+add, sub, mul, div, inc and dec in float mode like op_add() and the others, on the float registers.
+an int immediate value is converted, a float literal (IMM_FLOAT) is taken as it is
+*/
+static void jitFloat(struct jitasm *a, int op, int dst, int src, int value) {
+    int code = op == ADD || op == INC ? 0x58 : op == SUB || op == DEC ? 0x5C : op == MUL ? 0x59 : 0x5E;
+    jitMem(a, 0xF30F10, 0, JIT_REG(dst));              // movss xmm0, [dst]
+    if(src == IMM_FLOAT) {
+        jitByte(a, 0xB8);                             // mov eax, imm32
+        jitWord(a, value);
+        jitOp(a, 0x660F6E);                           // movd xmm1, eax
+        jitByte(a, 0xC8);
+    } else if(op == INC || op == DEC || src == 0) {
+        jitByte(a, 0xB8);                             // mov eax, imm32
+        jitWord(a, op == INC || op == DEC ? 1 : value);
+        jitOp(a, 0xF30F2A);                           // cvtsi2ss xmm1, eax
+        jitByte(a, 0xC8);
+    } else {
+        jitMem(a, 0xF30F10, 1, JIT_REG(src));          // movss xmm1, [src]
+    }
+    jitOp(a, 0xF30F00 | code);                        // addss/subss/mulss/divss xmm0, xmm1
+    jitByte(a, 0xC1);
+    jitMem(a, 0xF30F11, 0, JIT_REG(dst));              // movss [dst], xmm0
+}
+
+/* jitFloat in double mode on the double registers, a float literal is widened */
+static void jitDouble(struct jitasm *a, int op, int dst, int src, int value) {
+    int code = op == ADD || op == INC ? 0x58 : op == SUB || op == DEC ? 0x5C : op == MUL ? 0x59 : 0x5E;
+    jitMem(a, 0xF20F10, 0, JIT_DREG(dst));             // movsd xmm0, [dst]
+    if(src == IMM_FLOAT) {
+        jitByte(a, 0xB8);                             // mov eax, imm32
+        jitWord(a, value);
+        jitOp(a, 0x660F6E);                           // movd xmm1, eax
+        jitByte(a, 0xC8);
+        jitOp(a, 0xF30F5A);                           // cvtss2sd xmm1, xmm1
+        jitByte(a, 0xC9);
+    } else if(op == INC || op == DEC || src == 0) {
+        jitByte(a, 0xB8);                             // mov eax, imm32
+        jitWord(a, op == INC || op == DEC ? 1 : value);
+        jitOp(a, 0xF20F2A);                           // cvtsi2sd xmm1, eax
+        jitByte(a, 0xC8);
+    } else {
+        jitMem(a, 0xF20F10, 1, JIT_DREG(src));         // movsd xmm1, [src]
+    }
+    jitOp(a, 0xF20F00 | code);                        // addsd/subsd/mulsd/divsd xmm0, xmm1
+    jitByte(a, 0xC1);
+    jitMem(a, 0xF20F11, 0, JIT_DREG(dst));             // movsd [dst], xmm0
+}
+
+/* the float of a literal */
+static float jitLiteral(int bits) {
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+/* the bits of a float */
+static int jitBits(float f) {
+    int bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+/* the blocks of the program, start[i] is set if a block starts at i */
+static void jitBlocks(VMState *vm, char *start, int *rest) {
+    int len = vm->program.len;
+    memset(start, 0, len + 2);
+    start[0] = 1;
+    for(int i = 0; i <= len; i++) {
+        int op = opGeneric(vm->program.op[i]), to = vm->program.imm[i];
+        if((op == JMP || op == JZ || op == JNZ || op == CALL) && to >= 0 && to <= len)
+            start[to] = 1;
+        if(op == JMP || op == JZ || op == JNZ || op == CALL || op == RET || op == INT || op == READ || op == READC || op == END)
+            start[i + 1] = 1;
+    }
+    rest[len] = 0;
+    for(int i = len - 1; i >= 0; i--)
+        rest[i] = start[i + 1] ? 0 : rest[i + 1] + 1;
+}
+
+/*
+the last instruction of the region that starts at the hot target from. a loop goes at least up to its
+backward jump back, a function (back == from) up to a jmp, ret or END. both also take in the code
+their forward jumps go to, like the body of an if that is moved behind the loop
+*/
+static int jitExtent(VMState *vm, int from, int back) {
+    int len = vm->program.len, furthest = back;
+    for(int i = from; i <= len && i - from < JIT_REGION; i++) {
+        int op = opGeneric(vm->program.op[i]), to = vm->program.imm[i];
+        if((op == JMP || op == JZ || op == JNZ) && to > i && to <= len && to > furthest)
+            furthest = to;
+        if(i < furthest)
+            continue;
+        if(op == JMP || op == RET || op == END || (back > from && i == back))
+            return i;
+    }
+    return from + JIT_REGION - 1 < len ? from + JIT_REGION - 1 : len;
+}
+
+/* the arithmetic mode behind instruction i that runs in mode, 0 if it isn't known */
+static int jitModeBehind(VMState *vm, int i, int mode) {
+    int op = opGeneric(vm->program.op[i]), dst = vm->program.dst[i], src = vm->program.src[i], value = vm->program.imm[i];
+    if(op == INT && dst != 0)
+        return 0;
+    if(op == INT && ((value >= 9 && value <= 11) || value == 22))
+        return value == 9 ? ARITH_CHAR : value == 10 ? ARITH_INT : value == 11 ? ARITH_FLOAT : ARITH_DOUBLE;
+    if(op == MODES && src != 0)
+        return src == 9 ? ARITH_CHAR : src == 10 ? ARITH_INT : src == 11 ? ARITH_FLOAT : ARITH_DOUBLE;
+    return mode;
+}
+
+/* mode[i] where ways into it meet, -1 is not set yet, 0 is not known */
+static bool jitMeet(int *mode, int i, int m) {
+    if(mode[i] == m || mode[i] == 0)
+        return false;
+    mode[i] = mode[i] == -1 ? m : 0;
+    return true;
+}
+
+/*
+the arithmetic mode of every instruction of the region from..to, entered at from in mode.
+the region is also entered at its other block starts, in the mode they get here
+*/
+static void jitModes(VMState *vm, int from, int to, int entered, int *mode) {
+    for(int i = from; i <= to; i++)
+        mode[i - from] = -1;
+    mode[0] = entered;
+    bool changed = true;
+    while(changed) {
+        changed = false;
+        for(int i = from; i <= to; i++) {
+            if(mode[i - from] == -1)
+                continue;
+            int op = opGeneric(vm->program.op[i]), target = vm->program.imm[i];
+            int behind = jitModeBehind(vm, i, mode[i - from]);
+            if((op == JMP || op == JZ || op == JNZ || op == CALL) && target >= from && target <= to)
+                changed |= jitMeet(mode, target - from, behind);
+            /* behind a call the mode it was called in, ret only goes there in that mode */
+            if(op != JMP && op != RET && op != END && i < to)
+                changed |= jitMeet(mode, i + 1 - from, behind);
+        }
+    }
+}
+
+/* the template of instruction i, running in mode (0 if it isn't known) */
+static void jitInstruction(struct jitasm *a, VMState *vm, int i, int mode, char *slowUsed) {
+    int len = vm->program.len;
+    int op = opGeneric(vm->program.op[i]), dst = vm->program.dst[i], src = vm->program.src[i], value = vm->program.imm[i];
+    int slow = jitSlow(a, i);
+    /* registers out of range and jumps out of the program get the interpreter and its behaviour */
+    bool regsOk = dst <= NUM_REG && (src <= NUM_REG || src == IMM_FLOAT);
+    bool toOk = value >= 0 && value <= len;
+    /* mov, push, pop and ldr use the double registers in double mode, that is left to the interpreter */
+    bool wordsOk = mode != 0 && mode != ARITH_DOUBLE;
+    slowUsed[i - a->from] = 1;
+    switch(op) {
+        case MOV:
+            if(!regsOk || !wordsOk) break;
+            if(src == 0 || src == IMM_FLOAT) {
+                /* an integer is converted in float mode */
+                jitMem(a, 0xC7, EAX, JIT_REG(dst));          // mov dword [dst], imm32
+                jitWord(a, mode == ARITH_FLOAT && src == 0 ? jitBits((float)value) : value);
+            } else {
+                jitMem(a, 0x8B, EAX, JIT_REG(src));
+                jitMem(a, 0x89, EAX, JIT_REG(dst));
+            }
+            return;
+        case PUSH:
+        case LDR:
+            if(!regsOk || !wordsOk) break;
+            jitStackCheck(a, -1, slow);
+            if(op == PUSH && dst == 0) {
+                jitByte(a, 0xB8);                             // mov eax, imm32
+                jitWord(a, value);
+            } else {
+                jitMem(a, 0x8B, EAX, JIT_REG(dst));
+            }
+            jitSlot(a, 0x89, EAX, JIT_VM(stack));
+            jitOp(a, 0xFFC1);                                 // inc ecx
+            jitMem(a, 0x89, ECX, JIT_VM(pstack));
+            /* push clears the register */
+            if(op == PUSH && dst != 0) {
+                jitMem(a, 0xC7, EAX, JIT_REG(dst));
+                jitWord(a, 0);
+            }
+            return;
+        case POP:
+            if(!regsOk || !wordsOk) break;
+            jitStackCheck(a, 1, slow);
+            jitOp(a, 0xFFC9);                                 // dec ecx
+            jitSlot(a, 0x8B, EAX, JIT_VM(stack));
+            jitMem(a, 0x89, ECX, JIT_VM(pstack));
+            jitMem(a, 0x89, EAX, JIT_REG(dst));
+            return;
+        case SI:
+            if(!regsOk) break;
+            jitMem(a, 0x8B, EAX, JIT_VM(pstack));
+            jitMem(a, 0x89, EAX, JIT_REG(dst));
+            return;
+        case INC:
+        case DEC:
+            if(!regsOk || mode == 0) break;
+            if(mode == ARITH_FLOAT)
+                jitFloat(a, op, dst, 0, 0);
+            else if(mode == ARITH_DOUBLE)
+                jitDouble(a, op, dst, 0, 0);
+            else
+                jitMem(a, 0xFF, op == INC ? 0 : 1, JIT_REG(dst));   // inc/dec dword [dst]
+            return;
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+        case MOD:
+            if(!regsOk || mode == 0) break;
+            /* mod works on ints in float and double mode, a float literal is truncated there */
+            if(mode == ARITH_FLOAT && op != MOD)
+                jitFloat(a, op, dst, src, value);
+            else if(mode == ARITH_DOUBLE && op != MOD)
+                jitDouble(a, op, dst, src, value);
+            else if(src == IMM_FLOAT)
+                jitArith(a, op, dst, 0, (int)jitLiteral(value), mode == ARITH_CHAR, slow);
+            else
+                jitArith(a, op, dst, src, value, mode == ARITH_CHAR, slow);
+            return;
+        case EQ:
+        case LT:
+        case GT:
+        case LEQ:
+        case GEQ: {
+            /* eax the top, edx the value below it */
+            jitStackCheck(a, 2, slow);
+            jitSlot(a, 0x8B, EAX, JIT_VM(stack) - 4);
+            jitSlot(a, 0x8B, EDX, JIT_VM(stack) - 8);
+            jitOp(a, 0x83E902);                               // sub ecx, 2
+            jitMem(a, 0x89, ECX, JIT_VM(pstack));
+            jitOp(a, 0x39D0);                                 // cmp eax, edx
+            int cc = op == EQ ? CC_E : op == LT ? CC_L : op == GT ? CC_G : op == LEQ ? CC_LE : CC_GE;
+            jitOp(a, 0x0F90 | cc);                            // setcc al
+            jitByte(a, 0xC0);
+            jitMem(a, 0x88, EAX, JIT_VM(zeroflag));
+            return;
+        }
+        case JMP:
+            if(!toOk) break;
+            slowUsed[i - a->from] = 0;
+            jitSyncCheck(a);
+            jitBranch(a, -1, value);
+            return;
+        case JZ:
+        case JNZ:
+            if(!toOk) break;
+            slowUsed[i - a->from] = 0;
+            jitSyncCheck(a);
+            jitMem(a, 0x0FB6, EAX, JIT_VM(zeroflag));          // movzx eax, byte [zeroflag]
+            jitMem(a, 0xC6, EAX, JIT_VM(zeroflag));            // mov byte [zeroflag], 0
+            jitByte(a, 0);
+            jitOp(a, 0x85C0);
+            jitBranch(a, op == JZ ? CC_NE : CC_E, value);
+            return;
+        case CALL:
+            if(!toOk) break;
+            jitMem(a, 0x8B, ECX, JIT_VM(rstack));
+            jitOp(a, 0x81F9);                                 // cmp ecx, STACK_SIZE - 1
+            jitWord(a, STACK_SIZE - 1);
+            jitJump(a, CC_GE, slow);
+            jitSlot(a, 0xC7, EAX, JIT_VM(returnstack));        // mov dword [returnstack + rcx * 4], i + 1
+            jitWord(a, i + 1);
+            jitOp(a, 0xFFC1);
+            jitMem(a, 0x89, ECX, JIT_VM(rstack));
+            jitSyncCheck(a);
+            jitBranch(a, -1, value);
+            return;
+        case INT: {
+            /* the mode interrupts only set a field, the others run in the interpreter */
+            if(dst != 0 || (value != 1 && value != 2 && (value < 9 || value > 11) && value != 22)) break;
+            int field = value <= 2 ? JIT_VM(memory_rw_mode) : JIT_VM(arith_mode);
+            int set = value == 1 ? MEMORY_RW_CHAR : value == 2 ? MEMORY_RW_INT : value == 9 ? ARITH_CHAR : value == 10 ? ARITH_INT : value == 11 ? ARITH_FLOAT : ARITH_DOUBLE;
+            slowUsed[i - a->from] = 0;
+            jitMem(a, 0xC7, EAX, field);                      // mov dword [field], imm32
+            jitWord(a, set);
+            return;
+        }
+        case RET: {
+            jitMem(a, 0x8B, ECX, JIT_VM(rstack));
+            jitOp(a, 0x85C9);                                 // test ecx, ecx
+            jitJump(a, CC_LE, slow);
+            jitOp(a, 0xFFC9);
+            jitMem(a, 0x89, ECX, JIT_VM(rstack));
+            jitSlot(a, 0x8B, EAX, JIT_VM(returnstack));
+            /* the code of the return address in this mode, if it is translated */
+            if(mode != 0) {
+                jitByte(a, 0x3D);                             // cmp eax, len
+                jitWord(a, len);
+                long outside = jitShort(a, CC_A);
+                jitOp(a, 0x48B9);                             // mov rcx, entry
+                jitQuad(a, (unsigned long long)(size_t)vm->jit->entry[mode - 1]);
+                jitOp(a, 0x488B0C);                           // mov rcx, [rcx + rax * 8]
+                jitByte(a, 0xC1);
+                jitOp(a, 0x4885C9);                           // test rcx, rcx
+                long none = jitShort(a, CC_E);
+                jitOp(a, 0xFFE1);                             // jmp rcx
+                jitLand(a, outside);
+                jitLand(a, none);
+            }
+            jitMem(a, 0x89, EAX, JIT_VM(pc));
+            jitJump(a, -1, jitExit(a));
+            return;
+        }
+    }
+    slowUsed[i - a->from] = 0;
+    jitHelper(a, i);
+}
+
+/* translate the instructions from..to, entered at from in an arithmetic mode, called with j->lock */
+static void jitRegion(VMState *vm, struct jitcode *j, int from, int to, int entered) {
+    int n = to - from + 1;
+    char *slowUsed = (char *)calloc(n, 1);
+    int *mode = (int *)malloc(n * sizeof(int));
+    jitModes(vm, from, to, entered, mode);
+    for(int k = 0; k < n; k++)
+        if(mode[k] == -1)
+            mode[k] = 0;
+    struct jitasm a;
+    a.cap = 64 * n + 256;
+    a.buf = (unsigned char *)malloc(a.cap);
+    a.len = 0;
+    a.labels = (long *)malloc((2 * n + 1) * sizeof(long));
+    for(int i = 0; i < 2 * n + 1; i++)
+        a.labels[i] = -1;
+    a.fixCap = 64;
+    a.fixCount = 0;
+    a.fixes = (long *)malloc(a.fixCap * 2 * sizeof(long));
+    a.from = from;
+    a.to = to;
+
+    /* the exit, back into the trampoline: pop rbx, ret */
+    jitBind(&a, jitExit(&a));
+    jitByte(&a, 0x5B);
+    jitByte(&a, 0xC3);
+
+    for(int i = from; i <= to; i++) {
+        jitBind(&a, jitLabel(&a, i));
+        if(j->start[i]) {
+            /* count the block, or leave it to the interpreter if it doesn't fit in the budget */
+            jitMem(&a, 0x488B, EAX, JIT_VM(steps));
+            jitOp(&a, 0x4805);                                // add rax, imm32
+            jitWord(&a, j->rest[i] + 1);
+            jitMem(&a, 0x483B, EAX, JIT_VM(limit));
+            long fits = jitShort(&a, CC_BE);
+            jitLeave(&a, i, 0);
+            jitLand(&a, fits);
+            jitMem(&a, 0x4889, EAX, JIT_VM(steps));
+        }
+        jitInstruction(&a, vm, i, mode[i - from], slowUsed);
+    }
+    /* the end of the region */
+    jitLeave(&a, to + 1, j->rest[to]);
+
+    /* the slow paths, the interpreter runs the instruction and the code goes on behind it */
+    for(int i = from; i <= to; i++) {
+        if(!slowUsed[i - from])
+            continue;
+        jitBind(&a, jitSlow(&a, i));
+        jitHelper(&a, i);
+        if(i < to)
+            jitJump(&a, -1, jitLabel(&a, i + 1));
+        else
+            jitLeave(&a, to + 1, j->rest[to]);
+    }
+
+    for(int k = 0; k < a.fixCount; k++) {
+        long at = a.fixes[k * 2];
+        int rel = (int)(a.labels[a.fixes[k * 2 + 1]] - (at + 4));
+        memcpy(a.buf + at, &rel, 4);
+    }
+
+    unsigned char *code = (unsigned char *)mmap(NULL, a.len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(code != MAP_FAILED) {
+        memcpy(code, a.buf, a.len);
+        if(mprotect(code, a.len, PROT_READ | PROT_EXEC) != 0) {
+            munmap(code, a.len);
+            code = (unsigned char *)MAP_FAILED;
+        }
+    }
+    if(code != MAP_FAILED) {
+        j->code = (unsigned char **)realloc(j->code, (j->regions + 1) * sizeof(unsigned char *));
+        j->size = (long *)realloc(j->size, (j->regions + 1) * sizeof(long));
+        j->code[j->regions] = code;
+        j->size[j->regions] = a.len;
+        j->regions++;
+        /* block starts that are translated already keep their code, other vms may be running it */
+        for(int i = from; i <= to; i++) {
+            int m = mode[i - from];
+            if(j->start[i] && m != 0 && j->entry[m - 1][i] == NULL)
+                __atomic_store_n(&j->entry[m - 1][i], (void *)(code + a.labels[jitLabel(&a, i)]), __ATOMIC_RELEASE);
+        }
+    }
+    free(mode);
+    free(a.buf);
+    free(a.labels);
+    free(a.fixes);
+    free(slowUsed);
+}
+
+/* the counters and the trampoline of the program of vm, NULL if there is no executable memory */
+static struct jitcode *jitCreate(VMState *vm) {
+    /* push rbx, mov rbx, rdi, jmp rsi */
+    static const unsigned char trampoline[] = {0x53, 0x48, 0x89, 0xFB, 0xFF, 0xE6};
+    unsigned char *enter = (unsigned char *)mmap(NULL, 16, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(enter == MAP_FAILED)
+        return NULL;
+    memcpy(enter, trampoline, sizeof(trampoline));
+    if(mprotect(enter, 16, PROT_READ | PROT_EXEC) != 0) {
+        munmap(enter, 16);
+        return NULL;
+    }
+    int len = vm->program.len;
+    struct jitcode *j = (struct jitcode *)calloc(1, sizeof(struct jitcode));
+    j->enter = enter;
+    for(int m = 0; m < 4; m++)
+        j->entry[m] = (void **)calloc(len + 1, sizeof(void *));
+    j->start = (char *)malloc(len + 2);
+    j->rest = (int *)malloc((len + 1) * sizeof(int));
+    j->hot = (int *)calloc(len + 1, sizeof(int));
+    j->tried = (char *)calloc(len + 1, 1);
+    j->refs = 1;
+    pthread_mutex_init(&j->lock, NULL);
+    jitBlocks(vm, j->start, j->rest);
+    return j;
+}
+
+/* a backward jump from back to the target to, or a call of to (back == to) */
+static void jitHot(VMState *vm, struct jitcode *j, int to, int back) {
+    int mode = vm->arith_mode;
+    if(to < 0 || to > vm->program.len || mode < ARITH_CHAR || mode > ARITH_DOUBLE)
+        return;
+    if(__atomic_add_fetch(&j->hot[to], 1, __ATOMIC_RELAXED) < JIT_HOT)
+        return;
+    __atomic_store_n(&j->hot[to], 0, __ATOMIC_RELAXED);
+    /* once per target and mode, the start of a loop whose mode changes from one round to the next stays in the interpreter */
+    pthread_mutex_lock(&j->lock);
+    if(j->entry[mode - 1][to] == NULL && !(j->tried[to] & 1 << mode)) {
+        j->tried[to] |= 1 << mode;
+        jitRegion(vm, j, to, jitExtent(vm, to, back), mode);
+    }
+    pthread_mutex_unlock(&j->lock);
+}
+
+#else
+
+static struct jitcode *jitCreate(VMState *vm) {
+    return NULL;
+}
+
+static void jitHot(VMState *vm, struct jitcode *j, int to, int back) {
+}
+
+#endif
+
+/* the native code of a translated block start at at in the current mode, if the budget lets it run to the end of its block */
+static void *jitEntry(VMState *vm, struct jitcode *j, int at) {
+    int mode = vm->arith_mode;
+    if(at < 0 || at > vm->program.len || mode < ARITH_CHAR || mode > ARITH_DOUBLE)
+        return NULL;
+    void *code = __atomic_load_n(&j->entry[mode - 1][at], __ATOMIC_ACQUIRE);
+    if(code == NULL || vm->steps + j->rest[at] >= vm->limit)
+        return NULL;
+    return code;
+}
+
+/* a jump, call or ret of runThreaded() went from at to vm->pc, true if native code goes on there */
+static bool jitJumped(VMState *vm, int at) {
+    struct jitcode *j = vm->jit;
+    int op = vm->instrNum;
+    if(((op == JMP || op == JZ || op == JNZ) && vm->pc <= at) || (op == CALL && vm->pc == vm->value))
+        jitHot(vm, j, vm->pc, op == CALL ? vm->pc : at);
+    return jitEntry(vm, j, vm->pc) != NULL;
+}
+
+/* the threaded interpreter, counting backward jumps and calls, and the native code of translated block starts */
+void runJit(VMState *vm) {
+    if(vm->jit == NULL)
+        vm->jit = jitCreate(vm);
+    struct jitcode *j = vm->jit;
+    if(j == NULL) {
+        if(threaded)
+            runThreaded(vm);
+        else
+            runClassic(vm);
+        return;
+    }
+    while(vm->running && vm->steps != vm->limit) {
+        void *code = jitEntry(vm, j, vm->pc);
+        if(code != NULL)
+            ((jitenter)j->enter)(vm, code);
+        else
+            runThreaded(vm);
+    }
+}
@@ -1,108 +1,599 @@
 /*
 Some structures to represent the vm's memory
-@todo
+
+Every memory location is a struct node, indexed by its key (the address used by puts/gets/ldm/stm..)
+Small non negative keys live in a dense array, all other keys (negative or sparse) in an open
+addressing hash table. Both give O(1) lookups, ordered output is created on demand by memSorted().
+Every vm has its own struct memstore, all functions work on the store they get.
+
+Shared stores
+Vms spawned by a program share the store of their parent. Lookups don't lock: the dense array, the
+hash table and the nodes are published with atomic stores and whatever a reader may still see is
+only freed once it can't see it anymore (epochs, see memEnter()). Writers that change the index or
+replace a location hold m->lock. A location is never resized in place, memCopy() makes a bigger copy
+that replaces it (RCU), so a reader sees either the old or the new buffer. Bytes and aligned words
+inside a location are written in place with atomic stores (STM).
+
+Forked stores
+A forked vm gets a copy of the index, the nodes themselves are shared and counted (refs). A node
+with more than one ref is never written, the store that writes it puts a copy of its own in its
+place first (memWritable(), memForked()), so forking costs one copy of the index and no data.
 */
 
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+
 struct node {
    int key;
    int len;
+   int cap; // allocated size of data
+   int mapped; // data points into the mapped bootfile or snapshot and must be copied before writing
+   int dirty; // changed since the last sync of the bootfile (write-back)
+   int sealed; // being replaced by a copy, in place writes have to retry, see memCopy()
+   int busy; // atomic instructions (int 16..19) in progress, memCopy() waits for them
+   int refs; // stores holding the node, more than one after a fork
    unsigned char *data;
-   struct node *next;
 };
 
-struct node *head = NULL;
-struct node *current = NULL;
-
-int memLen() {
-   int length = 0;
-   struct node *current;	
-   for(current = head; current != NULL; current = current->next) {
-      length++;
-   }	
-   return length;
-}
-
-void sort() {
-   int i, j, k, tempKey, tempLen;
-   unsigned char *tempData;
-   struct node *current;
-   struct node *next;	
-   int size = memLen();
-   k = size ;	
-   for ( i = 0 ; i < size - 1 ; i++, k-- ) {
-      current = head;
-      next = head->next;		
-      for ( j = 1 ; j < k ; j++ ) {   
-         if ( current->key > next->key ) {
-            tempData = current->data;
-            current->data = next->data;
-            next->data = tempData;
-            tempKey = current->key;
-            current->key = next->key;
-            next->key = tempKey;
-            tempLen = current->len;
-            current->len = next->len;
-            next->len = tempLen;
-         }			
-         current = current->next;
-         next = next->next;
-      }
-   }   
-}
-
-int insertFirst(int tkey, unsigned char *tdata, int tlen) {
-   struct node *link = (struct node*) malloc(sizeof(struct node));	
-   if(link != NULL) {
-       link->key = tkey;
-       link->data = tdata;
-       link->len = tlen;
-       link->next = head;
-       head = link;
-   } else printf("[hash] could not allocate memory!\n");
-   sort();
-   return link->key;
+/* keys 0 <= key < MEM_DENSE_LIMIT are stored in the dense array */
+#define MEM_DENSE_LIMIT 65536
+/* initial size of the hash table, always a power of 2 */
+#define MEM_HASH_INIT 64
+/* retired nodes and arrays of a shared store collected before trying to free them */
+#define MEM_RETIRE_BATCH 64
+
+/* a vm using a store, the epoch it reads in. padded to its own cache line */
+struct memreader {
+   unsigned long long epoch; // 0 while it doesn't read
+   char pad[64 - sizeof(unsigned long long)];
+};
+
+/* a node or an array replaced in a shared store, still visible to readers of older epochs */
+struct retired {
+   struct node *node;
+   void *array;
+   unsigned long long epoch;
+   struct retired *next;
+};
+
+/* the hash table, a reader gets its size and its slots with one load, a rehash replaces both */
+struct memtable {
+   int cap;
+   struct node *slots[];
+};
+
+/* a file mapped read-only, locations point into it like into the bootfile. forked stores share it */
+struct memmapping {
+   char *base;
+   long size;
+   int refs;
+};
+
+struct memstore {
+   struct node **dense;
+   int denseCap;
+   struct memtable *table; // NULL until a key outside the dense array is used
+   int tableUsed;  // live entries
+   int tableTombs; // deleted slots
+   int count;      // memory locations
+   unsigned long long allocs; // nodes and data buffers allocated (vm -s)
+   /* write-back: keys changed since the last sync of the bootfile, see Storage.h */
+   int *dirtyIds;
+   int dirtyCount;
+   int dirtyCap;
+   /* shared stores */
+   int refs;   // vms using the store
+   int shared; // used by more than one vm, once set it stays
+   pthread_mutex_t lock; // writers
+   unsigned long long epoch; // advanced by every retire
+   struct memreader **readers;
+   int readerCount;
+   int readerCap;
+   struct retired *retired;
+   int retiredCount;
+   struct memmapping *mapping; // a restored snapshot (Snapshot.h)
+};
+
+void storageUnmap(char *base, long size); // Storage.h
+
+/* marks a deleted slot in the hash table, lookups have to probe past it */
+struct node memTombstone;
+
+int memLen(struct memstore *m) {
+   return m->count;
 }
 
-struct node* deleteFirst() {
-   struct node *tempLink = head; 
-   head = head->next;
-   return tempLink;
+static unsigned int memHash(int key) {
+   /* fibonacci hashing, spreads consecutive keys */
+   return (unsigned int)key * 2654435769u;
 }
 
-struct node* find(int key) {
-   struct node* current = head;
-   if(head == NULL) {
-      return NULL;
+/* free a memory location once no store holds it anymore, data in a mapping is not freed */
+void memFree(struct node *n) {
+   if(n == NULL)
+      return;
+   if(__atomic_sub_fetch(&n->refs, 1, __ATOMIC_ACQ_REL) > 0)
+      return;
+   if(!n->mapped)
+      free(n->data);
+   free(n);
+}
+
+/*
+Epochs
+a reader announces the epoch it starts in, every retire advances the epoch. something retired in
+epoch e can be freed once no reader is still in an epoch <= e, readers that started later loaded
+the index after it was replaced
+*/
+
+/* start reading a shared store, the exchange orders the announcement before the loads of the index */
+static inline void memEnter(struct memstore *m, struct memreader *r) {
+   __atomic_exchange_n(&r->epoch, __atomic_load_n(&m->epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+}
+
+static inline void memLeave(struct memreader *r) {
+   __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/* free what no reader can see anymore, the caller holds m->lock */
+static void memReclaim(struct memstore *m) {
+   unsigned long long oldest = ~0ull;
+   for(int i = 0; i < m->readerCount; i++) {
+      unsigned long long e = __atomic_load_n(&m->readers[i]->epoch, __ATOMIC_SEQ_CST);
+      if(e != 0 && e < oldest) oldest = e;
    }
-   while(current->key != key) {
-      if(current->next == NULL) {
-         return NULL;
+   struct retired **p = &m->retired;
+   while(*p != NULL) {
+      struct retired *r = *p;
+      if(r->epoch < oldest) {
+         *p = r->next;
+         memFree(r->node);
+         free(r->array);
+         free(r);
+         m->retiredCount--;
       } else {
-         current = current->next;
+         p = &r->next;
       }
-   }      
-   return current;
+   }
 }
 
-struct node* deleteNode(int key) {
-   struct node* current = head;
-   struct node* previous = NULL;
-   if(head == NULL) {
-      return NULL;
+/* a node or array was replaced, free it now or once the readers are done with it */
+static void memRetire(struct memstore *m, struct node *n, void *array) {
+   if(!m->shared) {
+      memFree(n);
+      free(array);
+      return;
    }
-   while(current->key != key) {
-      if(current->next == NULL) {
-         return NULL;
-      } else {
-         previous = current;
-         current = current->next;
+   struct retired *r = (struct retired *)malloc(sizeof(struct retired));
+   r->node = n;
+   r->array = array;
+   r->epoch = m->epoch;
+   r->next = m->retired;
+   m->retired = r;
+   m->retiredCount++;
+   __atomic_add_fetch(&m->epoch, 1, __ATOMIC_SEQ_CST);
+   if(m->retiredCount >= MEM_RETIRE_BATCH)
+      memReclaim(m);
+}
+
+/* find the slot of key, or the first free slot to insert it */
+static int memSlot(struct node **table, int tableCap, int key) {
+   unsigned int mask = tableCap - 1;
+   unsigned int i = memHash(key) & mask;
+   int firstFree = -1;
+   struct node *n;
+   while((n = __atomic_load_n(&table[i], __ATOMIC_ACQUIRE)) != NULL) {
+      if(n == &memTombstone) {
+         if(firstFree < 0) firstFree = i;
+      } else if(n->key == key) {
+         return i;
+      }
+      i = (i + 1) & mask;
+   }
+   return firstFree >= 0 ? firstFree : (int)i;
+}
+
+/* an empty hash table of cap slots */
+static struct memtable *memTableCreate(int cap) {
+   struct memtable *t = (struct memtable *)calloc(1, sizeof(struct memtable) + cap * sizeof(struct node *));
+   if(t == NULL) {
+      printf("[hash] could not allocate memory!\n");
+      exit(1);
+   }
+   t->cap = cap;
+   return t;
+}
+
+/* the new table is filled before it is published, the old one is retired as a whole */
+static void memRehash(struct memstore *m, int newCap) {
+   struct memtable *old = m->table;
+   struct memtable *t = memTableCreate(newCap);
+   for(int i = 0; old != NULL && i < old->cap; i++) {
+      if(old->slots[i] != NULL && old->slots[i] != &memTombstone)
+         t->slots[memSlot(t->slots, newCap, old->slots[i]->key)] = old->slots[i];
+   }
+   m->tableTombs = 0;
+   __atomic_store_n(&m->table, t, __ATOMIC_RELEASE);
+   memRetire(m, NULL, old);
+}
+
+/* the dense array is published before its size and only grows, a reader that sees the size sees an array that big */
+static void memDenseGrow(struct memstore *m, int key) {
+   int newCap = m->denseCap ? m->denseCap : 64;
+   while(newCap <= key) newCap *= 2;
+   struct node **dense = (struct node **)calloc(newCap, sizeof(struct node *));
+   if(dense == NULL) {
+      printf("[hash] could not allocate memory!\n");
+      exit(1);
+   }
+   if(m->denseCap > 0)
+      memcpy(dense, m->dense, m->denseCap * sizeof(struct node *));
+   struct node **old = m->dense;
+   __atomic_store_n(&m->dense, dense, __ATOMIC_RELEASE);
+   __atomic_store_n(&m->denseCap, newCap, __ATOMIC_RELEASE);
+   memRetire(m, NULL, old);
+}
+
+/* put a node into the store, a location with the same key gets replaced and retired */
+static void memPut(struct memstore *m, struct node *link) {
+   int key = link->key;
+   struct node *old;
+   if(key >= 0 && key < MEM_DENSE_LIMIT) {
+      if(key >= m->denseCap) memDenseGrow(m, key);
+      old = m->dense[key];
+      if(old == NULL) m->count++;
+      __atomic_store_n(&m->dense[key], link, __ATOMIC_RELEASE);
+   } else {
+      /* keep the load factor (including tombstones) below 3/4 */
+      if(m->table == NULL) memRehash(m, MEM_HASH_INIT);
+      else if((m->tableUsed + m->tableTombs + 1) * 4 > m->table->cap * 3)
+         memRehash(m, (m->tableUsed + 1) * 2 > m->table->cap ? m->table->cap * 2 : m->table->cap);
+      struct memtable *t = m->table;
+      int i = memSlot(t->slots, t->cap, key);
+      old = t->slots[i];
+      if(old == NULL || old == &memTombstone) {
+         if(old == &memTombstone) m->tableTombs--;
+         m->tableUsed++;
+         m->count++;
+         old = NULL;
       }
+      __atomic_store_n(&t->slots[i], link, __ATOMIC_RELEASE);
+   }
+   if(old != NULL)
+      memRetire(m, old, NULL);
+}
+
+/*
+add a memory location
+an existing location with the same key gets replaced
+*/
+int insertFirst(struct memstore *m, int tkey, unsigned char *tdata, int tlen) {
+   struct node *link = (struct node*) malloc(sizeof(struct node));
+   if(link == NULL) {
+      printf("[hash] could not allocate memory!\n");
+      exit(1);
+   }
+   link->key = tkey;
+   link->data = tdata;
+   link->len = tlen;
+   link->cap = tlen;
+   link->mapped = 0;
+   link->dirty = 0;
+   link->sealed = 0;
+   link->busy = 0;
+   link->refs = 1;
+   m->allocs += tlen > 0 ? 2 : 1;
+   memPut(m, link);
+   return link->key;
+}
+
+/* lookups don't lock, see memEnter() */
+struct node* find(struct memstore *m, int key) {
+   if(key >= 0 && key < MEM_DENSE_LIMIT) {
+      if(key >= __atomic_load_n(&m->denseCap, __ATOMIC_ACQUIRE))
+         return NULL;
+      return __atomic_load_n(&__atomic_load_n(&m->dense, __ATOMIC_ACQUIRE)[key], __ATOMIC_ACQUIRE);
    }
-   if(current == head) {
-      head = head->next;
+   struct memtable *t = __atomic_load_n(&m->table, __ATOMIC_ACQUIRE);
+   if(t == NULL)
+      return NULL;
+   struct node *n = __atomic_load_n(&t->slots[memSlot(t->slots, t->cap, key)], __ATOMIC_ACQUIRE);
+   return n == &memTombstone ? NULL : n;
+}
+
+/* remove a memory location and return it, the caller owns the node. not for shared stores */
+struct node* deleteNode(struct memstore *m, int key) {
+   struct node *n = NULL;
+   if(key >= 0 && key < MEM_DENSE_LIMIT) {
+      if(key >= m->denseCap || m->dense[key] == NULL)
+         return NULL;
+      n = m->dense[key];
+      m->dense[key] = NULL;
    } else {
-      previous->next = current->next;
-   }    	
-   return current;
+      struct memtable *t = m->table;
+      if(t == NULL)
+         return NULL;
+      int i = memSlot(t->slots, t->cap, key);
+      if(t->slots[i] == NULL || t->slots[i] == &memTombstone)
+         return NULL;
+      n = t->slots[i];
+      t->slots[i] = &memTombstone;
+      m->tableUsed--;
+      m->tableTombs++;
+   }
+   m->count--;
+   return n;
+}
+
+/* the node is shared with a forked store, it gets copied before it is written */
+static inline int memForked(struct node *n) {
+   return __atomic_load_n(&n->refs, __ATOMIC_ACQUIRE) > 1;
+}
+
+/* a private copy of n with at least len bytes, not yet in the store */
+static struct node *memClone(struct memstore *m, struct node *n, int len) {
+   if(len < n->len) len = n->len;
+   struct node *c = (struct node *)malloc(sizeof(struct node));
+   unsigned char *data = (unsigned char *)malloc(len > 0 ? len : 1);
+   if(c == NULL || data == NULL) {
+      printf("[hash] could not allocate memory!\n");
+      exit(1);
+   }
+   memcpy(data, n->data, n->len);
+   memset(data + n->len, 0, len - n->len);
+   *c = *n;
+   c->data = data;
+   c->len = len;
+   c->cap = len;
+   c->mapped = 0;
+   c->sealed = 0;
+   c->busy = 0;
+   c->refs = 1;
+   m->allocs += 2;
+   return c;
+}
+
+/*
+make sure a memory location can be written, returns the node to write
+a location that still points into the mapped bootfile gets its own copy (copy on write), one that is
+shared with a forked store is replaced by a copy of its own. not for shared stores, see memCopy()
+*/
+struct node *memWritable(struct memstore *m, struct node *n) {
+   if(memForked(n)) {
+      struct node *c = memClone(m, n, n->len);
+      memPut(m, c);
+      return c;
+   }
+   if(!n->mapped)
+      return n;
+   unsigned char *tmp = (unsigned char *)malloc(n->len > 0 ? n->len : 1);
+   if(tmp == NULL) {
+      printf("[hash] could not allocate memory!\n");
+      exit(1);
+   }
+   memcpy(tmp, n->data, n->len);
+   m->allocs++;
+   n->data = tmp;
+   n->cap = n->len;
+   n->mapped = 0;
+   return n;
+}
+
+/*
+grow a writable memory location (memWritable()) to at least len bytes, new bytes are zeroed
+the buffer grows geometrically, so writing past the end again and again is amortized O(1)
+*/
+void memGrow(struct memstore *m, struct node *n, int len) {
+   if(len <= n->len)
+      return;
+   if(len > n->cap) {
+      int cap = n->cap * 2;
+      if(cap < len) cap = len;
+      unsigned char *tmp = (unsigned char *)realloc(n->data, cap);
+      if(tmp == NULL) {
+         printf("[hash] could not allocate memory!\n");
+         exit(1);
+      }
+      m->allocs++;
+      n->data = tmp;
+      n->cap = cap;
+   }
+   memset(n->data + n->len, 0, len - n->len);
+   n->len = len;
+}
+
+/*
+a writable copy of a location of a shared store with at least len bytes, new bytes are zeroed.
+n is sealed first, so in place writes that come after the copy see it and retry on the copy.
+read-modify-writes can't be redone, the copy waits until the ones in progress are done instead.
+the copy replaces n when it is written and put with memPut(), the caller holds m->lock
+*/
+struct node *memCopy(struct memstore *m, struct node *n, int len) {
+   __atomic_store_n(&n->sealed, 1, __ATOMIC_SEQ_CST);
+   while(__atomic_load_n(&n->busy, __ATOMIC_SEQ_CST) > 0)
+      sched_yield();
+   return memClone(m, n, len);
+}
+
+/* read a byte or a word of a location that can be written concurrently (STM), aligned words are read at once */
+static inline unsigned char memLoadByte(struct node *n, int pos) {
+   return __atomic_load_n(&n->data[pos], __ATOMIC_RELAXED);
+}
+
+static inline int memLoadWord(struct node *n, int pos) {
+   int v;
+   if(((uintptr_t)(n->data + pos) & (sizeof(int) - 1)) == 0)
+      return __atomic_load_n((int *)&n->data[pos], __ATOMIC_RELAXED);
+   memcpy(&v, &n->data[pos], sizeof(int));
+   return v;
+}
+
+/* write a byte or an aligned word in place, returns 0 if n is being replaced and the write has to be redone */
+static inline int memStoreByte(struct node *n, int pos, int val) {
+   __atomic_store_n(&n->data[pos], (unsigned char)val, __ATOMIC_SEQ_CST);
+   return !__atomic_load_n(&n->sealed, __ATOMIC_SEQ_CST);
+}
+
+static inline int memStoreWord(struct node *n, int pos, int val) {
+   __atomic_store_n((int *)&n->data[pos], val, __ATOMIC_SEQ_CST);
+   return !__atomic_load_n(&n->sealed, __ATOMIC_SEQ_CST);
 }
 
+static inline int memAligned(struct node *n, int pos) {
+   return ((uintptr_t)(n->data + pos) & (sizeof(int) - 1)) == 0;
+}
+
+static int memCompare(const void *a, const void *b) {
+   int ka = (*(struct node **)a)->key;
+   int kb = (*(struct node **)b)->key;
+   return (ka > kb) - (ka < kb);
+}
+
+/*
+all memory locations ordered by key
+returns a new array of memLen() entries, the caller has to free it
+*/
+struct node** memSorted(struct memstore *m, int *count) {
+   struct node **list = (struct node **)malloc((m->count + 1) * sizeof(struct node *));
+   int n = 0;
+   for(int i = 0; m->table != NULL && i < m->table->cap; i++) {
+      if(m->table->slots[i] != NULL && m->table->slots[i] != &memTombstone)
+         list[n++] = m->table->slots[i];
+   }
+   /* only the hash table needs sorting, the dense array is already in order */
+   qsort(list, n, sizeof(struct node *), memCompare);
+   int negative = 0;
+   while(negative < n && list[negative]->key < 0) negative++;
+   struct node **result = (struct node **)malloc((m->count + 1) * sizeof(struct node *));
+   int r = 0;
+   for(int i = 0; i < negative; i++)
+      result[r++] = list[i];
+   for(int i = 0; i < m->denseCap; i++) {
+      if(m->dense[i] != NULL)
+         result[r++] = m->dense[i];
+   }
+   for(int i = negative; i < n; i++)
+      result[r++] = list[i];
+   free(list);
+   *count = r;
+   return result;
+}
+
+/* remove the location with the lowest key */
+struct node* deleteFirst(struct memstore *m) {
+   int count;
+   struct node **list = memSorted(m, &count);
+   struct node *first = count > 0 ? deleteNode(m, list[0]->key) : NULL;
+   free(list);
+   return first;
+}
+
+/* free all memory locations, the retired ones and the store itself */
+void memClear(struct memstore *m) {
+   for(int i = 0; i < m->denseCap; i++)
+      memFree(m->dense[i]);
+   for(int i = 0; m->table != NULL && i < m->table->cap; i++) {
+      if(m->table->slots[i] != &memTombstone)
+         memFree(m->table->slots[i]);
+   }
+   while(m->retired != NULL) {
+      struct retired *r = m->retired;
+      m->retired = r->next;
+      memFree(r->node);
+      free(r->array);
+      free(r);
+   }
+   free(m->dense);
+   free(m->table);
+   free(m->dirtyIds);
+   free(m->readers);
+   if(m->mapping != NULL && __atomic_sub_fetch(&m->mapping->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+      storageUnmap(m->mapping->base, m->mapping->size);
+      free(m->mapping);
+   }
+   memset(m, 0, sizeof(struct memstore));
+}
+
+struct memstore *memCreate() {
+   struct memstore *m = (struct memstore *)calloc(1, sizeof(struct memstore));
+   m->epoch = 1;
+   pthread_mutex_init(&m->lock, NULL);
+   return m;
+}
+
+/* one more vm uses the store, returns the reader it announces its epochs in */
+struct memreader *memRetain(struct memstore *m) {
+   struct memreader *r = (struct memreader *)calloc(1, sizeof(struct memreader));
+   pthread_mutex_lock(&m->lock);
+   if(m->readerCount == m->readerCap) {
+      m->readerCap = m->readerCap ? m->readerCap * 2 : 8;
+      m->readers = (struct memreader **)realloc(m->readers, m->readerCap * sizeof(struct memreader *));
+   }
+   m->readers[m->readerCount++] = r;
+   /* set once, before the second vm runs */
+   if(++m->refs > 1 && !m->shared)
+      m->shared = 1;
+   pthread_mutex_unlock(&m->lock);
+   return r;
+}
+
+/*
+a store for a forked vm with the locations of m, they are shared until one of the stores writes them.
+a shared m is copied under its lock, stm of other vms at that moment can still show up in the fork
+*/
+struct memstore *memFork(struct memstore *m) {
+   struct memstore *c = memCreate();
+   pthread_mutex_lock(&m->lock);
+   c->dense = (struct node **)calloc(m->denseCap > 0 ? m->denseCap : 1, sizeof(struct node *));
+   if(c->dense == NULL) {
+      printf("[hash] could not allocate memory!\n");
+      exit(1);
+   }
+   memcpy(c->dense, m->dense, m->denseCap * sizeof(struct node *));
+   if(m->table != NULL) {
+      c->table = memTableCreate(m->table->cap);
+      memcpy(c->table->slots, m->table->slots, m->table->cap * sizeof(struct node *));
+   }
+   c->denseCap = m->denseCap;
+   c->tableUsed = m->tableUsed;
+   c->tableTombs = m->tableTombs;
+   c->count = m->count;
+   c->allocs = 2;
+   for(int i = 0; i < c->denseCap; i++)
+      if(c->dense[i] != NULL)
+         __atomic_add_fetch(&c->dense[i]->refs, 1, __ATOMIC_ACQ_REL);
+   for(int i = 0; c->table != NULL && i < c->table->cap; i++)
+      if(c->table->slots[i] != NULL && c->table->slots[i] != &memTombstone)
+         __atomic_add_fetch(&c->table->slots[i]->refs, 1, __ATOMIC_ACQ_REL);
+   /* changes not yet written back are written by whichever store syncs first */
+   if(m->dirtyCount > 0) {
+      c->dirtyIds = (int *)malloc(m->dirtyCount * sizeof(int));
+      memcpy(c->dirtyIds, m->dirtyIds, m->dirtyCount * sizeof(int));
+      c->dirtyCount = c->dirtyCap = m->dirtyCount;
+   }
+   c->mapping = m->mapping;
+   if(c->mapping != NULL)
+      __atomic_add_fetch(&c->mapping->refs, 1, __ATOMIC_ACQ_REL);
+   pthread_mutex_unlock(&m->lock);
+   return c;
+}
+
+/* a vm is done with the store, the last one frees it */
+void memRelease(struct memstore *m, struct memreader *r) {
+   pthread_mutex_lock(&m->lock);
+   for(int i = 0; i < m->readerCount; i++) {
+      if(m->readers[i] == r) {
+         m->readers[i] = m->readers[--m->readerCount];
+         break;
+      }
+   }
+   free(r);
+   int last = --m->refs == 0;
+   pthread_mutex_unlock(&m->lock);
+   if(!last)
+      return;
+   pthread_mutex_destroy(&m->lock);
+   memClear(m);
+   free(m);
+}
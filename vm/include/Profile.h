@@ -0,0 +1,224 @@
+/*
+Instruction level profiler, enabled with -p
+
+Counts executions and cycles per pc and per opcode. The time of every instruction is also attributed
+to the function it runs in, a function being the target of a CALL, found through the return stack.
+At the end of the program a report is written to stderr. If the assembler wrote a symbol file
+(as -s, <program>.sym next to <program>.zvm) pcs are shown as label+offset.
+The counters are process wide, only the vm of the command line is profiled, the vms it spawns
+or forks run through the usual dispatch (vmRun()).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define profileClock() __rdtsc()
+#define PROFILE_UNIT "cycles"
+#else
+#define profileClock() ((unsigned long long)clock())
+#define PROFILE_UNIT "clock ticks"
+#endif
+
+/* number of pcs listed as hot spots */
+#define PROFILE_HOT 20
+
+const char *opNames[] = {
+    [END] = "end", [MOV] = "mov", [PUSH] = "push", [POP] = "pop", [LDR] = "ldr", [STR] = "str",
+    [LDM] = "ldm", [STM] = "stm", [LDMR] = "ldmr", [STMR] = "stmr", [ADD] = "add", [ADDI] = "addi",
+    [SUB] = "sub", [MUL] = "mul", [DIV] = "div", [MOD] = "mod", [EQ] = "eq", [LT] = "lt", [GT] = "gt",
+    [LEQ] = "leq", [GEQ] = "geq", [JMP] = "jmp", [JZ] = "jz", [JNZ] = "jnz", [RET] = "ret",
+    [PRINT] = "print", [PRINTC] = "printc", [READ] = "read", [WRITE] = "write", [PUTS] = "puts",
+    [GETS] = "gets", [READC] = "readc", [CMP] = "cmp", [PRC] = "prc", [SI] = "si", [INC] = "inc",
+    [DEC] = "dec", [CALL] = "call", [INT] = "int", [SARITH] = "sarith", [LDMI] = "ldmi", [STMI] = "stmi",
+    [MODES] = "modes", [VEC] = "vec",
+    /* mode specialised, see specialise() in vm.c */
+    [ADD_CHAR] = "add.c", [ADD_INT] = "add.i", [ADD_FLOAT] = "add.f", [ADD_DOUBLE] = "add.d",
+    [SUB_CHAR] = "sub.c", [SUB_INT] = "sub.i", [SUB_FLOAT] = "sub.f", [SUB_DOUBLE] = "sub.d",
+    [MUL_CHAR] = "mul.c", [MUL_INT] = "mul.i", [MUL_FLOAT] = "mul.f", [MUL_DOUBLE] = "mul.d",
+    [DIV_CHAR] = "div.c", [DIV_INT] = "div.i", [DIV_FLOAT] = "div.f", [DIV_DOUBLE] = "div.d",
+    [MOD_CHAR] = "mod.c", [MOD_INT] = "mod.i", [MOD_FLOAT] = "mod.f", [MOD_DOUBLE] = "mod.d",
+    [INC_CHAR] = "inc.c", [INC_INT] = "inc.i", [INC_FLOAT] = "inc.f", [INC_DOUBLE] = "inc.d",
+    [DEC_CHAR] = "dec.c", [DEC_INT] = "dec.i", [DEC_FLOAT] = "dec.f", [DEC_DOUBLE] = "dec.d",
+    [PRINT_CHAR] = "print.c", [PRINT_INT] = "print.i", [PRINT_FLOAT] = "print.f", [PRINT_DOUBLE] = "print.d",
+    [SARITH_CHAR] = "sarith.c", [SARITH_INT] = "sarith.i", [SARITH_FLOAT] = "sarith.f",
+    [SARITH_DOUBLE] = "sarith.d", [MOV_CHAR] = "mov.c", [MOV_INT] = "mov.i", [MOV_FLOAT] = "mov.f",
+    [MOV_DOUBLE] = "mov.d", [PUSH_CHAR] = "push.c", [PUSH_INT] = "push.i", [PUSH_FLOAT] = "push.f",
+    [PUSH_DOUBLE] = "push.d", [POP_CHAR] = "pop.c", [POP_INT] = "pop.i", [POP_FLOAT] = "pop.f",
+    [POP_DOUBLE] = "pop.d", [LDR_CHAR] = "ldr.c", [LDR_INT] = "ldr.i", [LDR_FLOAT] = "ldr.f",
+    [LDR_DOUBLE] = "ldr.d", [LDM_CHAR] = "ldm.c", [LDM_INT] = "ldm.i", [STM_CHAR] = "stm.c",
+    [STM_INT] = "stm.i", [PUTS_CHAR] = "puts.c", [PUTS_INT] = "puts.i", [GETS_CHAR] = "gets.c",
+    [GETS_INT] = "gets.i", [LDMI_CHAR] = "ldmi.c", [LDMI_INT] = "ldmi.i", [STMI_CHAR] = "stmi.c",
+    [STMI_INT] = "stmi.i"
+};
+
+const char *opName(int op) {
+    if(op >= 0 && op < (int)(sizeof(opNames) / sizeof(opNames[0])) && opNames[op] != NULL)
+        return opNames[op];
+    return "?";
+}
+
+struct symbol {
+    int pos; // pc of the label
+    char *name;
+};
+
+struct symbol *symbols = NULL;
+int symbolCount = 0;
+
+/* per pc, program.len + 1 entries */
+unsigned long long *pcCount = NULL;
+unsigned long long *pcCycles = NULL;
+/* per function, indexed by the pc of its first instruction */
+unsigned long long *fnCalls = NULL;
+unsigned long long *fnSelf = NULL;  // cycles of its own instructions
+unsigned long long *fnTotal = NULL; // cycles from call to return, including callees (recursive calls add up)
+/* per opcode */
+unsigned long long opCount[256];
+unsigned long long opCycles[256];
+
+/* the function running at each depth of the return stack and when it was called */
+int profileFrames[STACK_SIZE + 1];
+unsigned long long profileEntered[STACK_SIZE + 1];
+unsigned long long profileStart = 0;
+
+static int profileCompareSymbols(const void *a, const void *b) {
+    return ((const struct symbol *)a)->pos - ((const struct symbol *)b)->pos;
+}
+
+/* read <program>.sym, one "<pc> <label>" per line */
+void profileSymbols(char *runnable) {
+    char path[1024];
+    char *dot = strrchr(runnable, '.');
+    int stem = dot ? (int)(dot - runnable) : (int)strlen(runnable);
+    snprintf(path, sizeof(path), "%.*s.sym", stem, runnable);
+    FILE *f = fopen(path, "r");
+    if(!f)
+        return;
+    int cap = 16, pos;
+    char name[256];
+    symbols = (struct symbol *)realloc(symbols, cap * sizeof(struct symbol));
+    symbolCount = 0;
+    while(fscanf(f, "%d %255s", &pos, name) == 2) {
+        if(symbolCount == cap) {
+            cap *= 2;
+            symbols = (struct symbol *)realloc(symbols, cap * sizeof(struct symbol));
+        }
+        symbols[symbolCount].pos = pos;
+        symbols[symbolCount].name = strdup(name);
+        symbolCount++;
+    }
+    fclose(f);
+    qsort(symbols, symbolCount, sizeof(struct symbol), profileCompareSymbols);
+}
+
+/* reset the counters for the program loaded into vm */
+void profileLoad(VMState *vm, char *runnable) {
+    int n = vm->program.len + 1;
+    free(pcCount); free(pcCycles); free(fnCalls); free(fnSelf); free(fnTotal);
+    pcCount = (unsigned long long *)calloc(n, sizeof(unsigned long long));
+    pcCycles = (unsigned long long *)calloc(n, sizeof(unsigned long long));
+    fnCalls = (unsigned long long *)calloc(n, sizeof(unsigned long long));
+    fnSelf = (unsigned long long *)calloc(n, sizeof(unsigned long long));
+    fnTotal = (unsigned long long *)calloc(n, sizeof(unsigned long long));
+    memset(opCount, 0, sizeof(opCount));
+    memset(opCycles, 0, sizeof(opCycles));
+    profileSymbols(runnable);
+}
+
+/* label+offset of a pc, or the plain pc without symbols */
+void profileLabel(int at, char *buf, int size) {
+    int i = symbolCount - 1;
+    while(i >= 0 && symbols[i].pos > at) i--;
+    if(i < 0)
+        snprintf(buf, size, "%d", at);
+    else if(symbols[i].pos == at)
+        snprintf(buf, size, "%s", symbols[i].name);
+    else
+        snprintf(buf, size, "%s+%d", symbols[i].name, at - symbols[i].pos);
+}
+
+/*
+account one executed instruction
+depth is the return stack depth before it ran, rstack and pc are the values after it ran
+*/
+static inline void profileCount(VMState *vm, int at, int op, int depth, unsigned long long cycles, unsigned long long now) {
+    pcCount[at]++;
+    pcCycles[at] += cycles;
+    opCount[op & 0xFF]++;
+    opCycles[op & 0xFF] += cycles;
+    fnSelf[profileFrames[depth]] += cycles;
+    if(op == CALL && vm->rstack > depth && vm->pc >= 0 && vm->pc <= vm->program.len) {
+        profileFrames[vm->rstack] = vm->pc;
+        profileEntered[vm->rstack] = now;
+        fnCalls[vm->pc]++;
+    }
+    else if(op == RET && vm->rstack < depth) {
+        fnTotal[profileFrames[depth]] += now - profileEntered[depth];
+    }
+}
+
+static unsigned long long *profileSortBy;
+
+static int profileCompareDesc(const void *a, const void *b) {
+    unsigned long long x = profileSortBy[*(const int *)a];
+    unsigned long long y = profileSortBy[*(const int *)b];
+    return (x < y) - (x > y);
+}
+
+static double profilePercent(unsigned long long part, unsigned long long total) {
+    return total ? 100.0 * part / total : 0.0;
+}
+
+void profileReport(VMState *vm, FILE *out) {
+    char label[300];
+    unsigned long long total = 0, count = 0;
+    for(int i = 0; i < 256; i++) {
+        total += opCycles[i];
+        count += opCount[i];
+    }
+    /* the entry point runs from the start to the end */
+    fnTotal[profileFrames[0]] = profileClock() - profileStart;
+    int n = vm->program.len + 1;
+    int *order = (int *)malloc((n > 256 ? n : 256) * sizeof(int));
+
+    fprintf(out, "\nPROFILE # # # # # # # # # # # # # # # # # # # # # # # # # #\n");
+    fprintf(out, "%llu instructions, %llu %s\n", count, total, PROFILE_UNIT);
+
+    fprintf(out, "\n%-10s %14s %16s %7s\n", "opcode", "count", PROFILE_UNIT, "%");
+    int k = 0;
+    for(int i = 0; i < 256; i++)
+        if(opCount[i]) order[k++] = i;
+    profileSortBy = opCycles;
+    qsort(order, k, sizeof(int), profileCompareDesc);
+    for(int i = 0; i < k; i++)
+        fprintf(out, "%-10s %14llu %16llu %6.2f%%\n", opName(order[i]), opCount[order[i]], opCycles[order[i]], profilePercent(opCycles[order[i]], total));
+
+    fprintf(out, "\n%-24s %10s %16s %7s %16s\n", "function", "calls", "self", "%", "total");
+    k = 0;
+    for(int i = 0; i < n; i++)
+        if(fnCalls[i] || fnSelf[i]) order[k++] = i;
+    profileSortBy = fnSelf;
+    qsort(order, k, sizeof(int), profileCompareDesc);
+    for(int i = 0; i < k; i++) {
+        profileLabel(order[i], label, sizeof(label));
+        fprintf(out, "%-24s %10llu %16llu %6.2f%% %16llu\n", label, fnCalls[order[i]], fnSelf[order[i]], profilePercent(fnSelf[order[i]], total), fnTotal[order[i]]);
+    }
+
+    fprintf(out, "\n%-8s %-24s %-8s %14s %16s %7s\n", "pc", "label", "opcode", "count", PROFILE_UNIT, "%");
+    k = 0;
+    for(int i = 0; i < n; i++)
+        if(pcCount[i]) order[k++] = i;
+    profileSortBy = pcCycles;
+    qsort(order, k, sizeof(int), profileCompareDesc);
+    for(int i = 0; i < k && i < PROFILE_HOT; i++) {
+        int at = order[i];
+        profileLabel(at, label, sizeof(label));
+        fprintf(out, "%-8d %-24s %-8s %14llu %16llu %6.2f%%\n", at, label, opName(vm->program.op[at]), pcCount[at], pcCycles[at], profilePercent(pcCycles[at], total));
+    }
+    fprintf(out, "# # # # # # # # # # # # # # # # # # # # # # # # # # # # # #\n\n");
+    free(order);
+}
@@ -0,0 +1,332 @@
+/*
+Scheduler
+
+Runs any number of vms on a fixed number of worker threads, at most slice instructions at a time.
+Every worker has its own queue. It takes vms from the front of it and puts vms that yield back at
+the end, an idle worker steals the newest vm from the end of another worker's queue. Vms spawned by
+a program (int 13) go to the queue of the worker that runs their parent, so they spread over the
+workers as soon as some of them are idle.
+
+A vm blocked on queued input is parked until vmInput() or vmCloseInput() wakes it, a vm joining
+a spawned vm (int 14) is parked until that one stops. Vms that halt or fail are handed to
+vmSchedulerNext(), spawned vms to the vm that joins them. One runaway program only ever holds a
+worker for one slice.
+*/
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+/* instructions a vm runs before the worker turns to the next one */
+#define SCHEDULER_SLICE 100000
+
+struct deque {
+    pthread_mutex_t lock;
+    VMState **items; // ring buffer
+    int head;
+    int count;
+    int cap;
+};
+
+struct VMScheduler {
+    pthread_mutex_t lock;   // parking, the stopped vms and sleeping workers
+    pthread_cond_t ready;   // a queue got a vm, or the scheduler shuts down
+    pthread_cond_t stopped; // a vm halted or failed
+    struct deque *queues;   // one per worker
+    atomic_int queued;      // vms in all queues
+    atomic_int sleeping;    // workers waiting for ready
+    int nextQueue;          // queue of the next vm scheduled from outside
+    VMState *doneHead, *doneTail; // stopped vms, not yet returned by vmSchedulerNext()
+    int pending;            // scheduled vms not yet returned
+    int shutdown;
+    long long slice;
+    int threads;
+    pthread_t *workers;
+};
+
+/* the scheduler of spawned vms whose parent runs outside of a scheduler (vm prog.zvm) */
+VMScheduler *schedulerDefault = NULL;
+pthread_mutex_t schedulerDefaultLock = PTHREAD_MUTEX_INITIALIZER;
+
+int schedulerCores() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+static void dequePush(struct deque *q, VMState *vm) {
+    pthread_mutex_lock(&q->lock);
+    if(q->count == q->cap) {
+        int cap = q->cap ? q->cap * 2 : 16;
+        VMState **items = (VMState **)malloc(cap * sizeof(VMState *));
+        for(int i = 0; i < q->count; i++)
+            items[i] = q->items[(q->head + i) % q->cap];
+        free(q->items);
+        q->items = items;
+        q->head = 0;
+        q->cap = cap;
+    }
+    q->items[(q->head + q->count) % q->cap] = vm;
+    q->count++;
+    pthread_mutex_unlock(&q->lock);
+}
+
+/* the oldest vm of the queue, or the newest one if a worker steals it */
+static VMState *dequePop(struct deque *q, int steal) {
+    VMState *vm = NULL;
+    pthread_mutex_lock(&q->lock);
+    if(q->count > 0) {
+        if(steal) {
+            vm = q->items[(q->head + q->count - 1) % q->cap];
+        } else {
+            vm = q->items[q->head];
+            q->head = (q->head + 1) % q->cap;
+        }
+        q->count--;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return vm;
+}
+
+/* put a vm into a queue and wake a sleeping worker, without holding s->lock */
+static void schedulerPush(VMScheduler *s, int queue, VMState *vm) {
+    dequePush(&s->queues[queue], vm);
+    atomic_fetch_add(&s->queued, 1);
+    if(atomic_load(&s->sleeping) > 0) {
+        pthread_mutex_lock(&s->lock);
+        pthread_cond_signal(&s->ready);
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+static VMState *schedulerTake(VMScheduler *s, int self) {
+    VMState *vm = dequePop(&s->queues[self], 0);
+    for(int i = 1; vm == NULL && i < s->threads; i++)
+        vm = dequePop(&s->queues[(self + i) % s->threads], 1);
+    if(vm != NULL)
+        atomic_fetch_sub(&s->queued, 1);
+    return vm;
+}
+
+/* new input for vm, continue it if it is parked */
+void schedulerWake(VMState *vm) {
+    VMScheduler *s = vm->scheduler;
+    if(s == NULL)
+        return;
+    pthread_mutex_lock(&s->lock);
+    int wake = vm->parked;
+    vm->parked = false;
+    int queue = vm->worker;
+    pthread_mutex_unlock(&s->lock);
+    if(wake)
+        schedulerPush(s, queue, vm);
+}
+
+/* a blocked vm can go on, the scheduler lock is held */
+static int schedulerCanResume(VMState *vm) {
+    if(vm->joining != NULL)
+        return vm->joining->done;
+    pthread_mutex_lock(&vm->inputLock);
+    int arrived = vm->console.queued != vm->blockedAt || vm->console.queueClosed;
+    pthread_mutex_unlock(&vm->inputLock);
+    return arrived;
+}
+
+/* a worker ran vm for a slice and got result */
+static void schedulerStopped(VMScheduler *s, VMState *vm, int result, int self) {
+    VMState *resume = NULL, *detached = NULL;
+    pthread_mutex_lock(&s->lock);
+    if(result == VM_YIELDED || (result == VM_BLOCKED && schedulerCanResume(vm))) {
+        resume = vm;
+    } else if(result == VM_BLOCKED) {
+        vm->parked = true;
+        if(vm->joining != NULL)
+            vm->joining->joiner = vm;
+    } else if(vm->spawned) {
+        /* hand the result to the joining vm, a vm whose parent is gone is freed */
+        vm->done = true;
+        if(vm->joiner != NULL && vm->joiner->parked) {
+            vm->joiner->parked = false;
+            resume = vm->joiner;
+        }
+        if(vm->parent == NULL)
+            detached = vm;
+        pthread_cond_broadcast(&s->stopped);
+    } else {
+        vm->done = true;
+        vm->nextQueued = NULL;
+        if(s->doneTail != NULL) s->doneTail->nextQueued = vm;
+        else s->doneHead = vm;
+        s->doneTail = vm;
+        pthread_cond_broadcast(&s->stopped);
+    }
+    pthread_mutex_unlock(&s->lock);
+    if(resume != NULL)
+        schedulerPush(s, self, resume);
+    if(detached != NULL)
+        vmDestroy(detached);
+}
+
+struct worker {
+    VMScheduler *s;
+    int self;
+};
+
+static void *schedulerWorker(void *arg) {
+    VMScheduler *s = ((struct worker *)arg)->s;
+    int self = ((struct worker *)arg)->self;
+    free(arg);
+    while(1) {
+        /* vms still queued at shutdown stay where they are */
+        pthread_mutex_lock(&s->lock);
+        int shutdown = s->shutdown;
+        pthread_mutex_unlock(&s->lock);
+        if(shutdown)
+            break;
+        VMState *vm = schedulerTake(s, self);
+        if(vm == NULL) {
+            pthread_mutex_lock(&s->lock);
+            atomic_fetch_add(&s->sleeping, 1);
+            while(atomic_load(&s->queued) == 0 && !s->shutdown)
+                pthread_cond_wait(&s->ready, &s->lock);
+            atomic_fetch_sub(&s->sleeping, 1);
+            pthread_mutex_unlock(&s->lock);
+            continue;
+        }
+        vm->worker = self;
+        schedulerStopped(s, vm, vmRun(vm, s->slice), self);
+    }
+    return NULL;
+}
+
+VMScheduler *vmSchedulerCreate(int threads, long long slice) {
+    VMScheduler *s = (VMScheduler *)calloc(1, sizeof(VMScheduler));
+    if(threads < 1) threads = 1;
+    s->threads = threads;
+    s->slice = slice > 0 ? slice : 0;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->ready, NULL);
+    pthread_cond_init(&s->stopped, NULL);
+    atomic_init(&s->queued, 0);
+    atomic_init(&s->sleeping, 0);
+    s->queues = (struct deque *)calloc(threads, sizeof(struct deque));
+    for(int i = 0; i < threads; i++)
+        pthread_mutex_init(&s->queues[i].lock, NULL);
+    s->workers = (pthread_t *)malloc(threads * sizeof(pthread_t));
+    for(int i = 0; i < threads; i++) {
+        struct worker *w = (struct worker *)malloc(sizeof(struct worker));
+        w->s = s;
+        w->self = i;
+        pthread_create(&s->workers[i], NULL, schedulerWorker, w);
+    }
+    return s;
+}
+
+void vmSchedule(VMScheduler *s, VMState *vm) {
+    pthread_mutex_lock(&s->lock);
+    vm->scheduler = s;
+    vm->parked = false;
+    vm->done = false;
+    s->pending++;
+    int queue = s->nextQueue;
+    s->nextQueue = (s->nextQueue + 1) % s->threads;
+    pthread_mutex_unlock(&s->lock);
+    vm->worker = queue;
+    schedulerPush(s, queue, vm);
+}
+
+VMState *vmSchedulerNext(VMScheduler *s) {
+    pthread_mutex_lock(&s->lock);
+    while(s->doneHead == NULL && s->pending > 0)
+        pthread_cond_wait(&s->stopped, &s->lock);
+    VMState *vm = s->doneHead;
+    if(vm != NULL) {
+        s->doneHead = vm->nextQueued;
+        if(s->doneHead == NULL) s->doneTail = NULL;
+        vm->nextQueued = NULL;
+        vm->scheduler = NULL;
+        s->pending--;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return vm;
+}
+
+void vmSchedulerDestroy(VMScheduler *s) {
+    pthread_mutex_lock(&s->lock);
+    s->shutdown = 1;
+    pthread_cond_broadcast(&s->ready);
+    pthread_mutex_unlock(&s->lock);
+    for(int i = 0; i < s->threads; i++)
+        pthread_join(s->workers[i], NULL);
+    for(int i = 0; i < s->threads; i++) {
+        pthread_mutex_destroy(&s->queues[i].lock);
+        free(s->queues[i].items);
+    }
+    free(s->queues);
+    free(s->workers);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->ready);
+    pthread_cond_destroy(&s->stopped);
+    free(s);
+}
+
+/*
+Green threads of a program
+int 13 runs a label in a new vm that shares the memory of its parent, int 14 waits for it
+*/
+
+/* start a spawned vm next to its parent */
+void schedulerSpawn(VMState *parent, VMState *child) {
+    VMScheduler *s = parent->scheduler;
+    int queue = parent->worker;
+    if(s == NULL) {
+        pthread_mutex_lock(&schedulerDefaultLock);
+        if(schedulerDefault == NULL)
+            schedulerDefault = vmSchedulerCreate(schedulerCores(), SCHEDULER_SLICE);
+        pthread_mutex_unlock(&schedulerDefaultLock);
+        s = schedulerDefault;
+        pthread_mutex_lock(&s->lock);
+        queue = s->nextQueue;
+        s->nextQueue = (s->nextQueue + 1) % s->threads;
+        pthread_mutex_unlock(&s->lock);
+    }
+    child->scheduler = s;
+    child->spawned = true;
+    child->worker = queue;
+    schedulerPush(s, queue, child);
+}
+
+/*
+has child stopped? a parent outside of a scheduler waits for it here,
+a scheduled parent gets parked by the worker when it returns VM_BLOCKED
+*/
+int schedulerJoin(VMState *parent, VMState *child) {
+    VMScheduler *s = child->scheduler;
+    pthread_mutex_lock(&s->lock);
+    if(parent->scheduler == NULL)
+        while(!child->done)
+            pthread_cond_wait(&s->stopped, &s->lock);
+    int done = child->done;
+    pthread_mutex_unlock(&s->lock);
+    return done;
+}
+
+/* the parent of child is destroyed, child gets freed when it stops. returns 1 if it already has */
+int schedulerDetach(VMState *child) {
+    VMScheduler *s = child->scheduler;
+    pthread_mutex_lock(&s->lock);
+    child->parent = NULL;
+    int done = child->done;
+    pthread_mutex_unlock(&s->lock);
+    return done;
+}
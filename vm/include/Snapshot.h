@@ -0,0 +1,197 @@
+/*
+Snapshots, int 20 and vm --restore <file>
+
+A snapshot is the whole state of a vm in one file: the program, both register banks, both stacks, pc,
+zeroflag, the arithmetic and memory modes and every memory location. A program that spends its
+start building tables takes one once (int 20), later runs restore it and go on behind the int
+without doing the work again.
+
+vmRestore() maps the file and the memory locations point into the mapping like the locations of
+the bootfile, nothing is copied until a location is written (memWritable()). The mapping belongs
+to the memory store and stores forked from it, the last one unmaps it. Console, input and spawned
+vms are not part of a snapshot, the bootfile is not read again on restore.
+
+Layout, native byte order like the bootfile:
+struct snapshot, the program as pairs of instruction and value words, the stack, the returnstack,
+then for every location its key, its length and the data padded to 4 bytes.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* header id, "SNAP" */
+#define SNAPSHOT_ID 0x50414E53
+#define SNAPSHOT_VERSION 2
+
+struct snapshot {
+    int id;
+    int version;
+    int words;     // program image words
+    int pc;
+    int zeroflag;
+    int arith_mode;
+    int memory_rw_mode;
+    int pstack;
+    int rstack;
+    int locations;
+    int regs[NUM_REG + 1];
+    double dregs[NUM_REG + 1];
+};
+
+#define SNAPSHOT_PAD(len) (((len) + 3) & ~3)
+
+int vmSnapshot(VMState *vm, const char *file) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+    FILE *f = fopen(tmp, "wb");
+    if(!f)
+        return -1;
+    struct snapshot h;
+    memset(&h, 0, sizeof(h));
+    h.id = SNAPSHOT_ID;
+    h.version = SNAPSHOT_VERSION;
+    h.words = vm->program.len * 2;
+    h.pc = vm->pc;
+    h.zeroflag = vm->zeroflag;
+    h.arith_mode = vm->arith_mode;
+    h.memory_rw_mode = vm->memory_rw_mode;
+    h.pstack = vm->pstack;
+    h.rstack = vm->rstack;
+    memcpy(h.regs, vm->regs, sizeof(h.regs));
+    memcpy(h.dregs, vm->dregs, sizeof(h.dregs));
+    /* no location gets replaced while it is written, stm may still change bytes in place */
+    memLock(vm);
+    int count;
+    struct node **list = memSorted(vm->mem, &count);
+    h.locations = count;
+    fwrite(&h, sizeof(h), 1, f);
+    for(int i = 0; i < vm->program.len; i++) {
+        unsigned int image[2];
+        image[0] = encode(&vm->program, i);
+        image[1] = vm->program.imm[i];
+        fwrite(image, sizeof(image), 1, f);
+    }
+    fwrite(vm->stack, sizeof(int), vm->pstack, f);
+    fwrite(vm->returnstack, sizeof(int), vm->rstack, f);
+    static const char zero[4] = {0};
+    for(int i = 0; i < count; i++) {
+        int entry[2] = {list[i]->key, list[i]->len};
+        fwrite(entry, sizeof(entry), 1, f);
+        fwrite(list[i]->data, 1, list[i]->len, f);
+        fwrite(zero, 1, SNAPSHOT_PAD(list[i]->len) - list[i]->len, f);
+    }
+    memUnlock(vm);
+    free(list);
+    int failed = ferror(f);
+    if(fclose(f) != 0 || failed) {
+        remove(tmp);
+        return -1;
+    }
+#ifdef _WIN32
+    remove(file);
+#endif
+    return rename(tmp, file) == 0 ? 0 : -1;
+}
+
+/* check that every part of a mapped snapshot lies inside it, returns the offset behind it or -1 */
+static long snapshotCheck(const char *base, long size) {
+    if(size < (long)sizeof(struct snapshot))
+        return -1;
+    const struct snapshot *h = (const struct snapshot *)base;
+    if(h->id != SNAPSHOT_ID || h->version != SNAPSHOT_VERSION)
+        return -1;
+    if(h->words < 0 || h->words % 2 != 0 || h->pc < 0 || h->pc > h->words / 2 || h->locations < 0)
+        return -1;
+    if(h->pstack < 0 || h->pstack > STACK_SIZE || h->rstack < 0 || h->rstack >= STACK_SIZE)
+        return -1;
+    long pos = sizeof(struct snapshot) + ((long)h->words + h->pstack + h->rstack) * sizeof(int);
+    if(pos > size)
+        return -1;
+    for(int i = 0; i < h->locations; i++) {
+        if(pos + 2 * (long)sizeof(int) > size)
+            return -1;
+        int len = ((const int *)(base + pos))[1];
+        if(len < 0)
+            return -1;
+        pos += 2 * sizeof(int) + SNAPSHOT_PAD((long)len);
+        if(pos > size)
+            return -1;
+    }
+    return pos;
+}
+
+/* replace the state of a vm that has no spawned vms running, the vm is unchanged if it fails */
+int vmRestore(VMState *vm, const char *file) {
+    long size;
+    char *base = storageMap((char *)file, &size);
+    if(base == NULL)
+        return -1;
+    if(snapshotCheck(base, size) < 0) {
+        storageUnmap(base, size);
+        return -1;
+    }
+    const struct snapshot *h = (const struct snapshot *)base;
+    const int *words = (const int *)(base + sizeof(struct snapshot));
+    decode(vm, (const unsigned int *)words, h->words);
+    words += h->words;
+    memcpy(vm->regs, h->regs, sizeof(vm->regs));
+    memcpy(vm->dregs, h->dregs, sizeof(vm->dregs));
+    memcpy(vm->stack, words, h->pstack * sizeof(int));
+    words += h->pstack;
+    memcpy(vm->returnstack, words, h->rstack * sizeof(int));
+    words += h->rstack;
+    vm->pstack = h->pstack;
+    vm->rstack = h->rstack;
+    vm->pc = h->pc;
+    vm->zeroflag = h->zeroflag;
+    vm->arith_mode = h->arith_mode;
+    vm->memory_rw_mode = h->memory_rw_mode;
+    vm->running = 1;
+    vm->faulted = false;
+    specialise(vm, vm->pc);
+    /* a new store that owns the mapping, the old one is released */
+    memRelease(vm->mem, vm->reader);
+    vm->mem = memCreate();
+    vm->reader = memRetain(vm->mem);
+    vm->mem->mapping = (struct memmapping *)malloc(sizeof(struct memmapping));
+    vm->mem->mapping->base = base;
+    vm->mem->mapping->size = size;
+    vm->mem->mapping->refs = 1;
+    const char *p = (const char *)words;
+    for(int i = 0; i < h->locations; i++) {
+        int key = ((const int *)p)[0];
+        int len = ((const int *)p)[1];
+        p += 2 * sizeof(int);
+        insertFirst(vm->mem, key, (unsigned char *)p, len);
+        find(vm->mem, key)->mapped = 1;
+        if(len > 0) vm->mem->allocs--; // the data is mapped, not allocated
+        p += SNAPSHOT_PAD(len);
+    }
+    return 0;
+}
+
+/*
+int 20, snapshot to the file named by a memory location
+the zeroflag is set in the snapshot, so a restored program can tell that it was restored
+*/
+void vmSnapshotInt(VMState *vm) {
+    int loc = popv(vm);
+    memRead(vm);
+    struct node *n = find(vm->mem, loc);
+    if(n == NULL) {
+        char dbg[128];
+        snprintf(dbg, sizeof(dbg), "\n[!!!!!] Bad snapshot! pc: %d location: %d\n", vm->pc, loc);
+        vmFault(vm, dbg);
+    }
+    // the location is not terminated if it is mapped
+    char *file = (char *)malloc(n->len + 1);
+    memcpy(file, n->data, n->len);
+    file[n->len] = '\0';
+    memReadDone(vm);
+    vm->zeroflag = true;
+    if(vmSnapshot(vm, file) != 0)
+        consolePrintf(&vm->console, "[snapshot] could not write '%s'\n", file);
+    vm->zeroflag = false;
+    free(file);
+}
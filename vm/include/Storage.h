@@ -8,138 +8,394 @@ A class that represents the virtual machines memory
 Right now the storage only read/write to a binary file
 when an address in memory is stored using special functions, data on disk gets updated too
 
+The storage file is a journal: a header followed by records. Every change appends one record,
+the last record of an id wins and a record with length STORAGE_DELETED removes the id.
+readStorage() replays the journal, compactStorage() rewrites it with only the live entries.
+Files in the old format (header followed by <len> entries) are still read and get converted
+to a journal on the first write.
+
 */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* header id of the journal format, "JRNL" */
+#define STORAGE_JOURNAL 0x4C4E524A
+/* record length of a deleted entry */
+#define STORAGE_DELETED -1
 
 struct header {
     int id;
-    int len; // total length == no of files!
+    int len; // total length == no of files! in a journal: live entries at the last compaction
 };
 
 struct entry {
-    int id; // id of the block      
-    int len; // length of data        
-    char *data; // pointer to current data  
+    int id; // id of the block
+    int len; // length of data
+    char *data; // pointer to current data
 };
 
+/* a journal record, followed by len bytes of data */
+struct record {
+    int id;
+    int len;
+    unsigned int checksum; // over id, len and data, a torn append fails the check
+};
 
-void readStorage(char *src) {    
+/* bookkeeping of the mounted journal */
+long journalEnd = -1;   // offset behind the last valid record, -1 if unknown
+int journalRecords = 0; // records in the journal
+int journalLive = 0;    // live entries after the last replay or compaction
+int journalAppended = 0; // records appended by this process
 
-    FILE *f = fopen(src, "rb");           
-    /* get the header */
-    struct header inhdr;
-    fread(&inhdr.id, sizeof(int), 1, f);
-    fread(&inhdr.len, sizeof(int), 1, f);    
-    /* create a new list to store all existing entries */
-    struct entry list[inhdr.len];       
-    /* get the entries */
-    int id, len = 0; 
-    char *data; 
-    int inputLength = 0;
-    while(inputLength < inhdr.len) {    
-        fread(&id, sizeof(int), 1, f);
-        fread(&len, sizeof(int), 1, f);
-        /* reserve memory for <n> amount of data */
-        data = malloc((len + 1) * sizeof(char));
-        fread(data, sizeof(char), len, f);
-        struct entry e = {id, len, data};
-        list[inputLength++] = e;        
-    }    
-    /* append them to the vm's memory */    
-    int outputLength = 0;
-    while(outputLength < inputLength) {
-        insertFirst(list[outputLength].id, &list[outputLength].data[0], list[outputLength].len);
-        outputLength++;
-    }        
+/*
+the file and the bookkeeping above are shared by every memory store of the process, forks have their
+own store and lock (memFork()) but write the same file. appending, rewriting and syncing hold this
+*/
+pthread_mutex_t storageLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* FNV-1a over the record */
+unsigned int storageChecksum(int id, int len, const char *data) {
+    unsigned int h = 2166136261u;
+    const unsigned char *p = (const unsigned char *)&id;
+    for(int i = 0; i < (int)sizeof(int); i++) { h ^= p[i]; h *= 16777619u; }
+    p = (const unsigned char *)&len;
+    for(int i = 0; i < (int)sizeof(int); i++) { h ^= p[i]; h *= 16777619u; }
+    p = (const unsigned char *)data;
+    for(int i = 0; i < len; i++) { h ^= p[i]; h *= 16777619u; }
+    return h;
+}
+
+/*
+map a storage file into memory, read only
+without mmap (windows) the file is read into a single buffer
+*/
+char *storageMap(char *src, long *size) {
+    *size = 0;
+#ifdef _WIN32
+    FILE *f = fopen(src, "rb");
+    if(!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *base = (char *)malloc(len + 1);
+    if(base == NULL || (long)fread(base, 1, len, f) != len) {
+        free(base);
+        fclose(f);
+        return NULL;
+    }
     fclose(f);
+#else
+    int fd = open(src, O_RDONLY);
+    if(fd < 0)
+        return NULL;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    long len = st.st_size;
+    char *base = (char *)mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED)
+        return NULL;
+#endif
+    *size = len;
+    return base;
 }
 
-void createFile(char *src, int newId, char *newdata, int dataLen) {
-    FILE *f = fopen(src, "rb");       
-    /* get the header */
+void storageUnmap(char *base, long size) {
+#ifdef _WIN32
+    free(base);
+#else
+    munmap(base, size);
+#endif
+}
+
+/*
+parse the entries of a mapped storage file in file order, deleted entries have len STORAGE_DELETED
+the data of every entry points into the mapping. returns a new array, the caller frees it
+*/
+struct entry *storageEntries(char *base, long size, int *count, int *journal) {
+    *count = 0;
+    *journal = 0;
+    if(base == NULL || size < (long)sizeof(struct header))
+        return NULL;
     struct header inhdr;
-    fread(&inhdr.id, sizeof(int), 1, f);
-    fread(&inhdr.len, sizeof(int), 1, f);
-    /* create a new list to store all existing entries */
-    struct entry list[inhdr.len];    
-    /* get the entries */
-    int id, len = 0; char *data; 
-    int inputLength = 0;
-    while(inputLength < inhdr.len) {    
-        fread(&id, sizeof(int), 1, f);
-        fread(&len, sizeof(int), 1, f);
-        /* reserve memory for <n> amount of data */
-        data = malloc((len + 1) * sizeof(char));
-        fread(data, sizeof(char), len, f);
-        struct entry e = {id, len, data};
-        list[inputLength] = e;
-        inputLength++;        
-    }    
-    fclose(f);    
-    f = fopen(src, "wb");    
-    /* increase header length by 1 and write it back to file */
-    struct header outhdr = {inhdr.id, inhdr.len + 1};
-    fwrite(&outhdr, sizeof(struct header), 1, f);    
-    /* write all pre existing data back to file */
-    int outputLength = 0;
-    while(outputLength < inputLength) {
-        fwrite(&list[outputLength].id, sizeof(int), 1, f);
-        fwrite(&list[outputLength].len, sizeof(int), 1, f);
-        fwrite(&list[outputLength].data[0], sizeof(char), list[outputLength].len, f);
-        outputLength++;
+    memcpy(&inhdr, base, sizeof(struct header));
+    long pos = sizeof(struct header);
+    int cap = 16, n = 0;
+    struct entry *list = (struct entry *)malloc(cap * sizeof(struct entry));
+    if(inhdr.id == STORAGE_JOURNAL) {
+        /* 
+        replay records until the end of the file or the first torn record
+        the first inhdr.len records were written by a compaction and are trusted, only appended records get their checksum verified
+        */
+        *journal = 1;
+        journalEnd = pos;
+        struct record r;
+        while(pos + (long)sizeof(struct record) <= size) {
+            memcpy(&r, base + pos, sizeof(struct record));
+            int len = r.len > 0 ? r.len : 0;
+            char *data = base + pos + sizeof(struct record);
+            if(r.len < STORAGE_DELETED || pos + (long)sizeof(struct record) + len > size) break;
+            if(n >= inhdr.len && storageChecksum(r.id, r.len, data) != r.checksum) break;
+            if(n == cap) {
+                cap *= 2;
+                list = (struct entry *)realloc(list, cap * sizeof(struct entry));
+            }
+            struct entry e = {r.id, r.len, data};
+            list[n++] = e;
+            pos += sizeof(struct record) + len;
+            journalEnd = pos;
+        }
+    } else {
+        /* the old format, header len is the number of entries */
+        int id, len = 0;
+        while(n < inhdr.len && pos + 2 * (long)sizeof(int) <= size) {
+            memcpy(&id, base + pos, sizeof(int));
+            memcpy(&len, base + pos + sizeof(int), sizeof(int));
+            pos += 2 * sizeof(int);
+            if(len < 0 || pos + len > size) break;
+            if(n == cap) {
+                cap *= 2;
+                list = (struct entry *)realloc(list, cap * sizeof(struct entry));
+            }
+            struct entry e = {id, len, base + pos};
+            list[n++] = e;
+            pos += len;
+        }
+        journalEnd = -1;
     }
-    /* append the new one at the end */
-    struct entry e;   
-    e.id = newId;
-    e.data = newdata;
-    e.len = dataLen;
-    fwrite(&e.id, sizeof(int), 1, f);
-    fwrite(&e.len, sizeof(int), 1, f);
-    fwrite(e.data, sizeof(char), e.len, f);        
-    fclose(f);    
+    *count = n;
+    return list;
 }
 
-void deleteFile(char *src, int entryId) {
-    FILE *f = fopen(src, "rb");       
-    /* get the header */
-    struct header inhdr;
-    fread(&inhdr.id, sizeof(int), 1, f);
-    fread(&inhdr.len, sizeof(int), 1, f);
-    /* create a new list to store all existing entries */
-    struct entry list[inhdr.len];    
-    /* get the entries */
-    int id, len = 0; char *data; 
-    int inputLength = 0;
-    while(inputLength < inhdr.len) {    
-        fread(&id, sizeof(int), 1, f);
-        fread(&len, sizeof(int), 1, f);
-        /* reserve memory for <n> amount of data */
-        data = malloc((len + 1) * sizeof(char));
-        fread(data, sizeof(char), len, f);
-        struct entry e = {id, len, data};
-        list[inputLength] = e;
-        inputLength++;        
-    }    
-    fclose(f);
-    f = fopen(src, "wb");
-    /* decrease header length nby 1 and write it back to file */    
-    struct header outhdr;
-    outhdr.len = inhdr.len - 1;
-    fwrite(&outhdr.id, sizeof(int), 1, f);
-    fwrite(&outhdr.len, sizeof(int), 1, f);    
-    /* write all pre existed files back*/
-    int outputLength = 0;
-    while(outputLength < inputLength) {
-        if(list[outputLength].id == entryId) {
-            /* except the one to delete */
-        } else {
-            fwrite(&list[outputLength].id, sizeof(int), 1, f);
-            fwrite(&list[outputLength].len, sizeof(int), 1, f);
-            fwrite(&list[outputLength].data[0], sizeof(char), list[outputLength].len, f);
+struct slot {
+    int id;
+    int seq; // position in the file
+};
+
+static int storageCompareSlots(const void *a, const void *b) {
+    const struct slot *sa = (const struct slot *)a;
+    const struct slot *sb = (const struct slot *)b;
+    if(sa->id != sb->id)
+        return (sa->id > sb->id) - (sa->id < sb->id);
+    return sa->seq - sb->seq;
+}
+
+/* 
+mark the entries of list that are live, the last record of every id unless it deletes the id
+returns the number of live entries
+*/
+static int storageLive(struct entry *list, int count, char *keep) {
+    struct slot *slots = (struct slot *)malloc((count + 1) * sizeof(struct slot));
+    for(int i = 0; i < count; i++) {
+        slots[i].id = list[i].id;
+        slots[i].seq = i;
+        keep[i] = 0;
+    }
+    qsort(slots, count, sizeof(struct slot), storageCompareSlots);
+    int live = 0;
+    for(int i = 0; i < count; i++) {
+        if(i + 1 < count && slots[i + 1].id == slots[i].id)
+            continue;
+        if(list[slots[i].seq].len != STORAGE_DELETED) {
+            keep[slots[i].seq] = 1;
+            live++;
         }
-        outputLength++;
-    } 
-    fclose(f);      
-}
\ No newline at end of file
+    }
+    free(slots);
+    return live;
+}
+
+/* 
+the mounted bootfile, memory locations point into it until they get written 
+storageList holds its live entries, every vm that loads the bootfile shares them
+*/
+char *storageBase = NULL;
+long storageSize = 0;
+struct entry *storageList = NULL;
+int storageCount = 0;
+int storageMounted = 0;
+
+/* map the bootfile and replay its journal, only the first call does anything */
+void mountStorage(char *src) {
+    if(storageMounted)
+        return;
+    storageMounted = 1;
+    int count, journal;
+    storageBase = storageMap(src, &storageSize);
+    struct entry *list = storageEntries(storageBase, storageSize, &count, &journal);
+    if(list == NULL)
+        return;
+    char *keep = (char *)malloc(count + 1);
+    int live = storageLive(list, count, keep);
+    storageList = (struct entry *)malloc((live + 1) * sizeof(struct entry));
+    storageCount = 0;
+    for(int i = 0; i < count; i++)
+        if(keep[i])
+            storageList[storageCount++] = list[i];
+    free(keep);
+    free(list);
+    journalRecords = journal ? count : 0;
+    journalLive = live;
+    journalAppended = 0;
+}
+
+/*
+load the storage into a vm's memory
+the file is mapped once and every memory location points into the mapping, so nothing gets copied
+at startup. STM/STMR copy a location before they write to it, see memWritable()
+*/
+void readStorage(struct memstore *m, char *src) {
+    mountStorage(src);
+    for(int i = 0; i < storageCount; i++) {
+        struct node *old = deleteNode(m, storageList[i].id);
+        if(old != NULL)
+            memFree(old);
+        insertFirst(m, storageList[i].id, (unsigned char *)storageList[i].data, storageList[i].len);
+        find(m, storageList[i].id)->mapped = 1;
+        if(storageList[i].len > 0) m->allocs--; // the data is mapped, not allocated
+    }
+}
+
+static void writeRecord(FILE *f, int id, int len, char *data) {
+    struct record r = {id, len, storageChecksum(id, len, data)};
+    fwrite(&r, sizeof(struct record), 1, f);
+    if(len > 0)
+        fwrite(data, sizeof(char), len, f);
+}
+
+/*
+rewrite the storage file as a journal with one record per live entry
+extra entries are applied on top of the file, they replace entries with the same id
+the new journal is written to <src>.tmp and renamed, so a crash leaves either the old or the new file
+the caller holds storageLock
+*/
+static void rewriteStorage(char *src, struct entry *extra, int extraCount) {
+    int count, journal;
+    long size;
+    char *base = storageMap(src, &size);
+    struct entry *list = storageEntries(base, size, &count, &journal);
+    if(extraCount > 0) {
+        list = (struct entry *)realloc(list, (count + extraCount) * sizeof(struct entry));
+        memcpy(list + count, extra, extraCount * sizeof(struct entry));
+        count += extraCount;
+    }
+    /* the last record of every id wins */
+    char *keep = (char *)malloc(count + 1);
+    int live = storageLive(list, count, keep);
+    char tmp[1024];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", src);
+    FILE *f = fopen(tmp, "wb");
+    if(f) {
+        struct header outhdr = {STORAGE_JOURNAL, live};
+        fwrite(&outhdr, sizeof(struct header), 1, f);
+        for(int i = 0; i < count; i++) {
+            if(keep[i])
+                writeRecord(f, list[i].id, list[i].len, list[i].data);
+        }
+        journalEnd = ftell(f);
+        fclose(f);
+        #ifdef _WIN32
+        remove(src);
+        #endif
+        rename(tmp, src);
+        journalRecords = live;
+        journalLive = live;
+        journalAppended = 0;
+    } else {
+        fprintf(stderr, "[storage] could not write '%s'\n", tmp);
+    }
+    free(list);
+    free(keep);
+    if(base != NULL)
+        storageUnmap(base, size);
+}
+
+void compactStorage(char *src) {
+    pthread_mutex_lock(&storageLock);
+    rewriteStorage(src, NULL, 0);
+    pthread_mutex_unlock(&storageLock);
+}
+
+/* append a record to the journal, an old format file gets converted first */
+static void appendRecord(char *src, int id, int len, char *data) {
+    pthread_mutex_lock(&storageLock);
+    if(journalEnd < 0)
+        rewriteStorage(src, NULL, 0);
+    FILE *f = fopen(src, "r+b");
+    if(!f) {
+        fprintf(stderr, "[storage] could not open '%s'\n", src);
+        pthread_mutex_unlock(&storageLock);
+        return;
+    }
+    fseek(f, journalEnd, SEEK_SET);
+    writeRecord(f, id, len, data);
+    journalEnd = ftell(f);
+    fclose(f);
+    journalRecords++;
+    journalAppended++;
+    pthread_mutex_unlock(&storageLock);
+}
+
+/* store an entry, it replaces an existing entry with the same id */
+void createFile(char *src, int newId, char *newdata, int dataLen) {
+    appendRecord(src, newId, dataLen, newdata);
+}
+
+void deleteFile(char *src, int entryId) {
+    appendRecord(src, entryId, STORAGE_DELETED, NULL);
+}
+
+/* write-back: mark a memory location to be written by the next storageSync() */
+void storageDirty(struct memstore *m, struct node *n) {
+    if(n->dirty)
+        return;
+    n->dirty = 1;
+    if(m->dirtyCount == m->dirtyCap) {
+        m->dirtyCap = m->dirtyCap ? m->dirtyCap * 2 : 64;
+        m->dirtyIds = (int *)realloc(m->dirtyIds, m->dirtyCap * sizeof(int));
+    }
+    m->dirtyIds[m->dirtyCount++] = n->key;
+}
+
+/*
+write all dirty memory locations of a store to the storage file
+the file is rewritten through a temporary file and renamed, so it is never seen half written
+*/
+void storageSync(struct memstore *m, char *src) {
+    if(m->dirtyCount == 0)
+        return;
+    struct entry *extra = (struct entry *)malloc(m->dirtyCount * sizeof(struct entry));
+    int n = 0;
+    for(int i = 0; i < m->dirtyCount; i++) {
+        /* an id can be listed twice if its location was replaced, the first one writes it */
+        struct node *loc = find(m, m->dirtyIds[i]);
+        if(loc == NULL || !loc->dirty)
+            continue;
+        struct entry e = {loc->key, loc->len, (char *)loc->data};
+        extra[n++] = e;
+        loc->dirty = 0;
+    }
+    pthread_mutex_lock(&storageLock);
+    rewriteStorage(src, extra, n);
+    pthread_mutex_unlock(&storageLock);
+    free(extra);
+    m->dirtyCount = 0;
+}
+
+/* compact the journal on exit if most of its records are outdated */
+void closeStorage(char *src) {
+    pthread_mutex_lock(&storageLock);
+    if(journalAppended > 0 && journalRecords > 2 * journalLive)
+        rewriteStorage(src, NULL, 0);
+    pthread_mutex_unlock(&storageLock);
+}
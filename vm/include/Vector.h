@@ -0,0 +1,428 @@
+/*
+Vector instructions, vadd vsub vmul vdiv vscale vdot vsum vmin vmax
+
+They work on whole memory locations of 4 byte cells, the layout of the int memory mode (int 2).
+The cells are ints in char and int mode and floats in float and double mode (int 11/22). One
+instruction replaces a loop of ldm/stm over the location. The locations are on the stack like for
+the other memory instructions:
+
+push dst, push a, push b, vadd      dst = a + b element by element (vsub, vmul, vdiv)
+push dst, push a, push s, vscale    dst = a * s
+push a, push b, vdot                pushes the sum of a * b
+push a, vsum                        pushes the sum of a (vmin, vmax the smallest and the biggest)
+
+Element by element instructions go as far as the shorter location, dst is replaced by a new
+location like puts does (a and b may be dst). A location that doesn't exist is empty, the sum of an
+empty one is 0 and so are its min and max. In double mode the locations, the scalar and the
+results are doubles, two words like everything pushed in double mode. ints wrap around, an int
+division by 0 stops the vm.
+
+The kernels are chosen when the first vector instruction runs: AVX2 if the cpu has it, SSE2 on
+every other x86-64 cpu and plain C elsewhere. The order of the additions of vdot and vsum depends
+on the kernel, float results can differ in the last bits between machines.
+
+The assembler writes all of them as VEC, the operation is the value.
+*/
+
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define VEC_X86
+#include <immintrin.h>
+#endif
+
+/* the value of VEC */
+enum {
+    VEC_ADD,
+    VEC_SUB,
+    VEC_MUL,
+    VEC_DIV,
+    VEC_SCALE,
+    VEC_DOT,
+    VEC_SUM,
+    VEC_MIN,
+    VEC_MAX
+};
+
+/* the cells are unaligned in mapped locations, every access goes through memcpy or loadu */
+static inline int vecInt(const unsigned char *p, int i) {
+    int v;
+    memcpy(&v, p + 4 * i, sizeof(v));
+    return v;
+}
+
+static inline float vecFloat(const unsigned char *p, int i) {
+    float v;
+    memcpy(&v, p + 4 * i, sizeof(v));
+    return v;
+}
+
+static inline void vecSetInt(unsigned char *p, int i, int v) {
+    memcpy(p + 4 * i, &v, sizeof(v));
+}
+
+static inline void vecSetFloat(unsigned char *p, int i, float v) {
+    memcpy(p + 4 * i, &v, sizeof(v));
+}
+
+/*
+plain C, the SIMD kernels finish their last cells with it (from). ints are computed as unsigned,
+they wrap around like the int arithmetic of the vm does on x86. b of vscale is NULL
+*/
+static void vecMapIntFrom(int op, unsigned char *d, const unsigned char *a, const unsigned char *b, int s, int n, int from) {
+    int i = from;
+    switch(op) {
+        case VEC_ADD: for(; i < n; i++) vecSetInt(d, i, (int)((unsigned)vecInt(a, i) + (unsigned)vecInt(b, i))); break;
+        case VEC_SUB: for(; i < n; i++) vecSetInt(d, i, (int)((unsigned)vecInt(a, i) - (unsigned)vecInt(b, i))); break;
+        case VEC_MUL: for(; i < n; i++) vecSetInt(d, i, (int)((unsigned)vecInt(a, i) * (unsigned)vecInt(b, i))); break;
+        case VEC_SCALE: for(; i < n; i++) vecSetInt(d, i, (int)((unsigned)vecInt(a, i) * (unsigned)s)); break;
+        case VEC_DIV:
+            /* the divisors are checked for 0 already, INT_MIN / -1 wraps */
+            for(; i < n; i++) {
+                int x = vecInt(a, i), y = vecInt(b, i);
+                vecSetInt(d, i, y == -1 ? (int)(0u - (unsigned)x) : x / y);
+            }
+            break;
+    }
+}
+
+static void vecMapFloatFrom(int op, unsigned char *d, const unsigned char *a, const unsigned char *b, float s, int n, int from) {
+    int i = from;
+    switch(op) {
+        case VEC_ADD: for(; i < n; i++) vecSetFloat(d, i, vecFloat(a, i) + vecFloat(b, i)); break;
+        case VEC_SUB: for(; i < n; i++) vecSetFloat(d, i, vecFloat(a, i) - vecFloat(b, i)); break;
+        case VEC_MUL: for(; i < n; i++) vecSetFloat(d, i, vecFloat(a, i) * vecFloat(b, i)); break;
+        case VEC_DIV: for(; i < n; i++) vecSetFloat(d, i, vecFloat(a, i) / vecFloat(b, i)); break;
+        case VEC_SCALE: for(; i < n; i++) vecSetFloat(d, i, vecFloat(a, i) * s); break;
+    }
+}
+
+/* the reduction of the cells from..n-1 into acc */
+static int vecReduceIntFrom(int op, const unsigned char *a, const unsigned char *b, int n, int from, int acc) {
+    unsigned sum = (unsigned)acc;
+    int i = from;
+    switch(op) {
+        case VEC_DOT: for(; i < n; i++) sum += (unsigned)vecInt(a, i) * (unsigned)vecInt(b, i); return (int)sum;
+        case VEC_SUM: for(; i < n; i++) sum += (unsigned)vecInt(a, i); return (int)sum;
+        case VEC_MIN: for(; i < n; i++) if(vecInt(a, i) < acc) acc = vecInt(a, i); return acc;
+        case VEC_MAX: for(; i < n; i++) if(vecInt(a, i) > acc) acc = vecInt(a, i); return acc;
+    }
+    return acc;
+}
+
+static float vecReduceFloatFrom(int op, const unsigned char *a, const unsigned char *b, int n, int from, float acc) {
+    int i = from;
+    switch(op) {
+        case VEC_DOT: for(; i < n; i++) acc += vecFloat(a, i) * vecFloat(b, i); break;
+        case VEC_SUM: for(; i < n; i++) acc += vecFloat(a, i); break;
+        case VEC_MIN: for(; i < n; i++) if(vecFloat(a, i) < acc) acc = vecFloat(a, i); break;
+        case VEC_MAX: for(; i < n; i++) if(vecFloat(a, i) > acc) acc = vecFloat(a, i); break;
+    }
+    return acc;
+}
+
+static void vecMapInt(int op, unsigned char *d, const unsigned char *a, const unsigned char *b, int s, int n) {
+    vecMapIntFrom(op, d, a, b, s, n, 0);
+}
+
+static void vecMapFloat(int op, unsigned char *d, const unsigned char *a, const unsigned char *b, float s, int n) {
+    vecMapFloatFrom(op, d, a, b, s, n, 0);
+}
+
+/* min and max start at the first cell */
+static int vecReduceInt(int op, const unsigned char *a, const unsigned char *b, int n) {
+    if(n == 0)
+        return 0;
+    if(op == VEC_MIN || op == VEC_MAX)
+        return vecReduceIntFrom(op, a, b, n, 1, vecInt(a, 0));
+    return vecReduceIntFrom(op, a, b, n, 0, 0);
+}
+
+static float vecReduceFloat(int op, const unsigned char *a, const unsigned char *b, int n) {
+    if(n == 0)
+        return 0;
+    if(op == VEC_MIN || op == VEC_MAX)
+        return vecReduceFloatFrom(op, a, b, n, 1, vecFloat(a, 0));
+    return vecReduceFloatFrom(op, a, b, n, 0, 0);
+}
+
+#ifdef VEC_X86
+
+/* SSE2, 4 cells at a time. it has no 32 bit multiply and no 32 bit min/max, they are built from others */
+static inline __m128i vecMulSse2(__m128i x, __m128i y) {
+    __m128i even = _mm_mul_epu32(x, y);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(x, 32), _mm_srli_epi64(y, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static inline __m128i vecSelectSse2(__m128i mask, __m128i x, __m128i y) {
+    return _mm_or_si128(_mm_and_si128(mask, x), _mm_andnot_si128(mask, y));
+}
+
+static void vecMapIntSse2(int op, unsigned char *d, const unsigned char *a, const unsigned char *b, int s, int n) {
+    int i = 0;
+    if(op != VEC_DIV) {
+        __m128i scale = _mm_set1_epi32(s);
+        for(; i + 4 <= n; i += 4) {
+            __m128i x = _mm_loadu_si128((const __m128i *)(a + 4 * i));
+            __m128i y = op == VEC_SCALE ? scale : _mm_loadu_si128((const __m128i *)(b + 4 * i));
+            __m128i r = op == VEC_ADD ? _mm_add_epi32(x, y) : op == VEC_SUB ? _mm_sub_epi32(x, y) : vecMulSse2(x, y);
+            _mm_storeu_si128((__m128i *)(d + 4 * i), r);
+        }
+    }
+    vecMapIntFrom(op, d, a, b, s, n, i);
+}
+
+static void vecMapFloatSse2(int op, unsigned char *d, const unsigned char *a, const unsigned char *b, float s, int n) {
+    int i = 0;
+    __m128 scale = _mm_set1_ps(s);
+    for(; i + 4 <= n; i += 4) {
+        __m128 x = _mm_loadu_ps((const float *)(a + 4 * i));
+        __m128 y = op == VEC_SCALE ? scale : _mm_loadu_ps((const float *)(b + 4 * i));
+        __m128 r = op == VEC_ADD ? _mm_add_ps(x, y) : op == VEC_SUB ? _mm_sub_ps(x, y) : op == VEC_DIV ? _mm_div_ps(x, y) : _mm_mul_ps(x, y);
+        _mm_storeu_ps((float *)(d + 4 * i), r);
+    }
+    vecMapFloatFrom(op, d, a, b, s, n, i);
+}
+
+static int vecReduceIntSse2(int op, const unsigned char *a, const unsigned char *b, int n) {
+    if(n < 4)
+        return vecReduceInt(op, a, b, n);
+    /* min and max start with the first 4 cells, the sums with 0 */
+    __m128i acc = op == VEC_MIN || op == VEC_MAX ? _mm_loadu_si128((const __m128i *)a) : _mm_setzero_si128();
+    int i = op == VEC_MIN || op == VEC_MAX ? 4 : 0;
+    for(; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + 4 * i));
+        if(op == VEC_DOT)
+            acc = _mm_add_epi32(acc, vecMulSse2(x, _mm_loadu_si128((const __m128i *)(b + 4 * i))));
+        else if(op == VEC_SUM)
+            acc = _mm_add_epi32(acc, x);
+        else if(op == VEC_MIN)
+            acc = vecSelectSse2(_mm_cmplt_epi32(x, acc), x, acc);
+        else
+            acc = vecSelectSse2(_mm_cmpgt_epi32(x, acc), x, acc);
+    }
+    int lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    int r = lanes[0];
+    for(int k = 1; k < 4; k++)
+        r = vecReduceIntFrom(op == VEC_DOT ? VEC_SUM : op, (const unsigned char *)lanes, NULL, k + 1, k, r);
+    return vecReduceIntFrom(op, a, b, n, i, r);
+}
+
+static float vecReduceFloatSse2(int op, const unsigned char *a, const unsigned char *b, int n) {
+    if(n < 4)
+        return vecReduceFloat(op, a, b, n);
+    __m128 acc = op == VEC_MIN || op == VEC_MAX ? _mm_loadu_ps((const float *)a) : _mm_setzero_ps();
+    int i = op == VEC_MIN || op == VEC_MAX ? 4 : 0;
+    for(; i + 4 <= n; i += 4) {
+        __m128 x = _mm_loadu_ps((const float *)(a + 4 * i));
+        if(op == VEC_DOT)
+            acc = _mm_add_ps(acc, _mm_mul_ps(x, _mm_loadu_ps((const float *)(b + 4 * i))));
+        else if(op == VEC_SUM)
+            acc = _mm_add_ps(acc, x);
+        else if(op == VEC_MIN)
+            acc = _mm_min_ps(acc, x);
+        else
+            acc = _mm_max_ps(acc, x);
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc);
+    float r = lanes[0];
+    for(int k = 1; k < 4; k++)
+        r = vecReduceFloatFrom(op == VEC_DOT ? VEC_SUM : op, (const unsigned char *)lanes, NULL, k + 1, k, r);
+    return vecReduceFloatFrom(op, a, b, n, i, r);
+}
+
+/* AVX2, 8 cells at a time */
+__attribute__((target("avx2")))
+static void vecMapIntAvx2(int op, unsigned char *d, const unsigned char *a, const unsigned char *b, int s, int n) {
+    int i = 0;
+    if(op != VEC_DIV) {
+        __m256i scale = _mm256_set1_epi32(s);
+        for(; i + 8 <= n; i += 8) {
+            __m256i x = _mm256_loadu_si256((const __m256i *)(a + 4 * i));
+            __m256i y = op == VEC_SCALE ? scale : _mm256_loadu_si256((const __m256i *)(b + 4 * i));
+            __m256i r = op == VEC_ADD ? _mm256_add_epi32(x, y) : op == VEC_SUB ? _mm256_sub_epi32(x, y) : _mm256_mullo_epi32(x, y);
+            _mm256_storeu_si256((__m256i *)(d + 4 * i), r);
+        }
+    }
+    vecMapIntFrom(op, d, a, b, s, n, i);
+}
+
+__attribute__((target("avx2")))
+static void vecMapFloatAvx2(int op, unsigned char *d, const unsigned char *a, const unsigned char *b, float s, int n) {
+    int i = 0;
+    __m256 scale = _mm256_set1_ps(s);
+    for(; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_loadu_ps((const float *)(a + 4 * i));
+        __m256 y = op == VEC_SCALE ? scale : _mm256_loadu_ps((const float *)(b + 4 * i));
+        __m256 r = op == VEC_ADD ? _mm256_add_ps(x, y) : op == VEC_SUB ? _mm256_sub_ps(x, y) : op == VEC_DIV ? _mm256_div_ps(x, y) : _mm256_mul_ps(x, y);
+        _mm256_storeu_ps((float *)(d + 4 * i), r);
+    }
+    vecMapFloatFrom(op, d, a, b, s, n, i);
+}
+
+__attribute__((target("avx2")))
+static int vecReduceIntAvx2(int op, const unsigned char *a, const unsigned char *b, int n) {
+    if(n < 8)
+        return vecReduceInt(op, a, b, n);
+    __m256i acc = op == VEC_MIN || op == VEC_MAX ? _mm256_loadu_si256((const __m256i *)a) : _mm256_setzero_si256();
+    int i = op == VEC_MIN || op == VEC_MAX ? 8 : 0;
+    for(; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + 4 * i));
+        if(op == VEC_DOT)
+            acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(x, _mm256_loadu_si256((const __m256i *)(b + 4 * i))));
+        else if(op == VEC_SUM)
+            acc = _mm256_add_epi32(acc, x);
+        else if(op == VEC_MIN)
+            acc = _mm256_min_epi32(acc, x);
+        else
+            acc = _mm256_max_epi32(acc, x);
+    }
+    int lanes[8];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    int r = lanes[0];
+    for(int k = 1; k < 8; k++)
+        r = vecReduceIntFrom(op == VEC_DOT ? VEC_SUM : op, (const unsigned char *)lanes, NULL, k + 1, k, r);
+    return vecReduceIntFrom(op, a, b, n, i, r);
+}
+
+__attribute__((target("avx2")))
+static float vecReduceFloatAvx2(int op, const unsigned char *a, const unsigned char *b, int n) {
+    if(n < 8)
+        return vecReduceFloat(op, a, b, n);
+    __m256 acc = op == VEC_MIN || op == VEC_MAX ? _mm256_loadu_ps((const float *)a) : _mm256_setzero_ps();
+    int i = op == VEC_MIN || op == VEC_MAX ? 8 : 0;
+    for(; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_loadu_ps((const float *)(a + 4 * i));
+        if(op == VEC_DOT)
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(x, _mm256_loadu_ps((const float *)(b + 4 * i))));
+        else if(op == VEC_SUM)
+            acc = _mm256_add_ps(acc, x);
+        else if(op == VEC_MIN)
+            acc = _mm256_min_ps(acc, x);
+        else
+            acc = _mm256_max_ps(acc, x);
+    }
+    float lanes[8];
+    _mm256_storeu_ps(lanes, acc);
+    float r = lanes[0];
+    for(int k = 1; k < 8; k++)
+        r = vecReduceFloatFrom(op == VEC_DOT ? VEC_SUM : op, (const unsigned char *)lanes, NULL, k + 1, k, r);
+    return vecReduceFloatFrom(op, a, b, n, i, r);
+}
+
+#endif
+
+struct veckernels {
+    void (*mapInt)(int op, unsigned char *d, const unsigned char *a, const unsigned char *b, int s, int n);
+    void (*mapFloat)(int op, unsigned char *d, const unsigned char *a, const unsigned char *b, float s, int n);
+    int (*reduceInt)(int op, const unsigned char *a, const unsigned char *b, int n);
+    float (*reduceFloat)(int op, const unsigned char *a, const unsigned char *b, int n);
+};
+
+static struct veckernels vecKernels = {vecMapInt, vecMapFloat, vecReduceInt, vecReduceFloat};
+static pthread_once_t vecOnce = PTHREAD_ONCE_INIT;
+
+static void vecDetect(void) {
+#ifdef VEC_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        struct veckernels avx2 = {vecMapIntAvx2, vecMapFloatAvx2, vecReduceIntAvx2, vecReduceFloatAvx2};
+        vecKernels = avx2;
+    } else {
+        struct veckernels sse2 = {vecMapIntSse2, vecMapFloatSse2, vecReduceIntSse2, vecReduceFloatSse2};
+        vecKernels = sse2;
+    }
+#endif
+}
+
+/* the kernels of this cpu */
+static const struct veckernels *vecKernelsOf(void) {
+    pthread_once(&vecOnce, vecDetect);
+    return &vecKernels;
+}
+
+/* the cells of a location, 0 if it doesn't exist */
+static int vecCells(struct node *n) {
+    return n != NULL ? n->len / 4 : 0;
+}
+
+/* VEC, the operation is the value, see above */
+void vmVector(VMState *vm, int op) {
+    const struct veckernels *k = vecKernelsOf();
+    bool floats = vm->arith_mode == ARITH_FLOAT || vm->arith_mode == ARITH_DOUBLE;
+    bool doubles = vm->arith_mode == ARITH_DOUBLE;
+    if(op < VEC_ADD || op > VEC_MAX) {
+        char dbg[128];
+        snprintf(dbg, sizeof(dbg), "\n[!!!!!] Unknown vector instruction! pc: %d op: %d\n", vm->pc, op);
+        vmFault(vm, dbg);
+    }
+
+    if(op >= VEC_DOT) {
+        struct node *b = op == VEC_DOT ? find(vm->mem, popInt(vm, vm->arith_mode)) : NULL;
+        struct node *a = find(vm->mem, popInt(vm, vm->arith_mode));
+        int n = vecCells(a);
+        if(op == VEC_DOT && vecCells(b) < n)
+            n = vecCells(b);
+        const unsigned char *pa = n > 0 ? a->data : NULL, *pb = n > 0 && b != NULL ? b->data : NULL;
+        if(!floats) {
+            push(vm, k->reduceInt(op, pa, pb, n));
+        } else {
+            float r = k->reduceFloat(op, pa, pb, n);
+            if(doubles) {
+                pushDouble(vm, r);
+            } else {
+                int bits;
+                memcpy(&bits, &r, sizeof(bits));
+                push(vm, bits);
+            }
+        }
+        return;
+    }
+
+    /* the scalar of vscale, a double in double mode */
+    int si = 0;
+    float sf = 0;
+    if(op == VEC_SCALE) {
+        if(doubles) {
+            sf = (float)popDouble(vm);
+        } else {
+            si = popv(vm);
+            memcpy(&sf, &si, sizeof(sf));
+        }
+    }
+    struct node *b = op != VEC_SCALE ? find(vm->mem, popInt(vm, vm->arith_mode)) : NULL;
+    struct node *a = find(vm->mem, popInt(vm, vm->arith_mode));
+    int dst = popInt(vm, vm->arith_mode);
+    int n = vecCells(a);
+    if(op != VEC_SCALE && vecCells(b) < n)
+        n = vecCells(b);
+    const unsigned char *pa = n > 0 ? a->data : NULL, *pb = n > 0 && b != NULL ? b->data : NULL;
+
+    if(op == VEC_DIV && !floats) {
+        for(int i = 0; i < n; i++) {
+            if(vecInt(pb, i) == 0) {
+                char dbg[128];
+                snprintf(dbg, sizeof(dbg), "\n[!!!!!] Division by zero! pc: %d cell: %d\n", vm->pc, i);
+                vmFault(vm, dbg);
+            }
+        }
+    }
+
+    unsigned char *buffer = (unsigned char *)malloc(n > 0 ? n * 4 : 1);
+    if(floats)
+        k->mapFloat(op, buffer, pa, pb, sf, n);
+    else
+        k->mapInt(op, buffer, pa, pb, si, n);
+
+    // the location is replaced, like puts
+    memLock(vm);
+    insertFirst(vm->mem, dst, buffer, n * 4);
+    if( config.bootfile && bootfilewriteable ) {
+        persist(vm, find(vm->mem, dst));
+    }
+    memUnlock(vm);
+}
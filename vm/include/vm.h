@@ -0,0 +1,102 @@
+/*
+Embedding the vm
+
+Every vm is a VMState, it carries the program, registers, stacks, modes and its own memory.
+Any number of them can live in one process. Compile vm.c with -D VM_LIBRARY to leave out main()
+and link it into another program:
+
+    VMState *vm = vmCreate();
+    if(vmLoadFile(vm, "program.zvm") == 0)
+        while(vmRun(vm, 100000) == VM_YIELDED)
+            ; // do something else in between
+    vmDestroy(vm);
+
+The settings of vm.ini (bootfile, write-back..) are process wide.
+*/
+
+#ifndef VM_H_INCLUDED
+#define VM_H_INCLUDED
+
+#include <stdio.h>
+
+typedef struct VMState VMState;
+
+/* results of vmRun() */
+enum {
+    VM_HALTED = 0,  // the program reached END
+    VM_YIELDED = 1, // the instruction budget is used up, vmRun() continues where it stopped
+    VM_BLOCKED = 2, // read/readc wait for input queued with vmInput(), vmRun() retries them
+    VM_ERROR = -1   // stack over- or underflow, the vm is stopped
+};
+
+VMState *vmCreate();
+void vmDestroy(VMState *vm);
+
+/* load a program, an image is a sequence of instruction and value words like a .zvm file */
+int vmLoad(VMState *vm, const unsigned int *image, int words);
+int vmLoadFile(VMState *vm, const char *file);
+
+/* load the memory locations of a bootfile into the vm */
+void vmMount(VMState *vm, char *bootfile);
+
+/*
+write the whole state of a vm (program, registers, stacks, modes and memory) to a file, and replace
+the state of a vm with one. vmRestore() maps the file, memory is copied when it is written.
+Both return 0 on success, the vm must not run in a scheduler. See Snapshot.h
+*/
+int vmSnapshot(VMState *vm, const char *file);
+int vmRestore(VMState *vm, const char *file);
+
+/*
+a new vm that goes on where vm is, with a copy of its registers, stacks and modes. the memory is
+copy on write, forking doesn't copy any data. vm must not be running while it is forked
+*/
+VMState *vmFork(VMState *vm);
+
+/* output of write/print/printc, stdout by default. NULL collects it in memory, see vmOutput() */
+void vmSetOutput(VMState *vm, FILE *out);
+
+/* the output collected so far with vmSetOutput(vm, NULL), valid until the next vm call */
+const char *vmOutput(VMState *vm, int *len);
+
+/* 
+input of read/readc, stdin by default. NULL makes them read what vmInput() queued, they block the vm 
+if it has nothing yet and read EOF after vmCloseInput(). vmInput() can be called from any thread
+*/
+void vmSetInput(VMState *vm, FILE *in);
+void vmInput(VMState *vm, const char *data, int len);
+void vmCloseInput(VMState *vm);
+
+/* run at most steps instructions, 0 runs until END or until it blocks */
+int vmRun(VMState *vm, long long steps);
+
+/* the last result of vmRun() */
+int vmStatus(VMState *vm);
+
+/* a pointer of the embedding program, the vm doesn't use it */
+void vmSetUserData(VMState *vm, void *data);
+void *vmUserData(VMState *vm);
+
+/*
+Scheduler, runs vms on a fixed number of threads with at most slice instructions at a time
+
+    VMScheduler *s = vmSchedulerCreate(4, 10000);
+    vmSchedule(s, vm); ..
+    while((vm = vmSchedulerNext(s)) != NULL)
+        ; // vm halted or failed, see vmStatus()
+    vmSchedulerDestroy(s);
+
+A vm must not be used by the embedding program while it is scheduled, except for vmInput() and
+vmCloseInput(). vmSchedulerNext() waits for the next vm that stops and returns NULL when every
+scheduled vm has been returned, it also waits for blocked vms.
+Every thread has its own queue of vms and steals from the others when it runs out.
+Vms spawned by a program (int 13) run on the scheduler of their parent, a default one otherwise.
+*/
+typedef struct VMScheduler VMScheduler;
+
+VMScheduler *vmSchedulerCreate(int threads, long long slice);
+void vmSchedule(VMScheduler *s, VMState *vm);
+VMState *vmSchedulerNext(VMScheduler *s);
+void vmSchedulerDestroy(VMScheduler *s);
+
+#endif
@@ -29,6 +29,10 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <string.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <time.h>
+#include <setjmp.h>
+#include <limits.h>
+#include <pthread.h>
 
 #ifdef _WIN32
 #include <conio.h> 	
@@ -41,23 +45,27 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #define NUM_REG 14
 
 /* GLOBALS */
-unsigned int *program;
-int regs[NUM_REG + 1]; 
-
-int instrNum, reg1, reg2, reg3, value = 0; 
-
-int stack[STACK_SIZE] = {0};
-int pstack = 0;
- 
-int returnstack[STACK_SIZE] = {0};
-int rstack = 0;
+/* 
+the program as the interpreter sees it, decoded once by the loader
+one entry per instruction, pc is an index into these arrays
+*/
+struct decoded {
+    unsigned char *op;  // opcode
+    unsigned char *dst; // first register
+    unsigned char *src; // second register
+    int *imm;           // immediate value
+    int len;            // number of instructions, without the trailing END
+    unsigned char *modes; // the modes every instruction runs in, see specialise()
+};
 
+/* process wide settings, the state of a running program lives in its VMState */
 bool debug = false; 
+bool threaded = false;
+bool jit = false;
+bool profile = false;
+bool stats = false;
 bool realtime = false;
-bool zeroflag = false;
 
-int pc = 0;
-int running = 0;
 int displayMode = 0; 
 
 bool bootfilewriteable = false;
@@ -67,20 +75,27 @@ enum {
     MEMORY_RW_INT = 2
 };
 
-int memory_rw_mode = MEMORY_RW_CHAR;
-
 enum {
     ARITH_CHAR = 1,
     ARITH_INT = 2,
     ARITH_FLOAT = 3,
+    ARITH_DOUBLE = 4,
 };
 
-int arith_mode = ARITH_CHAR;
+/*
+the low byte of an instruction word is 1 if the value is the bits of a float literal (2.5), the decoded
+instruction has IMM_FLOAT as its second register then. only mov, push and the arithmetic take one
+*/
+#define IMAGE_FLOAT 1
+#define IMM_FLOAT 0x80
 
 typedef struct {
     char* bootfile;
     bool writeable;
     bool debug;   
+    bool writeback;   // only mark changed locations dirty and sync the bootfile later
+    int syncinterval; // write-back: sync after this many instructions, 0 = never
+    int synctime;     // write-back: sync after this many seconds, 0 = never
 } Configuration;
 
 Configuration config;
@@ -100,6 +115,15 @@ static int handler(void* userConfig, const char* section, const char* name, cons
     else if (MATCH("general", "debug")) {
         pconfig->debug = strcmp(value, "true") == 0 ? true : false;
     }
+    else if (MATCH("general", "writeback")) {
+        pconfig->writeback = strcmp(value, "true") == 0 ? true : false;
+    }
+    else if (MATCH("general", "syncinterval")) {
+        pconfig->syncinterval = atoi(value);
+    }
+    else if (MATCH("general", "synctime")) {
+        pconfig->synctime = atoi(value);
+    }
     else {
         return 0;
     }
@@ -108,98 +132,486 @@ static int handler(void* userConfig, const char* section, const char* name, cons
     
 }
 
+#include "Console.h"
 #include "Common.h"
 #include "Memory.h"
 #include "Storage.h"
 #include "ini.h"
+#include "vm.h"
+
+/*
+A vm instance
+everything a program touches at runtime, so a process can run any number of them side by side
+*/
+struct VMState {
+    struct decoded program;
+    /* the float registers are the int registers seen as floats, push, pop and memory see their bits */
+    union {
+        int regs[NUM_REG + 1];
+        float fregs[NUM_REG + 1];
+    };
+    int instrNum, reg1, reg2, value; // the decoded instruction being executed
+    int stack[STACK_SIZE];
+    int pstack;
+    int returnstack[STACK_SIZE];
+    int rstack;
+    int pc;
+    bool zeroflag;
+    int running;
+    int arith_mode;
+    int memory_rw_mode;
+    double dregs[NUM_REG + 1]; // the registers of ARITH_DOUBLE
+    unsigned long long steps; // executed instructions
+    unsigned long long limit; // the dispatch loops stop when steps reaches it
+    unsigned long long lastSyncSteps; // write-back, see vmSync()
+    time_t lastSyncTime;
+    struct memstore *mem; // shared with spawned vms
+    struct memreader *reader; // announces the epochs this vm reads mem in
+    bool memReading;      // inside memRead()
+    bool memLocked;       // holds mem->lock, see memLock()
+    struct console console;
+    void **handlers; // threaded dispatch, built by the first runThreaded()
+    struct jitcode *jit; // counters and native code of runJit(), shared with spawned vms
+    jmp_buf trap;    // vmFault() returns to vmRun() through it
+    bool guarded;    // trap is set
+    bool faulted;
+    bool blocked;    // READ/READC wait for queued input, see vmBlock()
+    unsigned long long blockedAt; // console.queued when it blocked
+    pthread_mutex_t inputLock;    // the input queue, vmInput() can be called from any thread
+    int status;      // the last result of vmRun()
+    void *userData;
+    /* Scheduler.h */
+    struct VMScheduler *scheduler;
+    VMState *nextQueued;
+    bool parked;     // blocked and waiting for vmInput() or a spawned vm
+    bool done;       // halted or failed in the scheduler
+    int worker;      // the queue it goes back to
+    /* green threads, int 13/14 */
+    bool spawned;
+    VMState *parent;
+    VMState **children; // by id - 1, NULL once joined
+    int childCount;
+    int childCap;
+    VMState *joining;   // the child int 14 waits for
+    VMState *joiner;    // the vm waiting for this one
+};
+
+/* Jit.h */
+struct jitcode *jitShare(struct jitcode *j);
+void jitRelease(struct jitcode *j);
+static bool jitJumped(VMState *vm, int at);
+
+/* the vm of the command line, written by vmFlush() on errors */
+VMState *vmMain = NULL;
+
+#include "Profile.h"
+#include "Scheduler.h"
+
+
+/*
+the memory of spawned vms is shared with their parent. instructions that access it run between
+memRead() and memReadDone() and don't lock to read, memLock() is only taken to change the index,
+replace a location or write one that doesn't fit (Memory.h)
+*/
+static inline void memRead(VMState *vm) {
+    if(vm->mem->shared) {
+        memEnter(vm->mem, vm->reader);
+        vm->memReading = true;
+    }
+}
+
+static inline void memReadDone(VMState *vm) {
+    if(vm->memReading) {
+        vm->memReading = false;
+        memLeave(vm->reader);
+    }
+}
+
+static inline void memLock(VMState *vm) {
+    if(vm->mem->shared) {
+        pthread_mutex_lock(&vm->mem->lock);
+        vm->memLocked = true;
+    }
+}
+
+static inline void memUnlock(VMState *vm) {
+    if(vm->memLocked) {
+        vm->memLocked = false;
+        pthread_mutex_unlock(&vm->mem->lock);
+    }
+}
+
+/*
+Write-back
+with config.writeback set, changed memory locations are only marked dirty. The bootfile gets synced
+at the end of the program, on int 12, after config.syncinterval instructions or config.synctime seconds
+and on SIGINT/SIGTERM at the next jump or call
+*/
+
+/* persist a memory location to the bootfile */
+void persist(VMState *vm, struct node *n) {
+    bool held = vm->memLocked;
+    if(!held) memLock(vm);
+    if(config.writeback) 
+        storageDirty(vm->mem, n);
+    else 
+        createFile(config.bootfile, n->key, (char *)n->data, n->len);
+    if(!held) memUnlock(vm);
+}
+
+/* write everything of a vm that is still pending, console output and the bootfile */
+void vmSync(VMState *vm) {
+    consoleFlush(&vm->console);
+    /* on a fault inside an instruction (error_exit) the vm can hold the lock already */
+    bool held = vm->memLocked;
+    if(!held) memLock(vm);
+    if(config.bootfile && vm->mem->dirtyCount > 0)
+        storageSync(vm->mem, config.bootfile);
+    if(!held) memUnlock(vm);
+    vm->lastSyncSteps = vm->steps;
+    vm->lastSyncTime = time(NULL);
+}
+
+/* the same for the vm of the command line, called by error_exit() */
+void vmFlush() {
+    if(vmMain != NULL)
+        vmSync(vmMain);
+}
+
+/* SIGINT/SIGTERM arrived (vmSignal), write what is pending and exit */
+void vmSignalled(VMState *vm) {
+    vmSync(vm);
+    if(vmSignal == SIGINT)
+        error_exit("\n[kern] Prozess unerwartet beendet.", true);
+    error_exit("\n[kern] VM wird unerwartet beendet.\n", true);
+}
+
+/* the console output of the vm of the command line that is still buffered, on a crash. write() only */
+void vmCrashOutput() {
+    if(vmMain != NULL && vmMain->console.out == stdout && vmMain->console.len > 0) {
+        ssize_t n = write(STDOUT_FILENO, vmMain->console.buf, vmMain->console.len);
+        (void)n;
+        vmMain->console.len = 0;
+    }
+}
+
+/* called on jumps, sync if dirty locations are older than the configured interval */
+static inline void syncCheck(VMState *vm) {
+    if(vmSignal)
+        vmSignalled(vm);
+    if(vm->mem->dirtyCount == 0)
+        return;
+    if(config.syncinterval > 0 && vm->steps - vm->lastSyncSteps >= (unsigned long long)config.syncinterval)
+        vmSync(vm);
+    else if(config.synctime > 0 && time(NULL) - vm->lastSyncTime >= config.synctime)
+        vmSync(vm);
+}
+
+/* 
+stop a vm because of an error in its program
+the message goes to its console, vmRun() returns VM_ERROR and other vms in the process keep running
+*/
+void vmFault(VMState *vm, const char *msg) {
+    memUnlock(vm);
+    memReadDone(vm);
+    consolePrintf(&vm->console, "%s\n", msg);
+    consoleFlush(&vm->console);
+    vm->running = 0;
+    vm->faulted = true;
+    if(vm->guarded)
+        longjmp(vm->trap, 1);
+    exit(1);
+}
+
+/*
+the current instruction needs input that is not queued yet, it runs again when the vm resumes
+the dispatch loops stop at the next instruction and vmRun() returns VM_BLOCKED
+*/
+void vmBlock(VMState *vm) {
+    vm->pc--;
+    vm->steps--;
+    vm->limit = vm->steps;
+    vm->blocked = true;
+    vm->blockedAt = vm->console.queued;
+}
 
 /* push/pop the variable stack */
-void push(int v) {
-    if(pstack >= STACK_SIZE) { 
-        char dbg[] = "";
-        sprintf(dbg, "\n[!!!!!] Stack overflow! pc: %d\n", pc);
-        error_exit(dbg, true);  
-    }
-    stack[pstack] = v;
-    pstack++;     
-}
-int popv() {
-    if(pstack <= 0) { 
-        char dbg[] = "";
-        sprintf(dbg, "\n[!!!!!] Stack underflow! pc: %d\n", pc);
-        error_exit(dbg, true);  
-    }
-    pstack--;
-	return stack[pstack];
+void push(VMState *vm, int v) {
+    if(vm->pstack >= STACK_SIZE) { 
+        char dbg[128];
+        snprintf(dbg, sizeof(dbg), "\n[!!!!!] Stack overflow! pc: %d\n", vm->pc);
+        vmFault(vm, dbg);  
+    }
+    vm->stack[vm->pstack] = v;
+    vm->pstack++;     
+}
+int popv(VMState *vm) {
+    if(vm->pstack <= 0) { 
+        char dbg[128];
+        snprintf(dbg, sizeof(dbg), "\n[!!!!!] Stack underflow! pc: %d\n", vm->pc);
+        vmFault(vm, dbg);  
+    }
+    vm->pstack--;
+	return vm->stack[vm->pstack];
 } 
 
 /* return stack */
-void rpush(int v) {
-    returnstack[rstack++] = v;	
-    if(rstack == STACK_SIZE) { 
-        char dbg[] = "";
-        sprintf(dbg, "\n[!!!!!] Returnstack overflow! pc: %d rs: %d\n", pc, returnstack[rstack]);
-        error_exit(dbg, true);
+void rpush(VMState *vm, int v) {
+    if(vm->rstack + 1 >= STACK_SIZE) { 
+        char dbg[128];
+        snprintf(dbg, sizeof(dbg), "\n[!!!!!] Returnstack overflow! pc: %d rs: %d\n", vm->pc, v);
+        vmFault(vm, dbg);
     }       
+    vm->returnstack[vm->rstack++] = v;	
+}
+int rpopv(VMState *vm) {
+    if(vm->rstack <= 0) {
+        char dbg[128];
+        snprintf(dbg, sizeof(dbg), "\n[!!!!!] Returnstack underflow! pc: %d rs: %d\n", vm->pc, vm->returnstack[0]);
+        vmFault(vm, dbg);
+    }
+    vm->rstack--;       
+    return vm->returnstack[vm->rstack];
+}
+
+/* 
+translate a raw image (pairs of instruction word and value) into the decoded program 
+an END is appended, so a program running off its end stops
+*/
+void decode(VMState *vm, const unsigned int *image, int words) {
+    int n = words / 2;
+    struct decoded *program = &vm->program;
+    free(program->op);
+    free(program->dst);
+    free(program->src);
+    free(program->imm);
+    free(program->modes);
+    program->modes = NULL;
+    free(vm->handlers);
+    vm->handlers = NULL;
+    jitRelease(vm->jit);
+    vm->jit = NULL;
+    program->op = (unsigned char *)malloc(n + 1);
+    program->dst = (unsigned char *)malloc(n + 1);
+    program->src = (unsigned char *)malloc(n + 1);
+    program->imm = (int *)malloc((n + 1) * sizeof(int));
+    program->len = n;
+    for(int i = 0; i < n; i++) {
+        unsigned int instr = image[i * 2];
+        program->op[i]  = (instr & 0xFF000000) >> 24;
+        program->dst[i] = (instr & 0x00FF0000) >> 16;
+        program->src[i] = (instr & 0x0000FF00) >> 8;
+        program->imm[i] = image[i * 2 + 1];
+        int op = program->op[i];
+        if((instr & IMAGE_FLOAT) && (op == MOV || op == PUSH || op == ADD || op == SUB || op == MUL || op == DIV || op == MOD))
+            program->src[i] = IMM_FLOAT;
+    }
+    program->op[n] = END;
+    program->dst[n] = program->src[n] = 0;
+    program->imm[n] = 0;
 }
-int rpopv() {
-    if(rstack <= 0) {
-        char dbg[] = "";
-        sprintf(dbg, "\n[!!!!!] Returnstack underflow! pc: %d rs: %d\n", pc, returnstack[rstack]);
-        error_exit(dbg, true);
+
+/*
+Mode specialisation
+ADD, LDM and the others check the arithmetic or the memory mode every time they run. The modes only
+change through int 1/2/9/10/11/22 (and MODES), so the loader follows them along the jumps of the program
+and replaces every instruction whose mode it knows with a specialised opcode (ADD_INT, LDM_CHAR, see
+Common.h) that doesn't check. Where paths in different modes meet, or behind int <register>, the
+generic opcode stays. ret can go behind every call.
+
+program.modes keeps the result, arithmetic mode | memory mode << 3 per instruction, 0 for a mode that
+isn't known, MODES_UNREACHED for instructions the program doesn't get to from where it was started.
+vms that start somewhere else (int 13, vmRestore()) check it and specialise their copy again if their
+modes don't match. Binaries and snapshots only ever contain the generic opcodes (opGeneric()).
+*/
+
+#define MODES_UNREACHED 0xFF
+#define MODES_ARITH(m) ((m) & 7)
+#define MODES_MEMORY(m) ((m) >> 3 & 3)
+
+static const unsigned char arithOps[] = {ADD, SUB, MUL, DIV, MOD, INC, DEC, PRINT, SARITH, MOV, PUSH, POP, LDR};
+static const unsigned char memoryOps[] = {LDM, STM, PUTS, GETS, LDMI, STMI};
+
+/* the generic opcode of a specialised one, other opcodes stay as they are */
+int opGeneric(int op) {
+    if(op >= ADD_CHAR && op < LDM_CHAR)
+        return arithOps[(op - ADD_CHAR) / 4];
+    if(op >= LDM_CHAR && op <= STMI_INT)
+        return memoryOps[(op - LDM_CHAR) / 2];
+    return op;
+}
+
+/* op for an arithmetic and a memory mode, 0 is a mode that isn't known */
+static int opSpecial(int op, int arith, int memory) {
+    for(int i = 0; i < (int)sizeof(arithOps); i++)
+        if(arithOps[i] == op)
+            return arith != 0 ? ADD_CHAR + i * 4 + arith - 1 : op;
+    for(int i = 0; i < (int)sizeof(memoryOps); i++)
+        if(memoryOps[i] == op)
+            return memory != 0 ? LDM_CHAR + i * 2 + memory - 1 : op;
+    return op;
+}
+
+/* the modes where two paths meet */
+static int modesMeet(int a, int b) {
+    if(a == MODES_UNREACHED)
+        return b;
+    if(b == MODES_UNREACHED)
+        return a;
+    int arith = MODES_ARITH(a) == MODES_ARITH(b) ? MODES_ARITH(a) : 0;
+    int memory = MODES_MEMORY(a) == MODES_MEMORY(b) ? MODES_MEMORY(a) : 0;
+    return arith | memory << 3;
+}
+
+/* the modes behind instruction i */
+static int modesBehind(struct decoded *program, int i, int m) {
+    int op = program->op[i], dst = program->dst[i], src = program->src[i], value = program->imm[i];
+    if(op == INT && dst != 0)
+        return 0;
+    if(op == INT && (value == 1 || value == 2))
+        return MODES_ARITH(m) | value << 3;
+    if(op == INT && value >= 9 && value <= 11)
+        return (value - 8) | MODES_MEMORY(m) << 3;
+    if(op == INT && value == 22)
+        return ARITH_DOUBLE | MODES_MEMORY(m) << 3;
+    if(op == MODES) {
+        int arith = src == 22 ? ARITH_DOUBLE : src != 0 ? src - 8 : MODES_ARITH(m);
+        int memory = dst != 0 ? dst : MODES_MEMORY(m);
+        return arith | memory << 3;
+    }
+    return m;
+}
+
+struct modesWork {
+    unsigned char *modes;
+    int *list;
+    char *queued;
+    int count;
+};
+
+/* instruction at is reached in the modes m */
+static void modesReach(struct modesWork *w, int at, int m) {
+    int met = modesMeet(w->modes[at], m);
+    if(met == w->modes[at])
+        return;
+    w->modes[at] = met;
+    if(!w->queued[at]) {
+        w->queued[at] = 1;
+        w->list[w->count++] = at;
+    }
+}
+
+/* follow the modes from entry, where the vm is now, and replace the opcodes, see above */
+void specialise(VMState *vm, int entry) {
+    struct decoded *program = &vm->program;
+    int len = program->len;
+    if(entry < 0 || entry > len)
+        return;
+    for(int i = 0; i <= len; i++)
+        program->op[i] = opGeneric(program->op[i]);
+    struct modesWork w;
+    w.modes = program->modes = (unsigned char *)realloc(program->modes, len + 1);
+    memset(w.modes, MODES_UNREACHED, len + 1);
+    w.list = (int *)malloc((len + 1) * sizeof(int));
+    w.queued = (char *)calloc(len + 1, 1);
+    w.count = 0;
+    /* the modes every ret returns in, behind any call */
+    int returned = MODES_UNREACHED;
+    modesReach(&w, entry, vm->arith_mode | vm->memory_rw_mode << 3);
+    while(w.count > 0) {
+        int i = w.list[--w.count];
+        w.queued[i] = 0;
+        int op = program->op[i], to = program->imm[i];
+        int m = modesBehind(program, i, w.modes[i]);
+        if((op == JMP || op == JZ || op == JNZ || op == CALL) && to >= 0 && to <= len)
+            modesReach(&w, to, m);
+        if(op == RET && modesMeet(returned, m) != returned) {
+            returned = modesMeet(returned, m);
+            for(int k = 1; k <= len; k++)
+                if(program->op[k - 1] == CALL)
+                    modesReach(&w, k, returned);
+        }
+        if(op != JMP && op != CALL && op != RET && op != END && i < len)
+            modesReach(&w, i + 1, m);
     }
-    rstack--;       
-    return returnstack[rstack];
+    for(int i = 0; i <= len; i++)
+        if(w.modes[i] != MODES_UNREACHED)
+            program->op[i] = opSpecial(program->op[i], MODES_ARITH(w.modes[i]), MODES_MEMORY(w.modes[i]));
+    free(w.list);
+    free(w.queued);
+    /* the handlers of runThreaded() are built from the opcodes */
+    free(vm->handlers);
+    vm->handlers = NULL;
+}
+
+/* the specialised opcodes hold if the vm starts to run at pc, in its modes */
+static bool specialisedFor(VMState *vm, int pc) {
+    if(vm->program.modes == NULL || pc < 0 || pc > vm->program.len)
+        return false;
+    int m = vm->program.modes[pc];
+    if(m == MODES_UNREACHED)
+        return false;
+    return (MODES_ARITH(m) == 0 || MODES_ARITH(m) == vm->arith_mode) && (MODES_MEMORY(m) == 0 || MODES_MEMORY(m) == vm->memory_rw_mode);
 }
 
-void decode(int instr) {
-	instrNum   = (instr & 0xFF000000) >> 24;
-	reg1       = (instr & 0x00FF0000) >> 16;
-	reg2       = (instr & 0x0000FF00) >> 8;
-	reg3       = (instr & 0x0000FFFF);     // @deprecated
+/* the instruction word of instruction i, the way decode() read it */
+unsigned int encode(struct decoded *program, int i) {
+    unsigned int src = program->src[i] == IMM_FLOAT ? 0 : program->src[i];
+    unsigned int flag = program->src[i] == IMM_FLOAT ? IMAGE_FLOAT : 0;
+    return opGeneric(program->op[i]) << 24 | program->dst[i] << 16 | src << 8 | flag;
 }
 
-void fetch(int *instr) {
-	*instr = program[pc];
-	value = program[pc + 1];
-	pc += 2;
+/* read a .zvm file into a vm, the command line version exits if it can't */
+void loadProgram(VMState *vm, char *runnable) {
+    if(vmLoadFile(vm, runnable) != 0) {
+  		fprintf(stderr, "An error occurred while opening the file.\n");
+  		exit(EXIT_FAILURE);
+  	}		
+    if(profile)
+        profileLoad(vm, runnable);
 }
 
-void regDump() {
-    printf("\nREGISTERS # # # # # # # # # # # # # # # # # # # # # # # # #\n");
+void regDump(VMState *vm) {
+    consolePrintf(&vm->console, "\nREGISTERS # # # # # # # # # # # # # # # # # # # # # # # # #\n");
     
     //printf("AX: 0x%08x,\tBX: 0x%08x\tCX: 0x%08x,\tDX: 0x%08x\n", regs[1], regs[2], regs[3], regs[4]);
-    printf("AX:\t%s 0x%08x %d", int2bin(regs[1]), regs[1], regs[1]);
-    printf("\nBX:\t%s 0x%08x %d", int2bin(regs[2]), regs[2], regs[2]);
-    printf("\nCX:\t%s 0x%08x %d", int2bin(regs[3]), regs[3], regs[3]);
-    printf("\nDX:\t%s 0x%08x %d", int2bin(regs[4]), regs[4], regs[4]);
+    consolePrintf(&vm->console, "AX:\t%s 0x%08x %d", int2bin(vm->regs[1]), vm->regs[1], vm->regs[1]);
+    consolePrintf(&vm->console, "\nBX:\t%s 0x%08x %d", int2bin(vm->regs[2]), vm->regs[2], vm->regs[2]);
+    consolePrintf(&vm->console, "\nCX:\t%s 0x%08x %d", int2bin(vm->regs[3]), vm->regs[3], vm->regs[3]);
+    consolePrintf(&vm->console, "\nDX:\t%s 0x%08x %d", int2bin(vm->regs[4]), vm->regs[4], vm->regs[4]);
     
-    printf("\n");
+    consolePrintf(&vm->console, "\n");
     
     //printf("R1: 0x%08x, R2: 0x%08x, R3: 0x%08x\nR4: 0x%08x, R5: 0x%08x, R6: 0x%08x\n", regs[5], regs[6], regs[7], regs[8], regs[9], regs[10]);
-    printf("\nR1:\t%s 0x%08x %d", int2bin(regs[5]), regs[5], regs[5]);
-    printf("\nR2:\t%s 0x%08x %d", int2bin(regs[6]), regs[6], regs[6]);
-    printf("\nR3:\t%s 0x%08x %d", int2bin(regs[7]), regs[7], regs[7]);
-    printf("\nR4:\t%s 0x%08x %d", int2bin(regs[8]), regs[8], regs[8]);
-    printf("\nR5:\t%s 0x%08x %d", int2bin(regs[9]), regs[9], regs[9]);
+    consolePrintf(&vm->console, "\nR1:\t%s 0x%08x %d", int2bin(vm->regs[5]), vm->regs[5], vm->regs[5]);
+    consolePrintf(&vm->console, "\nR2:\t%s 0x%08x %d", int2bin(vm->regs[6]), vm->regs[6], vm->regs[6]);
+    consolePrintf(&vm->console, "\nR3:\t%s 0x%08x %d", int2bin(vm->regs[7]), vm->regs[7], vm->regs[7]);
+    consolePrintf(&vm->console, "\nR4:\t%s 0x%08x %d", int2bin(vm->regs[8]), vm->regs[8], vm->regs[8]);
+    consolePrintf(&vm->console, "\nR5:\t%s 0x%08x %d", int2bin(vm->regs[9]), vm->regs[9], vm->regs[9]);
     
-    printf("\n");
+    consolePrintf(&vm->console, "\n");
     
-    printf("\nR6:\t%s 0x%08x %d", int2bin(regs[10]), regs[10], regs[10]);    
-    printf("\nR7:\t%s 0x%08x %d", int2bin(regs[11]), regs[11], regs[11]);
-    printf("\nR8:\t%s 0x%08x %d", int2bin(regs[12]), regs[12], regs[12]);    
-    printf("\nR9:\t%s 0x%08x %d", int2bin(regs[13]), regs[13], regs[13]);
-    printf("\nR10:\t%s 0x%08x %d", int2bin(regs[14]), regs[14], regs[14]);
+    consolePrintf(&vm->console, "\nR6:\t%s 0x%08x %d", int2bin(vm->regs[10]), vm->regs[10], vm->regs[10]);    
+    consolePrintf(&vm->console, "\nR7:\t%s 0x%08x %d", int2bin(vm->regs[11]), vm->regs[11], vm->regs[11]);
+    consolePrintf(&vm->console, "\nR8:\t%s 0x%08x %d", int2bin(vm->regs[12]), vm->regs[12], vm->regs[12]);    
+    consolePrintf(&vm->console, "\nR9:\t%s 0x%08x %d", int2bin(vm->regs[13]), vm->regs[13], vm->regs[13]);
+    consolePrintf(&vm->console, "\nR10:\t%s 0x%08x %d", int2bin(vm->regs[14]), vm->regs[14], vm->regs[14]);
     
-    printf("\n\nzeroflag: %d", (zeroflag) ? 1:0);
+    if(vm->arith_mode == ARITH_DOUBLE) {
+        consolePrintf(&vm->console, "\n");
+        for(int i = 1; i <= NUM_REG; i++)
+            consolePrintf(&vm->console, "\nD%d:\t%g", i, vm->dregs[i]);
+    }
+    
+    consolePrintf(&vm->console, "\n\nzeroflag: %d", (vm->zeroflag) ? 1:0);
     
-    printf("\n# # # # # # # # # # # # # # # # # # # # # # # # # # # # # #\n\n");
+    consolePrintf(&vm->console, "\n# # # # # # # # # # # # # # # # # # # # # # # # # # # # # #\n\n");
 }
 
-void stackDump() {
-    int i = pstack;
+void stackDump(VMState *vm) {
+    int i = vm->pstack;
     int col = 0;
-    printf("\nSTACK DUMP # # # # # # # # # # # # # # # # # # # # # # # #\n");
+    consolePrintf(&vm->console, "\nSTACK DUMP # # # # # # # # # # # # # # # # # # # # # # # #\n");
     char *pattern;
     switch(displayMode) {
         case 0: pattern = "0x%08x "; break;
@@ -208,25 +620,25 @@ void stackDump() {
         default: pattern = "0x%08x "; break;
     }
     if(i > 0) {
-        printf(pattern, stack[--i]);     
-        printf(" <-- top\n");
+        consolePrintf(&vm->console, pattern, vm->stack[--i]);     
+        consolePrintf(&vm->console, " <-- top\n");
     }
     while(i > 0) {
-        printf(pattern, stack[--i]); //col++;
-        //if(col == 16) { printf("\n"); col = 0; } 
+        consolePrintf(&vm->console, pattern, vm->stack[--i]); //col++;
+        //if(col == 16) { consolePrintf(&vm->console, "\n"); col = 0; } 
         //if(i==0) 
-        printf("\n");           
+        consolePrintf(&vm->console, "\n");           
     }
-    printf("TOTAL: %d elements / %d bytes", pstack, pstack*4 );
-    printf("\n# # # # # # # # # # # # # # # # # # # # # # # # # # # # # #\n\n"); 
+    consolePrintf(&vm->console, "TOTAL: %d elements / %d bytes", vm->pstack, vm->pstack*4 );
+    consolePrintf(&vm->console, "\n# # # # # # # # # # # # # # # # # # # # # # # # # # # # # #\n\n"); 
 }
 
 /* dump the memory */
-void memDump() {
-    struct node *ptr = head;
-    printf("\nMEMORY DUMP # # # # # # # # # # # # # # # # # # # # # # # #\n");
-    int vSize = 0;
+void memDump(VMState *vm) {
     int count = 0;
+    struct node **list = memSorted(vm->mem, &count);
+    consolePrintf(&vm->console, "\nMEMORY DUMP # # # # # # # # # # # # # # # # # # # # # # # #\n");
+    int vSize = 0;
     char *pattern;
     switch(displayMode) {
         case 0: pattern = "0x%02x "; break;
@@ -234,1369 +646,2099 @@ void memDump() {
         case 2: pattern = "%c "; break;
         default: pattern = "0x%02x "; break;
     } 	
-    while(ptr != NULL) {
-        printf("[ %d ] ", ptr->key );    
+    for(int n = 0; n < count; n++) {
+        struct node *ptr = list[n];
+        consolePrintf(&vm->console, "[ %d ] ", ptr->key );    
         for(int i = 0; i < ptr->len; i++) 
-            printf(pattern, ptr->data[i]);
-        printf("\n"); vSize += ptr->len; ptr = ptr->next; count++;
+            consolePrintf(&vm->console, pattern, ptr->data[i]);
+        consolePrintf(&vm->console, "\n"); vSize += ptr->len;
     }	
-    printf("TOTAL: %d elements / %d bytes\n", count, vSize );
-    printf("# # # # # # # # # # # # # # # # # # # # # # # # # # # # # #\n\n");
-    free(ptr);
+    consolePrintf(&vm->console, "TOTAL: %d elements / %d bytes\n", count, vSize );
+    consolePrintf(&vm->console, "# # # # # # # # # # # # # # # # # # # # # # # # # # # # # #\n\n");
+    free(list);
 }
 
-void eval() {
+/*
+Opcode handlers
+they work on the decoded vm->instrNum, vm->reg1, vm->reg2 and vm->value and are shared by eval() and runThreaded()
+handlers that depend on the arithmetic or memory mode take it as an argument (op_add_mode() ...), the
+generic one passes the mode of the vm, the specialised opcodes a constant (see specialise())
+*/
 
-    if(debug) {
-        printf("rs: %d, ps %d, pc: %d\t| ins: %d, r1: %d, r2: %d, val: %d\n", rstack, pstack, pc, instrNum, reg1, reg2, value); 
+/* the value of an instruction with a float literal */
+static inline float floatLiteral(VMState *vm) {
+    float f;
+    memcpy(&f, &vm->value, sizeof(f));
+    return f;
+}
+
+/* the second operand of the arithmetic in char and int mode, a register or an immediate */
+static inline int intOperand(VMState *vm) {
+    if(vm->reg2 == 0)
+        return vm->value;
+    if(vm->reg2 == IMM_FLOAT)
+        return (int)floatLiteral(vm);
+    return vm->regs[vm->reg2];
+}
+
+/* in float mode, integer immediates are converted */
+static inline float floatOperand(VMState *vm) {
+    if(vm->reg2 == IMM_FLOAT)
+        return floatLiteral(vm);
+    return vm->reg2 != 0 ? vm->fregs[vm->reg2] : (float)vm->value;
+}
+
+/* the same in double mode, a float literal is widened */
+static inline double doubleOperand(VMState *vm) {
+    if(vm->reg2 == IMM_FLOAT)
+        return floatLiteral(vm);
+    return vm->reg2 != 0 ? vm->dregs[vm->reg2] : (double)vm->value;
+}
+
+/* a double is two words on the stack, the low one first */
+static void pushDouble(VMState *vm, double d) {
+    int w[2];
+    memcpy(w, &d, sizeof(d));
+    push(vm, w[0]);
+    push(vm, w[1]);
+}
+
+static double popDouble(VMState *vm) {
+    int w[2];
+    w[1] = popv(vm);
+    w[0] = popv(vm);
+    double d;
+    memcpy(&d, w, sizeof(d));
+    return d;
+}
+
+/* an int the program pushed, in ARITH_DOUBLE mode every push is a double */
+static inline int popInt(VMState *vm, int mode) {
+    return mode == ARITH_DOUBLE ? (int)popDouble(vm) : popv(vm);
+}
+
+static inline void op_end(VMState *vm) {
+    consoleFlush(&vm->console);
+    vm->running = 0;
+}
+
+static inline void op_mov_mode(VMState *vm, int mode) {
+    /*                        
+    Move into register
+    parameters can be 2 registers, or a register and an immediate value
+    when moving reg to reg, the value of the moved reg still remains
+    a float literal is moved as its bits, an integer is converted in ARITH_FLOAT mode like the arithmetic does,
+    in ARITH_DOUBLE mode the double registers are used
+    @todo at/t or intel??
+    */            
+    if(mode == ARITH_DOUBLE) vm->dregs[vm->reg1] = doubleOperand(vm);
+    else if(mode == ARITH_FLOAT && vm->reg2 == 0) vm->fregs[vm->reg1] = (float)vm->value;
+    else if(vm->reg2 == 0 || vm->reg2 == IMM_FLOAT) vm->regs[vm->reg1] = vm->value; 
+    else vm->regs[vm->reg1] = vm->regs[vm->reg2]; 
+}
+
+static inline void op_mov(VMState *vm) {
+    op_mov_mode(vm, vm->arith_mode);
+}
+
+static inline void op_push_mode(VMState *vm, int mode) {
+    /*
+    Push a value on the stack
+    argument is a register or an immediate value
+    if its a register, it gets cleared, if you dont want to clear the register use ldr
+    in ARITH_DOUBLE mode a register or an immediate is pushed as a double, two words
+    */
+    if(vm->reg1 != 0 && mode == ARITH_DOUBLE) {
+        pushDouble(vm, vm->dregs[vm->reg1]);
+        vm->dregs[vm->reg1] = 0;
     }
-    
-	switch(instrNum) {
-     
-		case END: {
-			running = 0;
-			break;
-		}
-		case MOV: {
-            /*                        
-            Move into register
-            parameters can be 2 registers, or a register and an immediate value
-            when moving reg to reg, the value of the moved reg still remains
-            @todo at/t or intel??
-            */            
-            if(reg2 == 0) regs[reg1] = value; 
-            else regs[reg1] = regs[reg2]; 
-			break;            
-        }        
-		case PUSH: {
-			/*
-            Push a value on the stack
-            argument is a register or an immediate value
-            if its a register, it gets cleared, if you dont want to clear the register use ldr
-            */
-            if(reg1 != 0) {
-                push(regs[reg1]);
-                regs[reg1] = 0;
-            } 
-            else push(value);
-			break;
-		}
-        case POP: {
-			/*
-            Pop a value off the stack
-            argument is the register where to store the value
-            if no argument is shipped, the value is dropped
-            */
-            regs[reg1] = popv();
-			break;
-		}
-		case LDR: {
-			/*
-            Load a register on the stack
-            argument is the register
-            the value still remains in the register, if you want to clear it use pop
-            */
-            push(regs[reg1]);
-			break;
-		}
-		case STR: {
-			/*
-            Store a value from the stack into a register
-            the value remains on the stack, if you want to clear it use push
-            */
-            
-            /*
-            int i = popv();
-            regs[reg1] = i;
-            push(i);
-            */
-            
-            unsigned char *tmp = (unsigned char *)malloc(4);
-            
-            memcpy(tmp, &stack[--pstack], 4);
-            
-            pstack++;
+    else if(mode == ARITH_DOUBLE) pushDouble(vm, doubleOperand(vm));
+    else if(vm->reg1 != 0) {
+        push(vm, vm->regs[vm->reg1]);
+        vm->regs[vm->reg1] = 0;
+    } 
+    else push(vm, vm->value);
+}
+
+static inline void op_push(VMState *vm) {
+    op_push_mode(vm, vm->arith_mode);
+}
 
-            memcpy(&regs[reg1], tmp, 4);
+static inline void op_pop_mode(VMState *vm, int mode) {
+    /*
+    Pop a value off the stack
+    argument is the register where to store the value
+    if no argument is shipped, the value is dropped (two words in ARITH_DOUBLE mode)
+    */
+    if(mode == ARITH_DOUBLE)
+        vm->dregs[vm->reg1] = popDouble(vm);
+    else
+        vm->regs[vm->reg1] = popv(vm);
+}
 
-			break;
-		}
-        case LDM: {
-            /*
-            Load data from memory location:position onto the stack
-            
-            push loc
-            push pos
-            ldm
-            
-            @fix 4.12.21 - added switch to read char or int data
-            */
-            
-            if(memory_rw_mode == MEMORY_RW_CHAR)  {
-                       
-                int loc, pos;
-                pos = popv();
-                loc = popv();
-                
-                struct node *foundLink = find(loc);
-                                
-                int c = (int)foundLink->data[pos];
-                
-                push(c);
-                
-            }
-            
-            else if(memory_rw_mode == MEMORY_RW_INT) {
-            
-                int loc, pos;
-                pos = popv();
-                loc = popv();
-                
-                struct node *foundLink = find(loc);
-                                
-                int i;
-                memcpy(&i, &foundLink->data[pos], sizeof(int)); 
-                
-                push(i);
-            
-            }
-            
-            break;
+static inline void op_pop(VMState *vm) {
+    op_pop_mode(vm, vm->arith_mode);
+}
+
+static inline void op_ldr_mode(VMState *vm, int mode) {
+    /*
+    Load a register on the stack
+    argument is the register
+    the value still remains in the register, if you want to clear it use pop
+    */
+    if(mode == ARITH_DOUBLE)
+        pushDouble(vm, vm->dregs[vm->reg1]);
+    else
+        push(vm, vm->regs[vm->reg1]);
+}
+
+static inline void op_ldr(VMState *vm) {
+    op_ldr_mode(vm, vm->arith_mode);
+}
+
+static inline void op_str(VMState *vm) {
+    /*
+    Store a value from the stack into a register
+    the value remains on the stack, if you want to clear it use push
+    */
+
+    /*
+    int i = popv();
+    regs[reg1] = i;
+    push(i);
+    */
+
+    unsigned char *tmp = (unsigned char *)malloc(4);
+
+    memcpy(tmp, &vm->stack[--vm->pstack], 4);
+
+    vm->pstack++;
+
+    memcpy(&vm->regs[vm->reg1], tmp, 4);
+}
+
+static inline void op_ldm_mode(VMState *vm, int mode) {
+    /*
+    Load data from memory location:position onto the stack
+
+    push loc
+    push pos
+    ldm
+
+    @fix 4.12.21 - added switch to read char or int data
+    */
+
+    if(mode == MEMORY_RW_CHAR)  {
+
+        int loc, pos;
+        pos = popv(vm);
+        loc = popv(vm);
+
+        struct node *foundLink = find(vm->mem, loc);
+
+        int c = (int)memLoadByte(foundLink, pos);
+
+        push(vm, c);
+
+    }
+
+    else if(mode == MEMORY_RW_INT) {
+
+        int loc, pos;
+        pos = popv(vm);
+        loc = popv(vm);
+
+        struct node *foundLink = find(vm->mem, loc);
+
+        int i = memLoadWord(foundLink, pos);
+
+        push(vm, i);
+
+    }
+}
+
+static inline void op_ldm(VMState *vm) {
+    op_ldm_mode(vm, vm->memory_rw_mode);
+}
+
+/*
+stm on a shared store, an atomic store in place if the location is big enough and not mapped.
+otherwise, or if a writer copies the location meanwhile, a bigger copy replaces it under the lock.
+words at unaligned positions are written under the lock too, readers can see them half written.
+a node that is still in the store when the lock is held was sealed by a forked store, it gets
+copied like a mapped one
+*/
+static void stmShared(VMState *vm, struct node *n, int loc, int pos, int val, int size) {
+    if(!n->mapped && !memForked(n) && pos + size <= n->len) {
+        int done = size == 1 ? memStoreByte(n, pos, val) : memAligned(n, pos) && memStoreWord(n, pos, val);
+        if(done) {
+            if(config.bootfile && config.writeable)
+                persist(vm, n);
+            return;
         }
-        case STM: {
-            /*
-            Store data at a memory location:position
-            The location has to be already initialized using puts!
-                         
-            push value
-            push loc
-            push pos
-            stm
-            
-            @todo - switch to write int or char data
-                    4.12.21 - testing!
-            */
-            
-            if(memory_rw_mode == MEMORY_RW_CHAR) {
-            
-                int val, loc, pos;
-                pos = popv();
-                loc = popv();
-                val = popv(); 
-                
-                // lookup existing data, we assume there is data               
-                struct node *foundLink = find(loc);             
-                
-                // if the new position is higher than the current highest index we have to reallocate memory            
-                if(pos >= foundLink->len) {
-                
-                    // calculate the difference
-                    int diff = pos - foundLink->len;
-                    
-                    // create temporary buffer
-                    char *tmp = (char*)malloc(foundLink->len + diff);
-                    // zero out to be safe
-                    memset(tmp, 0, foundLink->len + diff);
-                    
-                    // copy existing data
-                    int c = 0;
-                    while(c < foundLink->len) {
-                        tmp[c] = foundLink->data[c];
-                        c++;
-                    }
-                    
-                    // replace the requested poition by the given value
-                    tmp[pos] = val; 
-                                                    
-                    // store it
-                    deleteNode(loc);                
-                    insertFirst(loc, tmp, foundLink->len + diff + 1);                
-                    if(config.bootfile && config.writeable) {
-                        deleteFile(config.bootfile, loc);
-                        createFile(config.bootfile, loc, tmp, foundLink->len + diff + 1);
-                    }
-                    
-                } else {
-                    
-                    // create temporary buffer
-                    char *tmp = (char *)malloc(foundLink->len);
-                    
-                    // copy existing data
-                    int i = 0;
-                    while(i < foundLink->len) {
-                        tmp[i] = foundLink->data[i];
-                        i++;
-                    }
-                    
-                    // replace new data
-                    tmp[pos] = val;
-                    
-                    // store it
-                    deleteNode(loc);                
-                    insertFirst(loc, tmp, foundLink->len);
-                    if(config.bootfile && config.writeable) {
-                        deleteFile(config.bootfile, loc);
-                        createFile(config.bootfile, loc, tmp, foundLink->len);
-                    } 
-                                  
-                }
-                
-            }
-            
-            else if(memory_rw_mode == MEMORY_RW_INT) {
-            
-                int val, loc, pos;
-                pos = popv();
-                loc = popv();
-                val = popv(); 
-                               
-                struct node *foundLink = find(loc);             
-                
-                // if the new position is higher than the current highest index we have to reallocate memory            
-                if(pos + sizeof(int) >= foundLink->len) {
-                
-                    // get the difference
-                    int diff = (pos + sizeof(int)) - foundLink->len; 
-                    
-                    // create temporary buffer                   
-                    char *tmp = (char*)malloc(foundLink->len + diff);
-                    // zero out to be safe
-                    memset(tmp, 0, foundLink->len + diff);
-                    
-                    // copy existing data into buffer
-                    int c = 0;
-                    while(c < foundLink->len) {
-                        tmp[c] = foundLink->data[c];
-                        c++;
-                    }   
-                                     
-                    // replace the requested poition by the given value                                                     
-                    memcpy(&tmp[pos], &val, sizeof(int));
-                    
-                    // store it
-                    deleteNode(loc);                
-                    insertFirst(loc, tmp, foundLink->len + diff);                
-                    if(config.bootfile && config.writeable) {
-                        deleteFile(config.bootfile, loc);
-                        createFile(config.bootfile, loc, tmp, foundLink->len + diff);
-                    }   
-                                     
-                } else {    
-                                             
-                    // create temporary buffer
-                    char *tmp = (char *)malloc(foundLink->len);
-                    
-                    // copy existing data
-                    int i = 0;
-                    while(i < foundLink->len) {
-                        tmp[i] = foundLink->data[i];
-                        i++;
-                    }
-                    // replace the requested poition by the given value
-                    memcpy(tmp + pos, &val, sizeof(int)); 
-                    
-                    // store it
-                    deleteNode(loc);                
-                    insertFirst(loc, tmp, foundLink->len);
-                    if(config.bootfile && config.writeable) {
-                        deleteFile(config.bootfile, loc);
-                        createFile(config.bootfile, loc, tmp, foundLink->len);
-                    } 
-                                                     
-                } 
-                                
-            }
-            
-            break;
-            
+    }
+    memLock(vm);
+    n = find(vm->mem, loc);
+    if(n->mapped || memForked(n) || n->sealed || pos + size > n->len) {
+        struct node *copy = memCopy(vm->mem, n, pos + size);
+        if(size == 1) copy->data[pos] = val;
+        else memcpy(&copy->data[pos], &val, sizeof(int));
+        memPut(vm->mem, copy);
+        n = copy;
+    } else if(size == 1) {
+        memStoreByte(n, pos, val);
+    } else {
+        memcpy(&n->data[pos], &val, sizeof(int));
+    }
+    if(config.bootfile && config.writeable)
+        persist(vm, n);
+    memUnlock(vm);
+}
+
+static inline void op_stm_mode(VMState *vm, int mode) {
+    /*
+    Store data at a memory location:position
+    The location has to be already initialized using puts!
+
+    push value
+    push loc
+    push pos
+    stm
+
+    @todo - switch to write int or char data
+            4.12.21 - testing!
+    @fix 17.10.26 - write in place, the location only grows if pos is past the end
+    */
+
+    if(mode == MEMORY_RW_CHAR) {
+
+        int val, loc, pos;
+        pos = popv(vm);
+        loc = popv(vm);
+        val = popv(vm); 
+
+        // lookup existing data, we assume there is data               
+        struct node *foundLink = find(vm->mem, loc);             
+
+        if(vm->mem->shared) {
+            stmShared(vm, foundLink, loc, pos, val, 1);
+            return;
         }
-        
-        case LDMR: {
-            /*
-            Load a range of bytes from memory location onto the stack            
-            push loc
-            push start
-            push end
-            ldmr
-            
-            @todo int/char data switch
-            */
-            
-            int loc, start, end;
-            end = popv();
-            start = popv();
-            loc = popv();
-            struct node *dat = find(loc);           
-            /* removed 28.11.21, now its reverse
-            while(start <= end) {
-                push((int)dat->data[start]);
-                start++;    
-            }
-            */
-            while(end >= start) {
-                push((int)dat->data[end]);
-                end--;    
-            } 
-                       
-            break;
-        }    
-        case STMR: {
-            /*
-            Store a range of bytes at a memory location            
-            push loc
-            push start
-            push end
-            stmr
-            
-            @todo int/char data switch
-            */
-            
-            int loc, start, end;
-            end = popv();
-            start = popv();
-            loc = popv();
-            struct node *dat = find(loc);                        
-            // if the new position is higher than the current highest index we have to reallocate memory            
-            int len = dat->len; //strlen(dat->data);
-            if(end >= len) {
-                int diff = end - len;
-                char *cnt;
-                cnt = (char*)malloc(len + diff);
-                // \x00 characters make trouble reading the length, we avoid it by filling the empty gap with \x20
-                memset(cnt, 0, len + diff);
-                // copy the current content into the new memory
-                int c = 0;
-                while( c < len ) {
-                    cnt[c] = dat->data[c];
-                    c++;
-                }
-                // copy the new content into the new memory
-                while(start <= end) {
-                    cnt[start] = popv();
-                    start++;    
-                }
-                // replace temporarily
-                deleteNode(loc);                
-                insertFirst(loc, cnt, len + diff + 1);                
-                // replace in bootfile
-                if(config.bootfile && config.writeable) {
-                    deleteFile(config.bootfile, loc);
-                    createFile(config.bootfile, loc, cnt, len + diff + 1);
-                }                                
-            } else {                       
-                // otherwise we copy the current content into the existing memory
-                while(start <= end) {
-                    dat->data[start] = popv();
-                    start++;    
-                }            
-                char *tmp = (char *)malloc(dat->len);
-                int i = 0;
-                while(i < dat->len) {
-                    tmp[i] = dat->data[i];
-                    i++;
-                }
-                char *newstr = strdup(tmp);
-                // replace temporarily
-                newstr[dat->len + 1];
-                deleteNode(loc);                
-                insertFirst(loc, newstr, dat->len);
-                // replace in bootfile
-                if(config.bootfile && config.writeable) {
-                    deleteFile(config.bootfile, loc);
-                    createFile(config.bootfile, loc, newstr, dat->len);
-                }                         
-            }   
-                                   
-            break;
+
+        // if the new position is higher than the current highest index the location grows
+        foundLink = memWritable(vm->mem, foundLink);
+        memGrow(vm->mem, foundLink, pos + 1);
+
+        // replace the requested position by the given value
+        foundLink->data[pos] = val; 
+
+        if(config.bootfile && config.writeable) {
+            persist(vm, foundLink);
         }
-        case ADD: {
-            /*
-            Addition
-            
-            @todo 06.12.21 arith mode
-            */
-            
-            // default
-            if(arith_mode == ARITH_CHAR) {
-            
-                // create a char from dst
-                char c1 = (char)regs[reg1];
-                
-                // create other char either by reg2 or value
-                char c2;                
-                if(reg2 != 0) 
-                    c2 = (char)regs[reg2];
-                else 
-                    c2 = (char)value;
-                    
-                // Now we have 2 char values.
-                //printf("<c1: %c (%d), c2: %c (%d)>", c1, c1, c2, c2);
-                
-                // add them together
-                c1 += c2;
-                
-                // and copy as char into reg1
-                memcpy(&regs[reg1], &c1, 1);
-                
-            }
-            
-            else if(arith_mode == ARITH_INT) {
-                
-                // create an int from dst
-                int i1 = (int)regs[reg1];
-                
-                // create other int either by reg2 or value
-                int i2;                
-                if(reg2 != 0) 
-                    i2 = (int)regs[reg2];
-                else 
-                    i2 = (int)value;
-                    
-                // Now we have 2 int values.
-                //printf("<d1: %d, d2: %d>", i1, i2);
-                
-                // add them together
-                i1 += i2;
-                
-                // and copy as int into reg1
-                memcpy(&regs[reg1], &i1, 4);
-                 
-            }
-            
-            if(arith_mode == ARITH_FLOAT) {
-            
-                // create a float from dst
-                float f1; // = regs[reg1];
-                memcpy(&f1, &regs[reg1], 4);
-                
-                // create other float either by reg2 or value
-                float f2;                
-                if(reg2 != 0) { 
-                    memcpy(&f2, &regs[reg2], 4); 
-                    //f2 = (float)regs[reg2];
-                } else { 
-                    //memcpy(&f2, &value, 4);
-                    f2 = value;
-                }
-                    
-                // Now we have 2 float values.
-                //printf("\n<ADD f1: %f, f2: %f>\n", f1, f2);
-                
-                // div them together
-                f1 += f2;
-                
-                // and copy as float into reg1
-                memcpy(&regs[reg1], &f1, 4);
-   
-            }            
-            
-            /*
-            if(reg2 == 0) 
-                regs[reg1] += value; 
-            else 
-                regs[reg1] += regs[reg2];  
-            */
-                    
-            break;            
-		}        		
-		case SUB: {
-            /*
-            Subtraction
-            */
-            
-            // default
-            if(arith_mode == ARITH_CHAR) {
-            
-                // create a char from dst
-                char c1 = (char)regs[reg1];
-                
-                // create other char either by reg2 or value
-                char c2;                
-                if(reg2 != 0) 
-                    c2 = (char)regs[reg2];
-                else 
-                    c2 = (char)value;
-                    
-                // Now we have 2 char values.
-                //printf("<c1: %c (%d), c2: %c (%d)>", c1, c1, c2, c2);
-                
-                // sub them together
-                c1 -= c2;
-                
-                // and copy as char into reg1
-                memcpy(&regs[reg1], &c1, 1);
-                
-            }
-            
-            else if(arith_mode == ARITH_INT) {
-                
-                // create an int from dst
-                int i1 = (int)regs[reg1];
-                
-                // create other int either by reg2 or value
-                int i2;                
-                if(reg2 != 0) 
-                    i2 = (int)regs[reg2];
-                else 
-                    i2 = (int)value;
-                    
-                // Now we have 2 int values.
-                //printf("<d1: %d, d2: %d>", i1, i2);
-                
-                // sub them together
-                i1 -= i2;
-                
-                // and copy as int into reg1
-                memcpy(&regs[reg1], &i1, 4);
-                 
-            }
-            
-            if(arith_mode == ARITH_FLOAT) {
-            
-                // create a float from dst
-                float f1; // = regs[reg1];
-                memcpy(&f1, &regs[reg1], 4);
-                
-                // create other float either by reg2 or value
-                float f2;                
-                if(reg2 != 0) { 
-                    memcpy(&f2, &regs[reg2], 4); 
-                    //f2 = (float)regs[reg2];
-                } else { 
-                    //memcpy(&f2, &value, 4);
-                    f2 = value;
-                }
-                    
-                // Now we have 2 float values.
-                //printf("\n<SUB f1: %f, f2: %f>\n", f1, f2);
-                
-                // div them together
-                f1 -= f2;
-                
-                // and copy as float into reg1
-                memcpy(&regs[reg1], &f1, 4);
-   
-            } 
-            
-            /*
-            if(reg2 != 0) {                            
-                regs[reg1] -= regs[reg2];                               
-            } else {                            
-                regs[reg1] -= value;                                 
-            }
-            */
-            
-			break;
-		}		
-		case MUL: {
-            /*
-            Multiplikation
-            */
-            
-            // default
-            if(arith_mode == ARITH_CHAR) {
-            
-                // create a char from dst
-                char c1 = (char)regs[reg1];
-                
-                // create other char either by reg2 or value
-                char c2;                
-                if(reg2 != 0) 
-                    c2 = (char)regs[reg2];
-                else 
-                    c2 = (char)value;
-                    
-                // Now we have 2 char values.
-                //printf("<c1: %c (%d), c2: %c (%d)>", c1, c1, c2, c2);
-                
-                // mul them together
-                c1 *= c2;
-                
-                // and copy as char into reg1
-                memcpy(&regs[reg1], &c1, 1);
-                
-            }
-            
-            else if(arith_mode == ARITH_INT) {
-                
-                // create an int from dst
-                int i1 = (int)regs[reg1];
-                
-                // create other int either by reg2 or value
-                int i2;                
-                if(reg2 != 0) 
-                    i2 = (int)regs[reg2];
-                else 
-                    i2 = (int)value;
-                    
-                // Now we have 2 int values.
-                //printf("<d1: %d, d2: %d>", i1, i2);
-                
-                // mul them together
-                i1 *= i2;
-                
-                // and copy as int into reg1
-                memcpy(&regs[reg1], &i1, 4);
-                 
-            }
-            
-            if(arith_mode == ARITH_FLOAT) {
-            
-                // create a float from dst
-                float f1 = regs[reg1];
-                
-                // create other float either by reg2 or value
-                float f2;                
-                if(reg2 != 0) { 
-                    f2 = regs[reg2];
-                } else { 
-                    f2 = value;
-                }
-                    
-                // Now we have 2 float values.
-                //printf("\n<MUL f1: %f, f2: %f>\n", f1, f2);
-                
-                // div them together
-                f1 *= f2;
-                
-                // and copy as float into reg1
-                memcpy(&regs[reg1], &f1, 4);
-   
-            } 
-            
-            /*
-            if(reg2 != 0) {
-                regs[reg1] *= regs[reg2]; 
-            } else {
-                regs[reg1] *= value; 
-            } 
-            */
-            
-			break;
-		}        
-		case DIV: {            
-            /*
-            Dividision
-            */
-            
-            // default
-            if(arith_mode == ARITH_CHAR) {
-            
-                // create a char from dst
-                char c1 = (char)regs[reg1];
-                
-                // create other char either by reg2 or value
-                char c2;                
-                if(reg2 != 0) 
-                    c2 = (char)regs[reg2];
-                else 
-                    c2 = (char)value;
-                    
-                // Now we have 2 char values.
-                //printf("<c1: %c (%d), c2: %c (%d)>", c1, c1, c2, c2);
-                
-                // div them together
-                c1 /= c2;
-                
-                // and copy as char into reg1
-                memcpy(&regs[reg1], &c1, 1);
-                
-            }
-            
-            else if(arith_mode == ARITH_INT) {
-                
-                // create an int from dst
-                int i1 = (int)regs[reg1];
-                
-                // create other int either by reg2 or value
-                int i2;                
-                if(reg2 != 0) 
-                    i2 = (int)regs[reg2];
-                else 
-                    i2 = (int)value;
-                    
-                // Now we have 2 int values.
-                //printf("<d1: %d, d2: %d>", i1, i2);
-                
-                // div them together
-                i1 /= i2;
-                
-                // and copy as int into reg1
-                memcpy(&regs[reg1], &i1, 4);
-                 
-            }
-            
-            if(arith_mode == ARITH_FLOAT) {
-            
-                // create a float from dst
-                float f1 = regs[reg1];
-                
-                // create other float either by reg2 or value
-                float f2;                
-                if(reg2 != 0) { 
-                    f2 = regs[reg2];
-                } else { 
-                    f2 = value;
-                }
-                    
-                // Now we have 2 float values.
-                // printf("\n<DIV f1: %f, f2: %f>\n", f1, f2);
-                
-                // div them together
-                f1 /= f2;
-                
-                // and copy as float into reg1
-                memcpy(&regs[reg1], &f1, 4);
-   
-            }
-            
-            /*
-            if(reg2 != 0) {            
-                regs[reg1] /= regs[reg2];             
-            } else {             
-                regs[reg1] /= value;             
-            } 
-            */
-                        
-			break;            
-		}
-        case MOD: {
-            /*
-            Modulo
-            there is no modulo in ARITH_FLOAT mode, use INT instead
-            */
-            
-            // default
-            if(arith_mode == ARITH_CHAR) {
-            
-                // create a char from dst
-                char c1 = (char)regs[reg1];
-                
-                // create other char either by reg2 or value
-                char c2;                
-                if(reg2 != 0) 
-                    c2 = (char)regs[reg2];
-                else 
-                    c2 = (char)value;
-                    
-                // Now we have 2 char values.
-                //printf("<c1: %c (%d), c2: %c (%d)>", c1, c1, c2, c2);
-                
-                // mod them together
-                c1 %= c2;
-                
-                // and copy as char into reg1
-                memcpy(&regs[reg1], &c1, 1);
-                
-            }
-            
-            else if(arith_mode == ARITH_INT || arith_mode == ARITH_FLOAT) {
-                
-                // create an int from dst
-                int i1 = (int)regs[reg1];
-                
-                // create other int either by reg2 or value
-                int i2;                
-                if(reg2 != 0) 
-                    i2 = (int)regs[reg2];
-                else 
-                    i2 = (int)value;
-                    
-                // Now we have 2 int values.
-                //printf("<d1: %d, d2: %d>", i1, i2);
-                
-                // mod them together
-                i1 %= i2;
-                
-                // and copy as int into reg1
-                memcpy(&regs[reg1], &i1, 4);
-                 
-            }
-            
-            /*
-            if(reg2 != 0) {
-                regs[reg1] %= regs[reg2]; 
-            } else {
-                regs[reg1] %= value; 
-            }
-            */
-              
-			break;
-		}		
-		case JMP: {
-			/* 
-            Jump to a label 
-            no return address gets stored
-            */
-            pc = value * 2;
-			break;
-		}
-		case JZ: {
-			/* 
-            Jump to a label if zeroFlag = true (last condition was true) 
-            no return address gets stored
-            */
-            if(zeroflag) {
-				pc = value * 2;             
-			} 
-            zeroflag = false;
-			break;
-		}        
-        case JNZ: {
-            /* 
-            Jump to a label if zeroflag = false (last condition was false) 
-            no return address gets stored
-            */
-			if(!zeroflag) {
-                pc = value * 2;                                
-			} 
-            zeroflag = false;
-			break;
-		}
-        case EQ: {
-            /*
-            push 1
-            push 1
-            eq --> z = true
-            */
-            int b = popv();
-            int a = popv();
-            zeroflag = false;
-            if(a == b) zeroflag = true;
+
+    }
+
+    else if(mode == MEMORY_RW_INT) {
+
+        int val, loc, pos;
+        pos = popv(vm);
+        loc = popv(vm);
+        val = popv(vm); 
+
+        struct node *foundLink = find(vm->mem, loc);             
+
+        if(vm->mem->shared) {
+            stmShared(vm, foundLink, loc, pos, val, sizeof(int));
+            return;
+        }
+
+        // if the new position is higher than the current highest index the location grows
+        foundLink = memWritable(vm->mem, foundLink);
+        memGrow(vm->mem, foundLink, pos + sizeof(int));
+
+        // replace the requested position by the given value                                                     
+        memcpy(&foundLink->data[pos], &val, sizeof(int));
+
+        if(config.bootfile && config.writeable) {
+            persist(vm, foundLink);
+        }   
+
+    }
+}
+
+static inline void op_stm(VMState *vm) {
+    op_stm_mode(vm, vm->memory_rw_mode);
+}
+
+static inline void op_ldmr(VMState *vm) {
+    /*
+    Load a range of bytes from memory location onto the stack            
+    push loc
+    push start
+    push end
+    ldmr
+
+    @todo int/char data switch
+    */
+
+    int loc, start, end;
+    end = popv(vm);
+    start = popv(vm);
+    loc = popv(vm);
+    struct node *dat = find(vm->mem, loc);           
+    /* removed 28.11.21, now its reverse
+    while(start <= end) {
+        push((int)dat->data[start]);
+        start++;    
+    }
+    */
+    while(end >= start) {
+        push(vm, (int)dat->data[end]);
+        end--;    
+    } 
+}
+
+/* stmr on a shared store writes a copy of the location that replaces it, readers see all bytes or none */
+static void stmrShared(VMState *vm, int loc, int start, int end) {
+    int len = end - start + 1;
+    unsigned char *bytes = (unsigned char *)malloc(len > 0 ? len : 1);
+    for(int i = 0; i < len; i++)
+        bytes[i] = popv(vm);
+    memLock(vm);
+    struct node *copy = memCopy(vm->mem, find(vm->mem, loc), end + 1);
+    if(len > 0)
+        memcpy(&copy->data[start], bytes, len);
+    memPut(vm->mem, copy);
+    if(config.bootfile && config.writeable)
+        persist(vm, copy);
+    memUnlock(vm);
+    free(bytes);
+}
+
+static inline void op_stmr(VMState *vm) {
+    /*
+    Store a range of bytes at a memory location            
+    push loc
+    push start
+    push end
+    stmr
+
+    @todo int/char data switch
+    */
+
+    int loc, start, end;
+    end = popv(vm);
+    start = popv(vm);
+    loc = popv(vm);
+    if(vm->mem->shared) {
+        stmrShared(vm, loc, start, end);
+        return;
+    }
+    struct node *dat = find(vm->mem, loc);                        
+    // if the new position is higher than the current highest index the location grows, the gap is zeroed
+    dat = memWritable(vm->mem, dat);
+    memGrow(vm->mem, dat, end + 1);
+    // copy the new content into the memory
+    while(start <= end) {
+        dat->data[start] = popv(vm);
+        start++;    
+    }
+    // replace in bootfile
+    if(config.bootfile && config.writeable) {
+        persist(vm, dat);
+    }                         
+}
+
+static inline void op_add_mode(VMState *vm, int mode) {
+    /*
+    Addition
+
+    @todo 06.12.21 arith mode
+    */
+
+    // default
+    if(mode == ARITH_CHAR) {
+
+        // create a char from dst
+        char c1 = (char)vm->regs[vm->reg1];
+
+        // create other char either by reg2 or value
+        char c2 = (char)intOperand(vm);
+
+        // Now we have 2 char values.
+        //printf("<c1: %c (%d), c2: %c (%d)>", c1, c1, c2, c2);
+
+        // add them together
+        c1 += c2;
+
+        // and copy as char into reg1
+        memcpy(&vm->regs[vm->reg1], &c1, 1);
+
+    }
+
+    else if(mode == ARITH_INT) {
+
+        // create an int from dst
+        int i1 = (int)vm->regs[vm->reg1];
+
+        // create other int either by reg2 or value
+        int i2 = intOperand(vm);
+
+        // Now we have 2 int values.
+        //printf("<d1: %d, d2: %d>", i1, i2);
+
+        // add them together
+        i1 += i2;
+
+        // and copy as int into reg1
+        memcpy(&vm->regs[vm->reg1], &i1, 4);
+
+    }
+
+    // the float bank, the operand is a float register, a float literal or an integer
+    if(mode == ARITH_FLOAT)
+        vm->fregs[vm->reg1] += floatOperand(vm);
+
+    if(mode == ARITH_DOUBLE)
+        vm->dregs[vm->reg1] += doubleOperand(vm);
+
+    /*
+    if(reg2 == 0) 
+        regs[reg1] += value; 
+    else 
+        regs[reg1] += regs[reg2];  
+    */
+}
+
+static inline void op_add(VMState *vm) {
+    op_add_mode(vm, vm->arith_mode);
+}
+
+static inline void op_sub_mode(VMState *vm, int mode) {
+    /*
+    Subtraction
+    */
+
+    // default
+    if(mode == ARITH_CHAR) {
+
+        // create a char from dst
+        char c1 = (char)vm->regs[vm->reg1];
+
+        // create other char either by reg2 or value
+        char c2 = (char)intOperand(vm);
+
+        // Now we have 2 char values.
+        //printf("<c1: %c (%d), c2: %c (%d)>", c1, c1, c2, c2);
+
+        // sub them together
+        c1 -= c2;
+
+        // and copy as char into reg1
+        memcpy(&vm->regs[vm->reg1], &c1, 1);
+
+    }
+
+    else if(mode == ARITH_INT) {
+
+        // create an int from dst
+        int i1 = (int)vm->regs[vm->reg1];
+
+        // create other int either by reg2 or value
+        int i2 = intOperand(vm);
+
+        // Now we have 2 int values.
+        //printf("<d1: %d, d2: %d>", i1, i2);
+
+        // sub them together
+        i1 -= i2;
+
+        // and copy as int into reg1
+        memcpy(&vm->regs[vm->reg1], &i1, 4);
+
+    }
+
+    // the float bank, the operand is a float register, a float literal or an integer
+    if(mode == ARITH_FLOAT)
+        vm->fregs[vm->reg1] -= floatOperand(vm);
+
+    if(mode == ARITH_DOUBLE)
+        vm->dregs[vm->reg1] -= doubleOperand(vm);
+
+    /*
+    if(reg2 != 0) {                            
+        regs[reg1] -= regs[reg2];                               
+    } else {                            
+        regs[reg1] -= value;                                 
+    }
+    */
+}
+
+static inline void op_sub(VMState *vm) {
+    op_sub_mode(vm, vm->arith_mode);
+}
+
+static inline void op_mul_mode(VMState *vm, int mode) {
+    /*
+    Multiplikation
+    */
+
+    // default
+    if(mode == ARITH_CHAR) {
+
+        // create a char from dst
+        char c1 = (char)vm->regs[vm->reg1];
+
+        // create other char either by reg2 or value
+        char c2 = (char)intOperand(vm);
+
+        // Now we have 2 char values.
+        //printf("<c1: %c (%d), c2: %c (%d)>", c1, c1, c2, c2);
+
+        // mul them together
+        c1 *= c2;
+
+        // and copy as char into reg1
+        memcpy(&vm->regs[vm->reg1], &c1, 1);
+
+    }
+
+    else if(mode == ARITH_INT) {
+
+        // create an int from dst
+        int i1 = (int)vm->regs[vm->reg1];
+
+        // create other int either by reg2 or value
+        int i2 = intOperand(vm);
+
+        // Now we have 2 int values.
+        //printf("<d1: %d, d2: %d>", i1, i2);
+
+        // mul them together
+        i1 *= i2;
+
+        // and copy as int into reg1
+        memcpy(&vm->regs[vm->reg1], &i1, 4);
+
+    }
+
+    // the float bank, the operand is a float register, a float literal or an integer
+    if(mode == ARITH_FLOAT)
+        vm->fregs[vm->reg1] *= floatOperand(vm);
+
+    if(mode == ARITH_DOUBLE)
+        vm->dregs[vm->reg1] *= doubleOperand(vm);
+
+    /*
+    if(reg2 != 0) {
+        regs[reg1] *= regs[reg2]; 
+    } else {
+        regs[reg1] *= value; 
+    } 
+    */
+}
+
+static inline void op_mul(VMState *vm) {
+    op_mul_mode(vm, vm->arith_mode);
+}
+
+static inline void op_div_mode(VMState *vm, int mode) {
+    /*
+    Dividision
+    */
+
+    // default
+    if(mode == ARITH_CHAR) {
+
+        // create a char from dst
+        char c1 = (char)vm->regs[vm->reg1];
+
+        // create other char either by reg2 or value
+        char c2 = (char)intOperand(vm);
+
+        // Now we have 2 char values.
+        //printf("<c1: %c (%d), c2: %c (%d)>", c1, c1, c2, c2);
+
+        // div them together
+        c1 /= c2;
+
+        // and copy as char into reg1
+        memcpy(&vm->regs[vm->reg1], &c1, 1);
+
+    }
+
+    else if(mode == ARITH_INT) {
+
+        // create an int from dst
+        int i1 = (int)vm->regs[vm->reg1];
+
+        // create other int either by reg2 or value
+        int i2 = intOperand(vm);
+
+        // Now we have 2 int values.
+        //printf("<d1: %d, d2: %d>", i1, i2);
+
+        // div them together
+        i1 /= i2;
+
+        // and copy as int into reg1
+        memcpy(&vm->regs[vm->reg1], &i1, 4);
+
+    }
+
+    // the float bank, the operand is a float register, a float literal or an integer
+    if(mode == ARITH_FLOAT)
+        vm->fregs[vm->reg1] /= floatOperand(vm);
+
+    if(mode == ARITH_DOUBLE)
+        vm->dregs[vm->reg1] /= doubleOperand(vm);
+
+    /*
+    if(reg2 != 0) {            
+        regs[reg1] /= regs[reg2];             
+    } else {             
+        regs[reg1] /= value;             
+    } 
+    */
+}
+
+static inline void op_div(VMState *vm) {
+    op_div_mode(vm, vm->arith_mode);
+}
+
+static inline void op_mod_mode(VMState *vm, int mode) {
+    /*
+    Modulo
+    there is no modulo in ARITH_FLOAT and ARITH_DOUBLE mode, they use INT instead
+    */
+
+    // default
+    if(mode == ARITH_CHAR) {
+
+        // create a char from dst
+        char c1 = (char)vm->regs[vm->reg1];
+
+        // create other char either by reg2 or value
+        char c2 = (char)intOperand(vm);
+
+        // Now we have 2 char values.
+        //printf("<c1: %c (%d), c2: %c (%d)>", c1, c1, c2, c2);
+
+        // mod them together
+        c1 %= c2;
+
+        // and copy as char into reg1
+        memcpy(&vm->regs[vm->reg1], &c1, 1);
+
+    }
+
+    else if(mode == ARITH_INT || mode == ARITH_FLOAT || mode == ARITH_DOUBLE) {
+
+        // create an int from dst
+        int i1 = (int)vm->regs[vm->reg1];
+
+        // create other int either by reg2 or value
+        int i2 = intOperand(vm);
+
+        // Now we have 2 int values.
+        //printf("<d1: %d, d2: %d>", i1, i2);
+
+        // mod them together
+        i1 %= i2;
+
+        // and copy as int into reg1
+        memcpy(&vm->regs[vm->reg1], &i1, 4);
+
+    }
+
+    /*
+    if(reg2 != 0) {
+        regs[reg1] %= regs[reg2]; 
+    } else {
+        regs[reg1] %= value; 
+    }
+    */
+}
+
+static inline void op_mod(VMState *vm) {
+    op_mod_mode(vm, vm->arith_mode);
+}
+
+static inline void op_jmp(VMState *vm) {
+    /* 
+    Jump to a label 
+    no return address gets stored
+    */
+    vm->pc = vm->value;
+    syncCheck(vm);
+}
+
+static inline void op_jz(VMState *vm) {
+    /* 
+    Jump to a label if zeroFlag = true (last condition was true) 
+    no return address gets stored
+    */
+    if(vm->zeroflag) {
+    	vm->pc = vm->value;             
+    } 
+    vm->zeroflag = false;
+    syncCheck(vm);
+}
+
+static inline void op_jnz(VMState *vm) {
+    /* 
+    Jump to a label if zeroflag = false (last condition was false) 
+    no return address gets stored
+    */
+    if(!vm->zeroflag) {
+        vm->pc = vm->value;                                
+    } 
+    vm->zeroflag = false;
+    syncCheck(vm);
+}
+
+static inline void op_eq(VMState *vm) {
+    /*
+    push 1
+    push 1
+    eq --> z = true
+    */
+    int b = popv(vm);
+    int a = popv(vm);
+    vm->zeroflag = false;
+    if(a == b) vm->zeroflag = true;
+}
+
+static inline void op_lt(VMState *vm) {
+    /*
+    push 2
+    push 1
+    lt --> z = true
+    */
+    int a = popv(vm);
+    int b = popv(vm);
+    vm->zeroflag = false;
+    if(a < b) vm->zeroflag = true;
+}
+
+static inline void op_gt(VMState *vm) {
+    /*
+    push 1
+    push 2
+    gt --> z = true
+    */
+    int a = popv(vm);
+    int b = popv(vm);
+    vm->zeroflag = false;
+    if(a > b) vm->zeroflag = true;
+}
+
+static inline void op_leq(VMState *vm) {
+    /*
+    push 2
+    push 1
+    leq --> zero = true
+    */
+    int a = popv(vm);
+    int b = popv(vm);
+    vm->zeroflag = false;
+    if(a <= b) vm->zeroflag = true;
+}
+
+static inline void op_geq(VMState *vm) {
+    /*
+    push 1
+    push 2
+    geq --> zero = true
+    */
+    int a = popv(vm);
+    int b = popv(vm);
+    vm->zeroflag = false;
+    if(a >= b) vm->zeroflag = true;
+}
+
+static inline void op_ret(VMState *vm) {
+    vm->pc = rpopv(vm);
+}
+
+static inline void op_print_mode(VMState *vm, int mode) {
+    /*
+    Print the value on the stack, the format character is on top of it
+    d, i, u, x, X, o and c (f in float mode) are formatted directly into the console buffer,
+    everything else goes through snprintf. in ARITH_DOUBLE mode the format and the value are doubles
+    */
+
+    char fmt = popInt(vm, mode);
+    char s[3] = { '%', fmt, '\0' };
+    char tmp[512];
+    int n;
+    if(mode == ARITH_DOUBLE) {
+        double d = popDouble(vm);
+        n = snprintf(tmp, sizeof(tmp), s, d);
+        if(n > 0)
+            consoleWrite(&vm->console, tmp, n < (int)sizeof(tmp) ? n : (int)sizeof(tmp) - 1);
+        return;
+    }
+    int raw = popv(vm);
+    if(mode == ARITH_FLOAT) {
+        float f;
+        memcpy(&f, &raw, 4);
+        if((fmt == 'f' || fmt == 'F') && consoleFloat(&vm->console, f))
+            return;
+        n = snprintf(tmp, sizeof(tmp), s, f);
+    }
+    else {
+        int i = mode == ARITH_CHAR ? (char)raw : raw;
+        switch(fmt) {
+            case 'd': case 'i': consoleInt(&vm->console, i); return;
+            case 'u': consoleUnsigned(&vm->console, i, 10, 0); return;
+            case 'x': consoleUnsigned(&vm->console, i, 16, 0); return;
+            case 'X': consoleUnsigned(&vm->console, i, 16, 1); return;
+            case 'o': consoleUnsigned(&vm->console, i, 8, 0); return;
+            case 'c': consoleChar(&vm->console, (char)i); return;
+            default: break;
+        }
+        n = snprintf(tmp, sizeof(tmp), s, i);
+    }
+    if(n > 0)
+        consoleWrite(&vm->console, tmp, n < (int)sizeof(tmp) ? n : (int)sizeof(tmp) - 1);
+}
+
+static inline void op_print(VMState *vm) {
+    op_print_mode(vm, vm->arith_mode);
+}
+
+static inline void op_printc(VMState *vm) {
+    consoleChar(&vm->console, (char)popInt(vm, vm->arith_mode));
+}
+
+static inline void op_read(VMState *vm) {
+    /*
+    Read a line from the console, stdin by default
+    replace \x0A at the end by \0x00
+    */ 
+
+    consoleFlush(&vm->console);
+    char tmp[1024] = {0};
+    pthread_mutex_lock(&vm->inputLock);
+    int complete = consoleReadLine(&vm->console, tmp, sizeof(tmp)); // without 0xA on end
+    pthread_mutex_unlock(&vm->inputLock);
+    if(!complete) {
+        vmBlock(vm);
+        return;
+    }
+    int index = popv(vm);
+    int dataLen = strlen(tmp);                        
+    // add \x00 at the end            
+    char *newstr = (char *)malloc(dataLen + 1);  
+    int i = 0; 
+    while(i < dataLen) { 
+        newstr[i] = tmp[i]; 
+        i++; 
+    }
+    newstr[i] = '\0'; // \x00 to mark the end       
+    // an existing location is replaced
+    memLock(vm);
+    insertFirst(vm->mem, index, newstr, dataLen + 1);                    
+    if( config.bootfile && bootfilewriteable ) { 
+        persist(vm, find(vm->mem, index));                        
+    }            
+    memUnlock(vm);
+    // push the length onto the stack afterward?
+    // push(dataLen); 
+}
+
+static inline void op_write(VMState *vm) {
+    /*
+    Print a memory location as characters to screen
+    the location is on the stack
+    the whole location is copied to the console buffer, including \x00 characters
+    */ 
+
+    int index = popv(vm);
+    struct node *foundLink = find(vm->mem, index);
+    consoleWrite(&vm->console, (char *)foundLink->data, foundLink->len); 
+}
+
+static inline void op_puts_mode(VMState *vm, int mode) {
+    /*
+    Put data from the stack into memory
+    all the data on the stack
+    data length on the stack
+    memory location on the stack
+
+    @fix 3.12.21 - added switch to write char or int data            
+    @fix 4.12.21 - using memcpy to fix overwriting other entries
+    */
+
+    if(mode == MEMORY_RW_CHAR) {
+
+        int index = popv(vm);
+        int len = popv(vm); 
+
+        char tmp[len];
+        int i = 0;            
+        while(i < len) 
+            tmp[i++] = popv(vm);
+
+        unsigned char *buffer = (unsigned char *)malloc(len);
+        memcpy(buffer, &tmp, len);
+
+        // an existing location is replaced
+        memLock(vm);
+        insertFirst(vm->mem, index, buffer, i);                    
+        if( config.bootfile && bootfilewriteable ) { 
+            persist(vm, find(vm->mem, index));
+        }  
+        memUnlock(vm);
+
+    }
+
+    else if(mode == MEMORY_RW_INT) {
+
+        int index = popv(vm);
+        int len = popv(vm); 
+
+        int tmp[len];
+        int i = 0;            
+        while(i < len)
+            tmp[i++] = popv(vm);
+
+        unsigned char *buffer = (unsigned char *)malloc(len * sizeof(int));
+        memcpy(buffer, &tmp, sizeof(int) * len);                
+
+        memLock(vm);
+        insertFirst(vm->mem, index, buffer, len * 4);
+        if( config.bootfile && bootfilewriteable ) { 
+            persist(vm, find(vm->mem, index));
+        } 
+        memUnlock(vm);
+
+    }
+}
+
+static inline void op_puts(VMState *vm) {
+    op_puts_mode(vm, vm->memory_rw_mode);
+}
+
+static inline void op_gets_mode(VMState *vm, int mode) {
+    /*
+    Get data from memory onto the stack
+    memory location is on the stack
+
+    @fix 3.13.21 - added switch to read char or int
+    */
+
+    if(mode == MEMORY_RW_CHAR) {
+
+        int index = popv(vm);
+
+        struct node *foundLink = find(vm->mem, index);
+        int dataLen = foundLink->len;
+
+        while(dataLen > 0) { 
+            push(vm, foundLink->data[--dataLen]);                               
+        }
+
+    }
+
+    else if(mode == MEMORY_RW_INT) {
+
+        int index = popv(vm);
+
+        struct node *foundLink = find(vm->mem, index);
+        int dataLen = foundLink->len;
+
+        int i = 0;
+        while(dataLen > 0) {                     
+            dataLen -= 4;
+            memcpy(&i, &foundLink->data[dataLen], sizeof(int));
+            push(vm, i);                                                   
+        }
+
+    }
+}
+
+static inline void op_gets(VMState *vm) {
+    op_gets_mode(vm, vm->memory_rw_mode);
+}
+
+static inline void op_readc(VMState *vm) {
+    /* 
+    Read a char from the console, stdin by default
+    */
+
+    consoleFlush(&vm->console);
+    pthread_mutex_lock(&vm->inputLock);
+    int ch = consoleReadChar(&vm->console);
+    pthread_mutex_unlock(&vm->inputLock);
+    if(ch == CONSOLE_WAIT) {
+        vmBlock(vm);
+        return;
+    }
+    push(vm, ch);
+}
+
+static inline void op_cmp(VMState *vm) {
+    int src = popv(vm);
+    int dst = popv(vm);
+    struct node *first = find(vm->mem, src);
+    struct node *second = find(vm->mem, dst);
+    vm->zeroflag = false;
+    if(first->len != second->len) { 
+        vm->zeroflag = false; 
+        return; 
+    }
+    if( memcmp(first->data, second->data, first->len) == 0 ) 
+        vm->zeroflag = true; 
+}
+
+static inline void op_prc(VMState *vm) {
+    /*
+    Read from a system process and store the output in memory
+    location of command on the stack
+    dst where to store output on the stack
+
+    @todo bad bytes \x00
+    @toto dynamic allocation
+    */
+
+    int dst = popv(vm); 
+    int commandString = popv(vm); 
+
+    struct node *cmd = find(vm->mem, commandString);
+
+    // the location is not terminated if it points into the mapped bootfile
+    char *command = (char *)malloc(cmd->len + 1);
+    memcpy(command, cmd->data, cmd->len);
+    command[cmd->len] = '\0';
+
+    FILE *f;
+    #ifdef _WIN32
+    f = _popen(command, "rt");            
+    #else
+    f = popen(command, "rt");
+    #endif
+    free(command);
+
+    char tmp[1024] = {0};
+    char output[1024*128] = {0};                   
+    while(fgets(tmp, 1024, f) != NULL) 
+        strcat(output, tmp);             
+    output[strlen(output)] = '\0';            
+    int dataLen = strlen(output);
+
+    // the memory location needs its own buffer, output lives on the stack
+    unsigned char *buffer = (unsigned char *)malloc(dataLen + 1);
+    memcpy(buffer, output, dataLen + 1);
+
+    memLock(vm);
+
+    insertFirst(vm->mem, dst, buffer, dataLen );              
+    if( config.bootfile && bootfilewriteable ) { 
+        persist(vm, find(vm->mem, dst));
+    }                                       
+    memUnlock(vm);
+
+    // @fix - 06.12.21 f**k, close the damn process at the end!
+    #ifdef _WIN32
+    _pclose(f);
+    #else
+    pclose(f);
+    #endif
+}
+
+static inline void op_si(VMState *vm) {
+    vm->regs[vm->reg1] = vm->pstack;
+}
+
+static inline void op_inc_mode(VMState *vm, int mode) {
+    if(mode == ARITH_CHAR || mode == ARITH_INT) {
+        vm->regs[vm->reg1] += 1;
+    }
+    else if(mode == ARITH_FLOAT) {
+        vm->fregs[vm->reg1] += 1.0f;
+    }
+    else {
+        vm->dregs[vm->reg1] += 1.0;
+    }
+}
+
+static inline void op_inc(VMState *vm) {
+    op_inc_mode(vm, vm->arith_mode);
+}
+
+static inline void op_dec_mode(VMState *vm, int mode) {
+    if(mode == ARITH_CHAR || mode == ARITH_INT) {
+        vm->regs[vm->reg1] -= 1;
+    }
+    else if(mode == ARITH_FLOAT) {
+        vm->fregs[vm->reg1] -= 1.0f;
+    }
+    else {
+        vm->dregs[vm->reg1] -= 1.0;
+    }
+}
+
+static inline void op_dec(VMState *vm) {
+    op_dec_mode(vm, vm->arith_mode);
+}
+
+static inline void op_call(VMState *vm) {
+    /* 
+    Call a label 
+    The return address get stored
+    */            
+    rpush(vm, vm->pc);
+    vm->pc = vm->value;
+    syncCheck(vm);
+}
+
+/*
+Superinstructions
+sequences the assembler fuses into one instruction (see Common.h), they leave registers, stack and
+modes exactly like the instructions they replace
+*/
+
+/* pop b, pop a, <op> a b, push a */
+static inline void op_sarith_mode(VMState *vm, int mode) {
+    int op = vm->value;
+    if(mode == ARITH_DOUBLE) {
+        vm->dregs[vm->reg2] = popDouble(vm);
+        vm->dregs[vm->reg1] = popDouble(vm);
+        switch(op) {
+            case ADD: op_add_mode(vm, mode); break;
+            case SUB: op_sub_mode(vm, mode); break;
+            case MUL: op_mul_mode(vm, mode); break;
+            case DIV: op_div_mode(vm, mode); break;
+            case MOD: op_mod_mode(vm, mode); break;
+        }
+        pushDouble(vm, vm->dregs[vm->reg1]);
+        vm->dregs[vm->reg1] = 0;
+        return;
+    }
+    vm->regs[vm->reg2] = popv(vm);
+    vm->regs[vm->reg1] = popv(vm);
+    switch(op) {
+        case ADD: op_add_mode(vm, mode); break;
+        case SUB: op_sub_mode(vm, mode); break;
+        case MUL: op_mul_mode(vm, mode); break;
+        case DIV: op_div_mode(vm, mode); break;
+        case MOD: op_mod_mode(vm, mode); break;
+    }
+    push(vm, vm->regs[vm->reg1]);
+    vm->regs[vm->reg1] = 0;
+}
+
+static inline void op_sarith(VMState *vm) {
+    op_sarith_mode(vm, vm->arith_mode);
+}
+
+/* push loc, push pos of LDMI and STMI, doubles in ARITH_DOUBLE mode like every push there */
+static inline void pushLocation(VMState *vm) {
+    if(vm->arith_mode == ARITH_DOUBLE) {
+        pushDouble(vm, vm->value);
+        pushDouble(vm, vm->reg1 << 8 | vm->reg2);
+        return;
+    }
+    push(vm, vm->value);
+    push(vm, vm->reg1 << 8 | vm->reg2);
+}
+
+/* push loc, push pos, ldm/stm */
+static inline void op_ldmi_mode(VMState *vm, int mode) {
+    pushLocation(vm);
+    op_ldm_mode(vm, mode);
+}
+
+static inline void op_ldmi(VMState *vm) {
+    op_ldmi_mode(vm, vm->memory_rw_mode);
+}
+
+static inline void op_stmi_mode(VMState *vm, int mode) {
+    pushLocation(vm);
+    op_stm_mode(vm, mode);
+}
+
+static inline void op_stmi(VMState *vm) {
+    op_stmi_mode(vm, vm->memory_rw_mode);
+}
+
+/* int 1/2 and int 9/10/11/22, 0 leaves a mode alone */
+static inline void op_modes(VMState *vm) {
+    if(vm->reg1 != 0)
+        vm->memory_rw_mode = vm->reg1 == 1 ? MEMORY_RW_CHAR : MEMORY_RW_INT;
+    if(vm->reg2 != 0)
+        vm->arith_mode = vm->reg2 == 9 ? ARITH_CHAR : vm->reg2 == 10 ? ARITH_INT : vm->reg2 == 11 ? ARITH_FLOAT : ARITH_DOUBLE;
+}
+
+/* a new vm with the program of vm */
+static VMState *vmChild(VMState *vm) {
+    VMState *child = vmCreate();
+    int n = vm->program.len + 1;
+    child->program.op = (unsigned char *)malloc(n);
+    child->program.dst = (unsigned char *)malloc(n);
+    child->program.src = (unsigned char *)malloc(n);
+    child->program.imm = (int *)malloc(n * sizeof(int));
+    memcpy(child->program.op, vm->program.op, n);
+    memcpy(child->program.dst, vm->program.dst, n);
+    memcpy(child->program.src, vm->program.src, n);
+    memcpy(child->program.imm, vm->program.imm, n * sizeof(int));
+    if(vm->program.modes != NULL) {
+        child->program.modes = (unsigned char *)malloc(n);
+        memcpy(child->program.modes, vm->program.modes, n);
+    }
+    child->program.len = vm->program.len;
+    child->jit = jitShare(vm->jit);
+    child->arith_mode = vm->arith_mode;
+    child->memory_rw_mode = vm->memory_rw_mode;
+    child->console.out = vm->console.out;
+    child->console.in = vm->console.in;
+    return child;
+}
+
+/* a child started by the program, returns the id int 14 joins it with */
+static int vmAdopt(VMState *vm, VMState *child) {
+    child->console.queueClosed = 1;
+    child->parent = vm;
+    if(vm->childCount == vm->childCap) {
+        vm->childCap = vm->childCap ? vm->childCap * 2 : 16;
+        vm->children = (VMState **)realloc(vm->children, vm->childCap * sizeof(VMState *));
+    }
+    vm->children[vm->childCount++] = child;
+    return vm->childCount;
+}
+
+/*
+int 13, spawn: run a label in a new vm
+    push <arguments>..
+    push <number of arguments>
+    push <label>
+    int 13
+the arguments are moved to the stack of the new vm, its id is pushed. the new vm shares the memory,
+it stops when the label returns (ret) and its result is the top of its stack
+*/
+void vmSpawn(VMState *vm) {
+    int label = popv(vm);
+    int argc = popv(vm);
+    if(argc < 0 || argc > vm->pstack || label < 0 || label >= vm->program.len) {
+        char dbg[128];
+        snprintf(dbg, sizeof(dbg), "\n[!!!!!] Bad spawn! pc: %d label: %d arguments: %d\n", vm->pc, label, argc);
+        vmFault(vm, dbg);
+    }
+    VMState *child = vmChild(vm);
+    memRelease(child->mem, child->reader);
+    child->reader = memRetain(vm->mem);
+    child->mem = vm->mem;
+    vm->pstack -= argc;
+    memcpy(child->stack, vm->stack + vm->pstack, argc * sizeof(int));
+    child->pstack = argc;
+    /* the return of the label goes to the END behind the program */
+    child->returnstack[0] = child->program.len;
+    child->rstack = 1;
+    child->pc = label;
+    child->running = 1;
+    if(!specialisedFor(child, label))
+        specialise(child, label);
+    push(vm, vmAdopt(vm, child));
+    schedulerSpawn(vm, child);
+}
+
+/*
+a copy of a vm that goes on where it is, with its registers, stacks, modes and console.
+the memory is forked (memFork()), both see the same locations until one of them writes
+*/
+VMState *vmFork(VMState *vm) {
+    VMState *child = vmChild(vm);
+    memRelease(child->mem, child->reader);
+    child->mem = memFork(vm->mem);
+    child->reader = memRetain(child->mem);
+    memcpy(child->regs, vm->regs, sizeof(vm->regs));
+    memcpy(child->dregs, vm->dregs, sizeof(vm->dregs));
+    memcpy(child->stack, vm->stack, vm->pstack * sizeof(int));
+    child->pstack = vm->pstack;
+    memcpy(child->returnstack, vm->returnstack, vm->rstack * sizeof(int));
+    child->rstack = vm->rstack;
+    child->pc = vm->pc;
+    child->zeroflag = vm->zeroflag;
+    child->running = vm->running;
+    child->faulted = vm->faulted;
+    return child;
+}
+
+/*
+int 21, fork: the program goes on behind the int twice, in this vm and in a forked one (vmFork()).
+the forked vm finds 0 on top of its stack, this one the id int 14 joins the forked vm with.
+the forked vm stops at END, its result is the top of its stack
+*/
+void vmForkInt(VMState *vm) {
+    push(vm, 0);
+    VMState *child = vmFork(vm);
+    vm->stack[vm->pstack - 1] = vmAdopt(vm, child);
+    schedulerSpawn(vm, child);
+}
+
+/*
+int 14, join: pop the id of a spawned vm, wait until it stops and push its result
+the output it collected (vmSetOutput(vm, NULL)) is appended to the output of this vm
+*/
+void vmJoin(VMState *vm) {
+    int id = popv(vm);
+    VMState *child = id >= 1 && id <= vm->childCount ? vm->children[id - 1] : NULL;
+    if(child == NULL) {
+        char dbg[128];
+        snprintf(dbg, sizeof(dbg), "\n[!!!!!] Join of an unknown vm! pc: %d id: %d\n", vm->pc, id);
+        vmFault(vm, dbg);
+    }
+    if(!schedulerJoin(vm, child)) {
+        push(vm, id);
+        vm->joining = child;
+        vmBlock(vm);
+        return;
+    }
+    vm->joining = NULL;
+    vm->children[id - 1] = NULL;
+    int len;
+    const char *out = consoleCollected(&child->console, &len);
+    if(len > 0)
+        consoleWrite(&vm->console, out, len);
+    push(vm, !child->faulted && child->pstack > 0 ? child->stack[child->pstack - 1] : 0);
+    vmDestroy(child);
+}
+
+/*
+Atomic memory cells, int 16..19
+a cell is an int at a position of a location that is a multiple of 4, addressed like ldm/stm.
+vms sharing the memory see every operation on a cell at once, cas sets the zeroflag if it swapped
+    int 16, load:       push loc, push pos                              -> the value
+    int 17, store:      push value, push loc, push pos
+    int 18, fetch-add:  push delta, push loc, push pos                  -> the value before
+    int 19, cas:        push expected, push new, push loc, push pos     -> the value before
+*/
+
+/* enter the cell of an atomic instruction, its location isn't copied until atomicDone() */
+static struct node *atomicCell(VMState *vm, int loc, int pos) {
+    memRead(vm);
+    while(1) {
+        struct node *n = find(vm->mem, loc);
+        if(n == NULL || pos < 0 || pos > n->len - (int)sizeof(int) || pos % sizeof(int) != 0) {
+            char dbg[128];
+            snprintf(dbg, sizeof(dbg), "\n[!!!!!] Bad atomic cell! pc: %d loc: %d pos: %d\n", vm->pc, loc, pos);
+            vmFault(vm, dbg);
+        }
+        if(n->mapped || memForked(n)) {
+            /* mappings are read-only and forked stores share the node, the location gets its own copy first */
+            memLock(vm);
+            n = find(vm->mem, loc);
+            if(!vm->mem->shared) memWritable(vm->mem, n);
+            else if(n->mapped || memForked(n)) memPut(vm->mem, memCopy(vm->mem, n, n->len));
+            memUnlock(vm);
+            continue;
+        }
+        if(!vm->mem->shared)
+            return n;
+        __atomic_add_fetch(&n->busy, 1, __ATOMIC_SEQ_CST);
+        if(!__atomic_load_n(&n->sealed, __ATOMIC_SEQ_CST))
+            return n;
+        /* a copy replaces it, wait until it is published. still there, a forked store sealed it */
+        __atomic_sub_fetch(&n->busy, 1, __ATOMIC_SEQ_CST);
+        memLock(vm);
+        if(find(vm->mem, loc) == n)
+            memPut(vm->mem, memCopy(vm->mem, n, n->len));
+        memUnlock(vm);
+    }
+}
+
+static void atomicDone(VMState *vm, struct node *n, int loc, int changed) {
+    if(vm->mem->shared)
+        __atomic_sub_fetch(&n->busy, 1, __ATOMIC_SEQ_CST);
+    if(changed && config.bootfile && config.writeable)
+        persist(vm, find(vm->mem, loc));
+    memReadDone(vm);
+}
+
+void vmAtomic(VMState *vm, int code) {
+    int pos = popv(vm);
+    int loc = popv(vm);
+    int val = code != 16 ? popv(vm) : 0;
+    int expected = code == 19 ? popv(vm) : 0;
+    struct node *n = atomicCell(vm, loc, pos);
+    int *cell = (int *)&n->data[pos];
+    int old = 0, changed = 1;
+    switch(code) {
+        case 16:
+            old = __atomic_load_n(cell, __ATOMIC_SEQ_CST);
+            changed = 0;
             break;
-		}                
-        case LT: {
-            /*
-            push 2
-            push 1
-            lt --> z = true
-            */
-            int a = popv();
-            int b = popv();
-            zeroflag = false;
-            if(a < b) zeroflag = true;
-			break;
-		}          
-        case GT: {
-            /*
-            push 1
-            push 2
-            gt --> z = true
-            */
-            int a = popv();
-            int b = popv();
-            zeroflag = false;
-            if(a > b) zeroflag = true;
-			break;
-		}                 
-        case LEQ: {
-            /*
-            push 2
-            push 1
-            leq --> zero = true
-            */
-            int a = popv();
-            int b = popv();
-            zeroflag = false;
-            if(a <= b) zeroflag = true;
+        case 17:
+            __atomic_store_n(cell, val, __ATOMIC_SEQ_CST);
             break;
-		}                
-        case GEQ: {
-			/*
-            push 1
-            push 2
-            geq --> zero = true
-            */
-            int a = popv();
-            int b = popv();
-            zeroflag = false;
-            if(a >= b) zeroflag = true;
+        case 18:
+            old = __atomic_fetch_add(cell, val, __ATOMIC_SEQ_CST);
             break;
-		}
-        case RET: {
-            pc = rpopv();
-			break;
-		}		
-		case PRINT: {
-        
-            char fmt = popv();
-            char s[] = "%";
-            sprintf(s, "%s%c", s, fmt);
-            if(arith_mode == ARITH_CHAR) {
-                char i;
-                memcpy(&i, &stack[--pstack], 1);
-                printf(s, i);
-			}
-            else if(arith_mode == ARITH_INT) {
-                int i;
-                memcpy(&i, &stack[--pstack], 4);
-                printf(s, i);
-			}
-            else if(arith_mode == ARITH_FLOAT) {
-                float f;
-                memcpy(&f, &stack[--pstack], 4);
-                printf(s, f);
-			}
-            
+        case 19:
+            old = expected;
+            changed = __atomic_compare_exchange_n(cell, &old, val, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+            vm->zeroflag = changed;
             break;
-		}       
-        case PRINTC: {
-            printf("%c", (char)popv());
-			break;
-		}                
-        case READ: {
-            /*
-            Read a line from stdin
-            replace \x0A at the end by \0x00
-            */ 
-                             
-            int index = popv();
-            char tmp[1024] = {0};
-            fgets(tmp, 1024, stdin); 
-            tmp[strlen(tmp)-1] = '\0'; // -1 to remove 0xA on end                              
-            int dataLen = strlen(tmp);                        
-            struct node *foundLink = find(index);
-            if(foundLink != NULL) {
-                deleteNode(index);
-                if( config.bootfile && bootfilewriteable ) {
-                    deleteFile(config.bootfile, index);
-                }
-            } 
-            // add \x00 at the end            
-            char *newstr = (char *)malloc(dataLen + 1);  
-            int i = 0; 
-            while(i < dataLen) { 
-                newstr[i] = tmp[i]; 
-                i++; 
-            }
-            newstr[i] = '\0'; // \x00 to mark the end       
-            insertFirst(index, newstr, dataLen + 1);                    
-            if( config.bootfile && bootfilewriteable ) { 
-                createFile(config.bootfile, index, newstr, dataLen + 1);                        
-            }            
-            // push the length onto the stack afterward?
-            // push(dataLen); 
-            
+    }
+    atomicDone(vm, n, loc, changed);
+    if(code != 17)
+        push(vm, old);
+}
+
+#include "Snapshot.h"
+#include "Vector.h"
+
+static inline void op_vec(VMState *vm) {
+    /*
+    vadd, vsub, vmul, vdiv, vscale, vdot, vsum, vmin, vmax
+    the operation is the value, the locations are on the stack (Vector.h)
+    */
+    vmVector(vm, vm->value);
+}
+
+static inline void op_int(VMState *vm) {
+    /* 
+    interrupt call
+    */
+    int r;  
+
+    if(vm->reg1 != 0)                             
+        r = vm->regs[vm->reg1];                               
+    else                            
+        r = vm->value;
+
+    switch(r) {
+
+        // R/W single bytes to/from memory
+        case 1:
+            vm->memory_rw_mode = MEMORY_RW_CHAR;
+            break;
+
+        // R/W 4 bytes at once from/to memory
+        case 2:
+            vm->memory_rw_mode = MEMORY_RW_INT;
+            break;
+
+        case 3:
+            stackDump(vm);
+            break;
+        case 4:
+            memLock(vm);
+            memDump(vm);
+            memUnlock(vm);
+            break;
+        case 5:
+            regDump(vm);
             break;                
-        }       
-        case WRITE: {     
-            /*
-            Print a memory location as characters to screen
-            the location is on the stack
-            printf with the string formatter stops at \x00 characters so we print each character in a loop
-            */ 
-            
-            int index = popv();
-            struct node *foundLink = find(index);
-            char *str = foundLink->data;
-            str[foundLink->len] = '\0';
-            // printf("%s", str); 
-            for(int i = 0; i < foundLink->len; i++) 
-                printf("%c", str[i]); 
-                       
+
+        case 9:
+            vm->arith_mode = ARITH_CHAR;
             break;
-		}        
-        case PUTS: {       
-            /*
-            Put data from the stack into memory
-            all the data on the stack
-            data length on the stack
-            memory location on the stack
-            
-            @fix 3.12.21 - added switch to write char or int data            
-            @fix 4.12.21 - using memcpy to fix overwriting other entries
-            */
-            
-            if(memory_rw_mode == MEMORY_RW_CHAR) {
-            
-                int index = popv();
-                int len = popv(); 
-                                      
-                char tmp[len];
-                int i = 0;            
-                while(i < len) 
-                    tmp[i++] = popv();
-                                                            
-                struct node *foundLink = find(index);
-                if(foundLink != NULL) {
-                    deleteNode(index);
-                    if( config.bootfile && bootfilewriteable ) {
-                        deleteFile(config.bootfile, index);
-                    }
-                }
-                
-                unsigned char *buffer = (unsigned char *)malloc(len);
-                memcpy(buffer, &tmp, len);
-                            
-                insertFirst(index, buffer, i);                    
-                if( config.bootfile && bootfilewriteable ) { 
-                    createFile(config.bootfile, index, buffer, len);
-                }  
-                              
-            }
-            
-            else if(memory_rw_mode == MEMORY_RW_INT) {
-            
-                int index = popv();
-                int len = popv(); 
-                                                                  
-                int tmp[len];
-                int i = 0;            
-                while(i < len)
-                    tmp[i++] = popv();
-                                                                                             
-                struct node *foundLink = find(index);
-                if(foundLink != NULL) {
-                    deleteNode(index);
-                    if( config.bootfile && bootfilewriteable ) {
-                        deleteFile(config.bootfile, index);
-                    }
-                } 
-                                          
-                unsigned char *buffer = (unsigned char *)malloc(len * sizeof(int));
-                memcpy(buffer, &tmp, sizeof(int) * len);                
-                
-                insertFirst(index, buffer, len * 4);
-                if( config.bootfile && bootfilewriteable ) { 
-                    createFile(config.bootfile, index, (unsigned char *)tmp, len * 4);
-                } 
-                 
-            }
-                                       
+        case 10:
+            vm->arith_mode = ARITH_INT;
             break;
-        }
-        case GETS: {       
-            /*
-            Get data from memory onto the stack
-            memory location is on the stack
-            
-            @fix 3.13.21 - added switch to read char or int
-            */
-            
-            if(memory_rw_mode == MEMORY_RW_CHAR) {
-                
-                int index = popv();
-                
-                struct node *foundLink = find(index);
-                int dataLen = foundLink->len;
-                
-                while(dataLen > 0) { 
-                    push(foundLink->data[--dataLen]);                               
-                }
-                
-            }
-            
-            else if(memory_rw_mode == MEMORY_RW_INT) {
-            
-                int index = popv();
-                
-                struct node *foundLink = find(index);
-                int dataLen = foundLink->len;
-                
-                int i = 0;
-                while(dataLen > 0) {                     
-                    dataLen -= 4;
-                    memcpy(&i, &foundLink->data[dataLen], sizeof(int));
-                    push(i);                                                   
-                }
-                
-            }
-            
+        case 11:
+            vm->arith_mode = ARITH_FLOAT;
             break;
-        }       
-        case READC: {                  
-            /* 
-            Read a char from stdin 
-            */
-            
-            int ch;
-            #ifdef _WIN32
-            ch = getch();
-            #else
-            ch = getchar();
-            #endif
-            push(ch);
-            
+
+        // flush pending console output and bootfile writes
+        case 12:
+            vmSync(vm);
             break;
-		}        
-        case CMP: {
-            int src = popv();
-            int dst = popv();
-            struct node *first = find(src);
-            struct node *second = find(dst);
-            zeroflag = false;
-            if(first->len != second->len) { 
-                zeroflag = false; 
-                break; 
-            }
-            if( memcmp(first->data, second->data, first->len) == 0 ) 
-                zeroflag = true; 
-            break;           
-		}
-        case PRC: {
-            /*
-            Read from a system process and store the output in memory
-            location of command on the stack
-            dst where to store output on the stack
-            
-            @todo bad bytes \x00
-            @toto dynamic allocation
-            */
-                                    
-            int dst = popv(); 
-            int commandString = popv(); 
-                        
-            struct node *cmd = find(commandString);
-                        
-            FILE *f;
-            #ifdef _WIN32
-            f = _popen(cmd->data, "rt");            
-            #else
-            f = popen(cmd->data, "rt");
-            #endif
-
-            char tmp[1024] = {0};
-            char output[1024*128] = {0};                   
-            while(fgets(tmp, 1024, f) != NULL) 
-                strcat(output, tmp);             
-            output[strlen(output)] = '\0';            
-            int dataLen = strlen(output);
-            
-            deleteNode(dst);
-            if( config.bootfile && bootfilewriteable ) {
-                deleteFile(config.bootfile, dst);
-            }
-           
-            insertFirst(dst, output, dataLen );              
-            if( config.bootfile && bootfilewriteable ) { 
-                createFile(config.bootfile, dst, output, dataLen );
-            }                                       
-
-            // @fix - 06.12.21 f**k, close the damn process at the end!
-            #ifdef _WIN32
-            _pclose(f);
-            #else
-            pclose(f);
-            #endif
-            
+
+        // run a label in a new vm with the top arguments of the stack, see vmSpawn()
+        case 13:
+            vmSpawn(vm);
             break;
-                       
-		}
-        case SI: {
-            regs[reg1] = pstack;
+
+        // wait for a spawned vm and push its result
+        case 14:
+            vmJoin(vm);
             break;
-        }
-        case INC: {
-            if(arith_mode == ARITH_CHAR || arith_mode == ARITH_INT) {
-                regs[reg1] += 1;
-            }
-            else {
-                float f; 
-                memcpy(&f, &regs[reg1], 4); // = regs[reg1];
-                f += 1.0f;
-                //printf("<INC f=%f>", f);
-                memcpy(&regs[reg1], &f, 4);
-            }
+
+        // end the time slice, let the other vms run
+        case 15:
+            vm->limit = vm->steps;
             break;
-        }
-        case DEC: {
-            if(arith_mode == ARITH_CHAR || arith_mode == ARITH_INT) {
-                regs[reg1] -= 1;
-            }
-            else {
-                float f; 
-                memcpy(&f, &regs[reg1], 4); // = regs[reg1];
-                f -= 1.0f;
-                //printf("<DEC f=%f>", f);
-                memcpy(&regs[reg1], &f, 4);
-            }
+
+        // atomic load, store, fetch-add and compare-and-swap of a memory cell, see vmAtomic()
+        case 16:
+        case 17:
+        case 18:
+        case 19:
+            vmAtomic(vm, r);
+            break;
+
+        // write a snapshot to the file named by a memory location, see Snapshot.h
+        case 20:
+            vmSnapshotInt(vm);
+            break;
+
+        // fork, go on in a new vm with a copy on write of the memory, see vmForkInt()
+        case 21:
+            vmForkInt(vm);
+            break;
+
+        // 64 bit doubles in their own registers
+        case 22:
+            vm->arith_mode = ARITH_DOUBLE;
+            break;
+
+        // convert the top of the stack: int to float, float to int, int to double (two words), double to int
+        case 23: {
+            float f = (float)popv(vm);
+            int bits;
+            memcpy(&bits, &f, sizeof(bits));
+            push(vm, bits);
             break;
         }
-        case CALL: {
-            /* 
-            Call a label 
-            The return address get stored
-            */            
-            rpush(pc);
-            pc = value * 2;
+        case 24: {
+            int bits = popv(vm);
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            push(vm, (int)f);
             break;
         }
-        case INT: {
-            /* 
-            interrupt call
-            */
-            int r;  
-                      
-            if(reg1 != 0)                             
-                r = regs[reg1];                               
-            else                            
-                r = value;
-                                                 
-            switch(r) {
-            
-                // R/W single bytes to/from memory
-                case 1:
-                    memory_rw_mode = MEMORY_RW_CHAR;
-                    break;
-                    
-                // R/W 4 bytes at once from/to memory
-                case 2:
-                    memory_rw_mode = MEMORY_RW_INT;
-                    break;
-                    
-                case 3:
-                    stackDump();
-                    break;
-                case 4:
-                    memDump();
-                    break;
-                case 5:
-                    regDump();
-                    break;                
-                
-                case 9:
-                    arith_mode = ARITH_CHAR;
-                    break;
-                case 10:
-                    arith_mode = ARITH_INT;
-                    break;
-                case 11:
-                    arith_mode = ARITH_FLOAT;
-                    break;
-                    
-                default:
-                    break;  
-                      
-            }
-            
+        case 25:
+            pushDouble(vm, (double)popv(vm));
             break;
-        }		
+        case 26:
+            push(vm, (int)popDouble(vm));
+            break;
+
+        default:
+            break;  
+
+    }
+}
+
+/* an instruction on memory that may be shared with spawned vms */
+#define READING(fn) do { memRead(vm); fn(vm); memReadDone(vm); } while(0)
+
+/* the specialised opcodes of an instruction, see specialise() */
+#define BY_ARITH(op, fn) \
+        case op##_CHAR: fn(vm, ARITH_CHAR); break; \
+        case op##_INT: fn(vm, ARITH_INT); break; \
+        case op##_FLOAT: fn(vm, ARITH_FLOAT); break; \
+        case op##_DOUBLE: fn(vm, ARITH_DOUBLE); break;
+#define BY_MEMORY(op, fn) \
+        case op##_CHAR: memRead(vm); fn(vm, MEMORY_RW_CHAR); memReadDone(vm); break; \
+        case op##_INT: memRead(vm); fn(vm, MEMORY_RW_INT); memReadDone(vm); break;
+
+void eval(VMState *vm) {
+
+    if(debug) {
+        consolePrintf(&vm->console, "rs: %d, ps %d, pc: %d\t| ins: %d, r1: %d, r2: %d, val: %d\n", vm->rstack, vm->pstack, vm->pc, opGeneric(vm->instrNum), vm->reg1, vm->reg2, vm->value); 
+    }
+    
+	switch(vm->instrNum) {
+        case END: op_end(vm); break;
+        case MOV: op_mov(vm); break;
+        case PUSH: op_push(vm); break;
+        case POP: op_pop(vm); break;
+        case LDR: op_ldr(vm); break;
+        case STR: op_str(vm); break;
+        case LDM: READING(op_ldm); break;
+        case STM: READING(op_stm); break;
+        case LDMR: READING(op_ldmr); break;
+        case STMR: READING(op_stmr); break;
+        case ADD: op_add(vm); break;
+        case SUB: op_sub(vm); break;
+        case MUL: op_mul(vm); break;
+        case DIV: op_div(vm); break;
+        case MOD: op_mod(vm); break;
+        case JMP: op_jmp(vm); break;
+        case JZ: op_jz(vm); break;
+        case JNZ: op_jnz(vm); break;
+        case EQ: op_eq(vm); break;
+        case LT: op_lt(vm); break;
+        case GT: op_gt(vm); break;
+        case LEQ: op_leq(vm); break;
+        case GEQ: op_geq(vm); break;
+        case RET: op_ret(vm); break;
+        case PRINT: op_print(vm); break;
+        case PRINTC: op_printc(vm); break;
+        case READ: op_read(vm); break;
+        case WRITE: READING(op_write); break;
+        case PUTS: READING(op_puts); break;
+        case GETS: READING(op_gets); break;
+        case READC: op_readc(vm); break;
+        case CMP: READING(op_cmp); break;
+        case PRC: READING(op_prc); break;
+        case SI: op_si(vm); break;
+        case INC: op_inc(vm); break;
+        case DEC: op_dec(vm); break;
+        case CALL: op_call(vm); break;
+        case INT: op_int(vm); break;
+        case SARITH: op_sarith(vm); break;
+        case LDMI: READING(op_ldmi); break;
+        case STMI: READING(op_stmi); break;
+        case MODES: op_modes(vm); break;
+        case VEC: READING(op_vec); break;
+        BY_ARITH(ADD, op_add_mode)
+        BY_ARITH(SUB, op_sub_mode)
+        BY_ARITH(MUL, op_mul_mode)
+        BY_ARITH(DIV, op_div_mode)
+        BY_ARITH(MOD, op_mod_mode)
+        BY_ARITH(INC, op_inc_mode)
+        BY_ARITH(DEC, op_dec_mode)
+        BY_ARITH(PRINT, op_print_mode)
+        BY_ARITH(SARITH, op_sarith_mode)
+        BY_ARITH(MOV, op_mov_mode)
+        BY_ARITH(PUSH, op_push_mode)
+        BY_ARITH(POP, op_pop_mode)
+        BY_ARITH(LDR, op_ldr_mode)
+        BY_MEMORY(LDM, op_ldm_mode)
+        BY_MEMORY(STM, op_stm_mode)
+        BY_MEMORY(PUTS, op_puts_mode)
+        BY_MEMORY(GETS, op_gets_mode)
+        BY_MEMORY(LDMI, op_ldmi_mode)
+        BY_MEMORY(STMI, op_stmi_mode)
 		default: {
-			printf("[kern] bad instruction '%d' at pc '%d'\n", instrNum, pc);
+			consolePrintf(&vm->console, "[kern] bad instruction '%d' at pc '%d'\n", vm->instrNum, vm->pc);
             break;
         }           
 	}
    
 }
 
-void run() {
-    running = 1;
-	int instr;
-	while(running) { 
-		fetch(&instr);
-		decode(instr);
-		eval();
-	}
-    running = false; 
-}
-
-void translateOpCode(char *token) {
-    if(strcmp(token, "eof") == 0) instrNum = EOF;
-    else if(strcmp(token, "mov") == 0) instrNum = MOV;  
-    else if(strcmp(token, "push") == 0) instrNum = PUSH; 
-    else if(strcmp(token, "pop") == 0) instrNum = POP; 
-    else if(strcmp(token, "ldr") == 0) instrNum = LDR; 
-    else if(strcmp(token, "str") == 0) instrNum = STR; 
-    else if(strcmp(token, "ldm") == 0) instrNum = LDM; 
-    else if(strcmp(token, "stm") == 0) instrNum = STM;
-    else if(strcmp(token, "ldmr") == 0) instrNum = LDMR; 
-    else if(strcmp(token, "stmr") == 0) instrNum = STMR; 
-    else if(strcmp(token, "add") == 0) instrNum = ADD; 
-    else if(strcmp(token, "addi") == 0) instrNum = ADDI; 
-    else if(strcmp(token, "sub") == 0) instrNum = SUB; 
-    else if(strcmp(token, "mul") == 0) instrNum = MUL; 
-    else if(strcmp(token, "div") == 0) instrNum = DIV;  
-    else if(strcmp(token, "mod") == 0) instrNum = MOD; 
-    else if(strcmp(token, "eq") == 0) instrNum = EQ; 
-    else if(strcmp(token, "lt") == 0) instrNum = LT;  
-    else if(strcmp(token, "gt") == 0) instrNum = GT; 
-    else if(strcmp(token, "leq") == 0) instrNum = LEQ; 
-    else if(strcmp(token, "geq") == 0) instrNum = GEQ; 
-    else if(strcmp(token, "jmp") == 0) instrNum = JMP; 
-    else if(strcmp(token, "jz") == 0) instrNum = JZ; 
-    else if(strcmp(token, "jnz") == 0) instrNum = JNZ; 
-    else if(strcmp(token, "ret") == 0) instrNum = RET; 
-    else if(strcmp(token, "print") == 0) instrNum = PRINT;  
-    else if(strcmp(token, "printc") == 0) instrNum = PRINTC;  
-    else if(strcmp(token, "read") == 0) instrNum = READ;  
-    else if(strcmp(token, "write") == 0) instrNum = WRITE;  
-    else if(strcmp(token, "puts") == 0) instrNum = PUTS; 
-    else if(strcmp(token, "gets") == 0) instrNum = GETS; 
-    else if(strcmp(token, "readc") == 0) instrNum = READC; 
-    else if(strcmp(token, "cmp") == 0) instrNum = CMP; 
-    else if(strcmp(token, "prc") == 0) instrNum = PRC;
-    else if(strcmp(token, "si") == 0) instrNum = SI;
-    else if(strcmp(token, "inc") == 0) instrNum = INC;
-    else if(strcmp(token, "dec") == 0) instrNum = DEC;
-    else if(strcmp(token, "int") == 0) instrNum = INT;
-}
-
-int translateReg1(char *token) {
-    if(strcmp(token, "ax") == 0) reg1 = 1; 
-    else if(strcmp(token, "bx") == 0) reg1 = 2; 
-    else if(strcmp(token, "cx") == 0) reg1 = 3; 
-    else if(strcmp(token, "dx") == 0) reg1 = 4; 
-    else if(strcmp(token, "r1") == 0) reg1 = 5;
-    else if(strcmp(token, "r2") == 0) reg1 = 6;
-    else if(strcmp(token, "r3") == 0) reg1 = 7;
-    else if(strcmp(token, "r4") == 0) reg1 = 8;
-    else if(strcmp(token, "r5") == 0) reg1 = 9;
-    else if(strcmp(token, "r6") == 0) reg1 = 10;
-    else if(strcmp(token, "r7") == 0) reg1 = 11;
-    else if(strcmp(token, "r8") == 0) reg1 = 12;
-    else if(strcmp(token, "r9") == 0) reg1 = 13;
-    else if(strcmp(token, "r10") == 0) reg1 = 14;
-    else {
-        value = atoi(token) ? atoi(token) : 0;
-        reg1 = 0;
-    }
-    return reg1;
-}
-
-int translateReg2(char *token) {
-    if(strcmp(token, "ax") == 0) reg2 = 1; 
-    else if(strcmp(token, "bx") == 0) reg2 = 2; 
-    else if(strcmp(token, "cx") == 0) reg2 = 3; 
-    else if(strcmp(token, "dx") == 0) reg2 = 4; 
-    else if(strcmp(token, "r1") == 0) reg2 = 5;
-    else if(strcmp(token, "r2") == 0) reg2 = 6;
-    else if(strcmp(token, "r3") == 0) reg2 = 7;
-    else if(strcmp(token, "r4") == 0) reg2 = 8;
-    else if(strcmp(token, "r5") == 0) reg2 = 9;
-    else if(strcmp(token, "r6") == 0) reg2 = 10;
-    else if(strcmp(token, "r7") == 0) reg2 = 11;
-    else if(strcmp(token, "r8") == 0) reg2 = 12;
-    else if(strcmp(token, "r9") == 0) reg2 = 13;
-    else if(strcmp(token, "r10") == 0) reg2 = 14;
-    else {
-        value = atoi(token) ? atoi(token) : 0;
-        reg2 = 0;
+/*
+Threaded dispatch
+every instruction of the decoded program gets the address of its handler label (computed goto with 
+GCC/clang), so each handler jumps straight to the next one instead of going through the switch in eval(). 
+Other compilers run a plain switch over the decoded program. Enabled with -t, debug output always uses 
+the classic loop. Under runJit() it runs the untranslated code and returns after a jump, call or ret that 
+reaches native code.
+*/
+
+#if defined(__GNUC__)
+#define THREADED_GOTO
+#endif
+
+void runThreaded(VMState *vm) {
+
+#ifdef THREADED_GOTO
+
+    #define LABELS_ARITH(op) [op##_CHAR] = &&L_##op##_CHAR, [op##_INT] = &&L_##op##_INT, [op##_FLOAT] = &&L_##op##_FLOAT, [op##_DOUBLE] = &&L_##op##_DOUBLE
+    #define LABELS_MEMORY(op) [op##_CHAR] = &&L_##op##_CHAR, [op##_INT] = &&L_##op##_INT
+
+    static void *labels[] = {
+        [END] = &&L_END, [MOV] = &&L_MOV, [PUSH] = &&L_PUSH, [POP] = &&L_POP, [LDR] = &&L_LDR, [STR] = &&L_STR, 
+        [LDM] = &&L_LDM, [STM] = &&L_STM, [LDMR] = &&L_LDMR, [STMR] = &&L_STMR, [ADD] = &&L_ADD, [SUB] = &&L_SUB, 
+        [MUL] = &&L_MUL, [DIV] = &&L_DIV, [MOD] = &&L_MOD, [EQ] = &&L_EQ, [LT] = &&L_LT, [GT] = &&L_GT, 
+        [LEQ] = &&L_LEQ, [GEQ] = &&L_GEQ, [JMP] = &&L_JMP, [JZ] = &&L_JZ, [JNZ] = &&L_JNZ, [RET] = &&L_RET, 
+        [PRINT] = &&L_PRINT, [PRINTC] = &&L_PRINTC, [READ] = &&L_READ, [WRITE] = &&L_WRITE, [PUTS] = &&L_PUTS, 
+        [GETS] = &&L_GETS, [READC] = &&L_READC, [CMP] = &&L_CMP, [PRC] = &&L_PRC, [SI] = &&L_SI, [INC] = &&L_INC, 
+        [DEC] = &&L_DEC, [CALL] = &&L_CALL, [INT] = &&L_INT, [SARITH] = &&L_SARITH, [LDMI] = &&L_LDMI, 
+        [STMI] = &&L_STMI, [MODES] = &&L_MODES, [VEC] = &&L_VEC, 
+        LABELS_ARITH(ADD), LABELS_ARITH(SUB), LABELS_ARITH(MUL), LABELS_ARITH(DIV), LABELS_ARITH(MOD), 
+        LABELS_ARITH(INC), LABELS_ARITH(DEC), LABELS_ARITH(PRINT), LABELS_ARITH(SARITH), 
+        LABELS_ARITH(MOV), LABELS_ARITH(PUSH), LABELS_ARITH(POP), LABELS_ARITH(LDR), 
+        LABELS_MEMORY(LDM), LABELS_MEMORY(STM), LABELS_MEMORY(PUTS), LABELS_MEMORY(GETS), 
+        LABELS_MEMORY(LDMI), LABELS_MEMORY(STMI)
+    };
+    
+    /* the handler of every instruction, including the trailing END, kept until the next program is loaded */
+    /* counting hot jumps and calls for runJit() */
+    bool jitted = vm->jit != NULL;
+    void **handlers = vm->handlers;
+    if(handlers == NULL) {
+        handlers = vm->handlers = (void **)malloc((vm->program.len + 1) * sizeof(void *));
+        for(int i = 0; i <= vm->program.len; i++) {
+            int op = vm->program.op[i];
+            if(op < (int)(sizeof(labels) / sizeof(labels[0])) && labels[op] != NULL)
+                handlers[i] = labels[op];
+            else 
+                handlers[i] = &&L_BAD;
+        }
     }
-    return reg2;
+
+    #define DISPATCH() do { if(vm->steps == vm->limit) goto L_STOP; vm->steps++; vm->instrNum = vm->program.op[vm->pc]; vm->reg1 = vm->program.dst[vm->pc]; vm->reg2 = vm->program.src[vm->pc]; vm->value = vm->program.imm[vm->pc]; goto *handlers[vm->pc++]; } while(0)
+    #define HANDLER(op, fn) L_##op: fn(vm); DISPATCH();
+    #define HANDLER_JUMP(op, fn) L_##op: { int at = vm->pc - 1; fn(vm); if(jitted && jitJumped(vm, at)) goto L_STOP; } DISPATCH();
+    #define HANDLER_READING(op, fn) L_##op: memRead(vm); fn(vm); memReadDone(vm); DISPATCH();
+    #define HANDLER_ARITH(op, fn) \
+        L_##op##_CHAR: fn(vm, ARITH_CHAR); DISPATCH(); \
+        L_##op##_INT: fn(vm, ARITH_INT); DISPATCH(); \
+        L_##op##_FLOAT: fn(vm, ARITH_FLOAT); DISPATCH(); \
+        L_##op##_DOUBLE: fn(vm, ARITH_DOUBLE); DISPATCH();
+    #define HANDLER_MEMORY(op, fn) \
+        L_##op##_CHAR: memRead(vm); fn(vm, MEMORY_RW_CHAR); memReadDone(vm); DISPATCH(); \
+        L_##op##_INT: memRead(vm); fn(vm, MEMORY_RW_INT); memReadDone(vm); DISPATCH();
+    
+    DISPATCH();
+    
+    HANDLER(MOV, op_mov)
+    HANDLER(PUSH, op_push)
+    HANDLER(POP, op_pop)
+    HANDLER(LDR, op_ldr)
+    HANDLER(STR, op_str)
+    HANDLER_READING(LDM, op_ldm)
+    HANDLER_READING(STM, op_stm)
+    HANDLER_READING(LDMR, op_ldmr)
+    HANDLER_READING(STMR, op_stmr)
+    HANDLER(ADD, op_add)
+    HANDLER(SUB, op_sub)
+    HANDLER(MUL, op_mul)
+    HANDLER(DIV, op_div)
+    HANDLER(MOD, op_mod)
+    HANDLER(EQ, op_eq)
+    HANDLER(LT, op_lt)
+    HANDLER(GT, op_gt)
+    HANDLER(LEQ, op_leq)
+    HANDLER(GEQ, op_geq)
+    HANDLER_JUMP(JMP, op_jmp)
+    HANDLER_JUMP(JZ, op_jz)
+    HANDLER_JUMP(JNZ, op_jnz)
+    HANDLER_JUMP(RET, op_ret)
+    HANDLER(PRINT, op_print)
+    HANDLER(PRINTC, op_printc)
+    HANDLER(READ, op_read)
+    HANDLER_READING(WRITE, op_write)
+    HANDLER_READING(PUTS, op_puts)
+    HANDLER_READING(GETS, op_gets)
+    HANDLER(READC, op_readc)
+    HANDLER_READING(CMP, op_cmp)
+    HANDLER_READING(PRC, op_prc)
+    HANDLER(SI, op_si)
+    HANDLER(INC, op_inc)
+    HANDLER(DEC, op_dec)
+    HANDLER_JUMP(CALL, op_call)
+    HANDLER(INT, op_int)
+    HANDLER(SARITH, op_sarith)
+    HANDLER_READING(LDMI, op_ldmi)
+    HANDLER_READING(STMI, op_stmi)
+    HANDLER(MODES, op_modes)
+    HANDLER_READING(VEC, op_vec)
+    HANDLER_ARITH(ADD, op_add_mode)
+    HANDLER_ARITH(SUB, op_sub_mode)
+    HANDLER_ARITH(MUL, op_mul_mode)
+    HANDLER_ARITH(DIV, op_div_mode)
+    HANDLER_ARITH(MOD, op_mod_mode)
+    HANDLER_ARITH(INC, op_inc_mode)
+    HANDLER_ARITH(DEC, op_dec_mode)
+    HANDLER_ARITH(PRINT, op_print_mode)
+    HANDLER_ARITH(SARITH, op_sarith_mode)
+    HANDLER_ARITH(MOV, op_mov_mode)
+    HANDLER_ARITH(PUSH, op_push_mode)
+    HANDLER_ARITH(POP, op_pop_mode)
+    HANDLER_ARITH(LDR, op_ldr_mode)
+    HANDLER_MEMORY(LDM, op_ldm_mode)
+    HANDLER_MEMORY(STM, op_stm_mode)
+    HANDLER_MEMORY(PUTS, op_puts_mode)
+    HANDLER_MEMORY(GETS, op_gets_mode)
+    HANDLER_MEMORY(LDMI, op_ldmi_mode)
+    HANDLER_MEMORY(STMI, op_stmi_mode)
+    
+    L_BAD:
+        consolePrintf(&vm->console, "[kern] bad instruction '%d' at pc '%d'\n", vm->instrNum, vm->pc);
+        DISPATCH();
+    
+    L_END:
+        op_end(vm);
+    
+    L_STOP:
+    
+    #undef HANDLER
+    #undef HANDLER_JUMP
+    #undef HANDLER_READING
+    #undef HANDLER_ARITH
+    #undef HANDLER_MEMORY
+    #undef LABELS_ARITH
+    #undef LABELS_MEMORY
+    #undef DISPATCH
+    
+#else
+
+    while(vm->running && vm->steps != vm->limit) {
+        vm->steps++;
+        vm->instrNum = vm->program.op[vm->pc];
+        vm->reg1 = vm->program.dst[vm->pc];
+        vm->reg2 = vm->program.src[vm->pc];
+        vm->value = vm->program.imm[vm->pc];
+        vm->pc++;
+        eval(vm);
+    }
+    
+#endif
+    
 }
 
-bool storageloaded = false;
+/* the classic loop with every instruction counted and timed, see Profile.h */
+void runProfiled(VMState *vm) {
+    if(vm->steps == 0) {
+        profileFrames[vm->rstack] = vm->pc;
+        profileEntered[vm->rstack] = profileStart = profileClock();
+    }
+    while(vm->running && vm->steps != vm->limit) {
+        int at = vm->pc, depth = vm->rstack;
+        vm->steps++;
+        vm->instrNum = vm->program.op[vm->pc];
+        vm->reg1 = vm->program.dst[vm->pc];
+        vm->reg2 = vm->program.src[vm->pc];
+        vm->value = vm->program.imm[vm->pc];
+        vm->pc++;
+        unsigned long long start = profileClock();
+        eval(vm);
+        unsigned long long now = profileClock();
+        profileCount(vm, at, vm->instrNum, depth, now - start, now);
+    }
+    if(!vm->running) {
+        consoleFlush(&vm->console);
+        profileReport(vm, stderr);
+    }
+}
 
-void load(char *runnable) {
+/* fetch/decode/eval */
+void runClassic(VMState *vm) {
+	while(vm->running && vm->steps != vm->limit) { 
+        vm->steps++;
+        vm->instrNum = vm->program.op[vm->pc];
+        vm->reg1 = vm->program.dst[vm->pc];
+        vm->reg2 = vm->program.src[vm->pc];
+        vm->value = vm->program.imm[vm->pc];
+        vm->pc++;
+		eval(vm);
+	}
+}
 
-    FILE * f = fopen(runnable, "rb");
-  	if(!f) {
-  		fprintf(stderr, "An error occurred while opening the file.\n");
-  		exit(EXIT_FAILURE);
-  	}		
+#include "Jit.h"
+
+/* 
+Embedding API, see vm.h 
+*/
+
+VMState *vmCreate() {
+    VMState *vm = (VMState *)calloc(1, sizeof(VMState));
+    vm->arith_mode = ARITH_CHAR;
+    vm->memory_rw_mode = MEMORY_RW_CHAR;
+    vm->console.out = stdout;
+    vm->console.in = stdin;
+    vm->mem = memCreate();
+    vm->reader = memRetain(vm->mem);
+    pthread_mutex_init(&vm->inputLock, NULL);
+    vm->lastSyncTime = time(NULL);
+    return vm;
+}
+
+void vmDestroy(VMState *vm) {
+    if(vm == NULL)
+        return;
+    vmSync(vm);
+    if(vmMain == vm)
+        vmMain = NULL;
+    /* spawned vms that still run are freed when they stop */
+    for(int i = 0; i < vm->childCount; i++)
+        if(vm->children[i] != NULL && schedulerDetach(vm->children[i]))
+            vmDestroy(vm->children[i]);
+    free(vm->children);
+    free(vm->program.op);
+    free(vm->program.dst);
+    free(vm->program.src);
+    free(vm->program.imm);
+    free(vm->program.modes);
+    free(vm->handlers);
+    jitRelease(vm->jit);
+    free(vm->console.collected);
+    free(vm->console.queue);
+    pthread_mutex_destroy(&vm->inputLock);
+    memRelease(vm->mem, vm->reader);
+    free(vm);
+}
+
+int vmLoad(VMState *vm, const unsigned int *image, int words) {
+    decode(vm, image, words);
+    vm->pc = 0;
+    vm->running = 1;
+    vm->faulted = false;
+    specialise(vm, 0);
+    return 0;
+}
+
+int vmLoadFile(VMState *vm, const char *file) {
+    FILE * f = fopen(file, "rb");
+  	if(!f) 
+        return -1;
   	fseek(f, 0, SEEK_END);
   	int len = ftell(f);
   	fseek(f, 0, SEEK_SET);
-  	program = malloc(len);
-  	fread(program, 1, len, f);
+  	unsigned int *image = malloc(len);
+  	int words = fread(image, 1, len, f) / sizeof(int);
   	fclose(f);
-    if(!storageloaded) if( config.bootfile ) readStorage( config.bootfile );
-    run();
-    instrNum = reg1 = reg2 = value = pc = 0;
+    vmLoad(vm, image, words);
+    free(image);
+    return 0;
+}
+
+void vmMount(VMState *vm, char *bootfile) {
+    readStorage(vm->mem, bootfile);
+}
+
+void vmSetOutput(VMState *vm, FILE *out) {
+    consoleFlush(&vm->console);
+    vm->console.out = out;
+}
+
+const char *vmOutput(VMState *vm, int *len) {
+    return consoleCollected(&vm->console, len);
+}
+
+void vmSetInput(VMState *vm, FILE *in) {
+    vm->console.in = in;
+}
+
+void vmInput(VMState *vm, const char *data, int len) {
+    pthread_mutex_lock(&vm->inputLock);
+    consoleQueue(&vm->console, data, len);
+    pthread_mutex_unlock(&vm->inputLock);
+    schedulerWake(vm);
+}
+
+void vmCloseInput(VMState *vm) {
+    pthread_mutex_lock(&vm->inputLock);
+    vm->console.queueClosed = 1;
+    pthread_mutex_unlock(&vm->inputLock);
+    schedulerWake(vm);
+}
+
+int vmRun(VMState *vm, long long budget) {
+    if(!vm->running)
+        return vm->status = vm->faulted ? VM_ERROR : VM_HALTED;
+    /* steps never reaches ULLONG_MAX, so there is no limit without a budget */
+    vm->limit = budget > 0 ? vm->steps + budget : ULLONG_MAX;
+    vm->blocked = false;
+    vm->guarded = true;
+    if(setjmp(vm->trap) != 0) {
+        vm->guarded = false;
+        return vm->status = VM_ERROR;
+    }
+    /* the counters are process wide, spawned and forked vms run unprofiled */
+    if(profile && vm->parent == NULL) 
+        runProfiled(vm);
+    else if(jit && !debug)
+        runJit(vm);
+    else if(threaded && !debug) 
+        runThreaded(vm);
+    else 
+        runClassic(vm);
+    vm->guarded = false;
+    if(vm->blocked)
+        return vm->status = VM_BLOCKED;
+    return vm->status = vm->running ? VM_YIELDED : VM_HALTED;
+}
+
+int vmStatus(VMState *vm) {
+    return vm->status;
+}
+
+void vmSetUserData(VMState *vm, void *data) {
+    vm->userData = data;
+}
+
+void *vmUserData(VMState *vm) {
+    return vm->userData;
+}
+
+void translateOpCode(VMState *vm, char *token) {
+    if(strcmp(token, "eof") == 0) vm->instrNum = EOF;
+    else if(strcmp(token, "mov") == 0) vm->instrNum = MOV;  
+    else if(strcmp(token, "push") == 0) vm->instrNum = PUSH; 
+    else if(strcmp(token, "pop") == 0) vm->instrNum = POP; 
+    else if(strcmp(token, "ldr") == 0) vm->instrNum = LDR; 
+    else if(strcmp(token, "str") == 0) vm->instrNum = STR; 
+    else if(strcmp(token, "ldm") == 0) vm->instrNum = LDM; 
+    else if(strcmp(token, "stm") == 0) vm->instrNum = STM;
+    else if(strcmp(token, "ldmr") == 0) vm->instrNum = LDMR; 
+    else if(strcmp(token, "stmr") == 0) vm->instrNum = STMR; 
+    else if(strcmp(token, "add") == 0) vm->instrNum = ADD; 
+    else if(strcmp(token, "addi") == 0) vm->instrNum = ADDI; 
+    else if(strcmp(token, "sub") == 0) vm->instrNum = SUB; 
+    else if(strcmp(token, "mul") == 0) vm->instrNum = MUL; 
+    else if(strcmp(token, "div") == 0) vm->instrNum = DIV;  
+    else if(strcmp(token, "mod") == 0) vm->instrNum = MOD; 
+    else if(strcmp(token, "eq") == 0) vm->instrNum = EQ; 
+    else if(strcmp(token, "lt") == 0) vm->instrNum = LT;  
+    else if(strcmp(token, "gt") == 0) vm->instrNum = GT; 
+    else if(strcmp(token, "leq") == 0) vm->instrNum = LEQ; 
+    else if(strcmp(token, "geq") == 0) vm->instrNum = GEQ; 
+    else if(strcmp(token, "jmp") == 0) vm->instrNum = JMP; 
+    else if(strcmp(token, "jz") == 0) vm->instrNum = JZ; 
+    else if(strcmp(token, "jnz") == 0) vm->instrNum = JNZ; 
+    else if(strcmp(token, "ret") == 0) vm->instrNum = RET; 
+    else if(strcmp(token, "print") == 0) vm->instrNum = PRINT;  
+    else if(strcmp(token, "printc") == 0) vm->instrNum = PRINTC;  
+    else if(strcmp(token, "read") == 0) vm->instrNum = READ;  
+    else if(strcmp(token, "write") == 0) vm->instrNum = WRITE;  
+    else if(strcmp(token, "puts") == 0) vm->instrNum = PUTS; 
+    else if(strcmp(token, "gets") == 0) vm->instrNum = GETS; 
+    else if(strcmp(token, "readc") == 0) vm->instrNum = READC; 
+    else if(strcmp(token, "cmp") == 0) vm->instrNum = CMP; 
+    else if(strcmp(token, "prc") == 0) vm->instrNum = PRC;
+    else if(strcmp(token, "si") == 0) vm->instrNum = SI;
+    else if(strcmp(token, "inc") == 0) vm->instrNum = INC;
+    else if(strcmp(token, "dec") == 0) vm->instrNum = DEC;
+    else if(strcmp(token, "int") == 0) vm->instrNum = INT;
+}
+
+int translateReg1(VMState *vm, char *token) {
+    if(strcmp(token, "ax") == 0) vm->reg1 = 1; 
+    else if(strcmp(token, "bx") == 0) vm->reg1 = 2; 
+    else if(strcmp(token, "cx") == 0) vm->reg1 = 3; 
+    else if(strcmp(token, "dx") == 0) vm->reg1 = 4; 
+    else if(strcmp(token, "r1") == 0) vm->reg1 = 5;
+    else if(strcmp(token, "r2") == 0) vm->reg1 = 6;
+    else if(strcmp(token, "r3") == 0) vm->reg1 = 7;
+    else if(strcmp(token, "r4") == 0) vm->reg1 = 8;
+    else if(strcmp(token, "r5") == 0) vm->reg1 = 9;
+    else if(strcmp(token, "r6") == 0) vm->reg1 = 10;
+    else if(strcmp(token, "r7") == 0) vm->reg1 = 11;
+    else if(strcmp(token, "r8") == 0) vm->reg1 = 12;
+    else if(strcmp(token, "r9") == 0) vm->reg1 = 13;
+    else if(strcmp(token, "r10") == 0) vm->reg1 = 14;
+    else {
+        vm->value = atoi(token) ? atoi(token) : 0;
+        vm->reg1 = 0;
+    }
+    return vm->reg1;
+}
+
+int translateReg2(VMState *vm, char *token) {
+    if(strcmp(token, "ax") == 0) vm->reg2 = 1; 
+    else if(strcmp(token, "bx") == 0) vm->reg2 = 2; 
+    else if(strcmp(token, "cx") == 0) vm->reg2 = 3; 
+    else if(strcmp(token, "dx") == 0) vm->reg2 = 4; 
+    else if(strcmp(token, "r1") == 0) vm->reg2 = 5;
+    else if(strcmp(token, "r2") == 0) vm->reg2 = 6;
+    else if(strcmp(token, "r3") == 0) vm->reg2 = 7;
+    else if(strcmp(token, "r4") == 0) vm->reg2 = 8;
+    else if(strcmp(token, "r5") == 0) vm->reg2 = 9;
+    else if(strcmp(token, "r6") == 0) vm->reg2 = 10;
+    else if(strcmp(token, "r7") == 0) vm->reg2 = 11;
+    else if(strcmp(token, "r8") == 0) vm->reg2 = 12;
+    else if(strcmp(token, "r9") == 0) vm->reg2 = 13;
+    else if(strcmp(token, "r10") == 0) vm->reg2 = 14;
+    else {
+        vm->value = atoi(token) ? atoi(token) : 0;
+        vm->reg2 = 0;
+    }
+    return vm->reg2;
+}
+
+bool storageloaded = false;
+
+void load(VMState *vm, char *runnable) {
+
+    loadProgram(vm, runnable);
+    if(!storageloaded) if( config.bootfile ) readStorage(vm->mem,  config.bootfile );
+    while(vmRun(vm, 0) == VM_YIELDED)
+        ;
+    vm->instrNum = vm->reg1 = vm->reg2 = vm->value = vm->pc = 0;
 
 }
 
-void realTime() {
+void realTime(VMState *vm) {
 
     printf("ZVM v1.0 beta (https://github.com/zarat/vm)\n");
         printf("[info] realtime mode enabled, type 'help' for help\n");
@@ -1604,25 +2746,26 @@ void realTime() {
         char command[1024];
         char *token = NULL;
 
-        if( config.bootfile ) readStorage( config.bootfile );
+        if( config.bootfile ) readStorage(vm->mem,  config.bootfile );
         storageloaded = true;
         int tokenCounter = 0;        
         while(1) {
+            consoleFlush(&vm->console);
             printf("> ");
             fgets(command, 1024, stdin);
             command[strcspn(command, "\n")] = '\0';
-            if(startsWith("sta", command)) stackDump();
-            if(startsWith("mem", command)) memDump();
-            if(startsWith("reg", command)) regDump();
+            if(startsWith("sta", command)) stackDump(vm);
+            if(startsWith("mem", command)) memDump(vm);
+            if(startsWith("reg", command)) regDump(vm);
             if(startsWith("quit", command)) return;
             if(startsWith("help", command)) {
                 printf("Available commands:\n\tregister\tshow registers\n\tstack\t\tshow stack\n\tmemory\t\tshow memory\n\tclear\t\tclear data\n\tload <file>\tload program\n\tquit\t\texit vm\n");
             }
             if(startsWith("clear", command)) {
                 //readStorage();
-                memset(regs, 0, sizeof(regs));
-                memset(stack, 0, STACK_SIZE);
-                pstack = 0;
+                memset(vm->regs, 0, sizeof(vm->regs));
+                memset(vm->stack, 0, STACK_SIZE);
+                vm->pstack = 0;
             }
             if(startsWith("dis", command)) {
                 char *token = strtok(command, " ");
@@ -1643,7 +2786,7 @@ void realTime() {
                 while(token != NULL) {
                     if(displayModeCounter==1) {                         
                         token[strcspn(token, "\n")] = '\0';
-                        eval(token);
+                        eval(vm);
                     }
                     token = strtok(NULL, " ");                    
                 }
@@ -1661,7 +2804,7 @@ void realTime() {
                 }                
                 token = NULL;
                 
-                load(code);
+                load(vm, code);
                 
             }
             
@@ -1669,10 +2812,10 @@ void realTime() {
             while(token != NULL) {
                 token[strcspn(token, "\n")] = '\0';
                 switch(tokenCounter) {
-                    case 0: translateOpCode(token); break;                        
-                    case 1: translateReg1(token); break; 
-                    case 2: translateReg2(token); break; 
-                    case 3: value = atoi(token) ? atoi(token) : 0; break;
+                    case 0: translateOpCode(vm, token); break;                        
+                    case 1: translateReg1(vm, token); break; 
+                    case 2: translateReg2(vm, token); break; 
+                    case 3: vm->value = atoi(token) ? atoi(token) : 0; break;
                     default: break;
                 }
                 tokenCounter++;
@@ -1680,16 +2823,23 @@ void realTime() {
             }
             token = NULL;
             tokenCounter = 0;
-            eval();
-            instrNum = reg1 = reg2 = value = 0;            
+            eval(vm);
+            vm->instrNum = vm->reg1 = vm->reg2 = vm->value = 0;            
         }
 
 }
 
+#ifndef VM_LIBRARY
+
+#include "Batch.h"
+
 int main(int argc, char ** argv) {     
 
     config.bootfile = 0;
     config.debug = false;
+    config.writeback = false;
+    config.syncinterval = 0;
+    config.synctime = 0;
     
     ini_parse("vm.ini", handler, &config);
     
@@ -1707,25 +2857,62 @@ int main(int argc, char ** argv) {
 
     char runnable[64] = {0};
     bool runnableset = false;
+    bool batch = false;
+    char *snapshot = NULL;
+    int workers = 0;
+    struct batch jobs = {0};
     int a = 1;
     
     while(a < argc) {
          
-        if(argv[a][0] == '-') {
+        // run all programs and directories given on a thread pool, see Batch.h
+        if(strcmp(argv[a], "--batch") == 0)
+            batch = true;
+        
+        // continue a program from a snapshot written by int 20
+        else if(strcmp(argv[a], "--restore") == 0 && a + 1 < argc)
+            snapshot = argv[++a];
         
+        else if(argv[a][0] == '-') {
+        
+            // worker threads of --batch, one per core by default
+            if(argv[a][1] == 'j')  
+                workers = atoi(argv[a] + 2);
+            
             if(argv[a][1] == 'd')  
                 debug = true;
             
+            // translate the program to x86-64 machine code, see Jit.h
+            if(argv[a][1] == 'c')  
+                jit = true;
+            
+            // threaded dispatch instead of fetch/decode/eval
+            if(argv[a][1] == 't')  
+                threaded = true;
+            
+            // count and time every instruction, report at the end
+            if(argv[a][1] == 'p')  
+                profile = true;
+            
+            // print instructions, run time and allocations to stderr at the end
+            if(argv[a][1] == 's')  
+                stats = true;
+            
             // write memory to mounted bootfile 
             if(argv[a][1] == 'w')  
                 bootfilewriteable = true;
+            
+            // write-back, sync the bootfile later instead of on every change
+            if(argv[a][1] == 'b')  
+                config.writeback = true;
              
         } 
         
         else {
         
             runnableset = true;
-            strcpy(runnable, argv[a]);
+            snprintf(runnable, sizeof(runnable), "%s", argv[a]);
+            batchAddPath(&jobs, argv[a]);
             
         }
         
@@ -1733,30 +2920,61 @@ int main(int argc, char ** argv) {
                 
     }
 
-    if(runnableset) {
+    if(batch) {
+        
+        struct timespec start, end;
+        timespec_get(&start, TIME_UTC);
+        int failed = runBatch(&jobs, workers);
+        timespec_get(&end, TIME_UTC);
+        if(stats) {
+            double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+            fprintf(stderr, "[stats] jobs=%d failed=%d seconds=%.6f\n", jobs.count, failed, seconds);
+        }
+        return failed ? 1 : 0;
+        
+    }
+
+    vmMain = vmCreate();
+
+    if(runnableset || snapshot) {
      
-        FILE * f = fopen(runnable, "rb");
-    	if(!f) {
-    		fprintf(stderr, "An error occurred while opening the file.\n");
-    		exit(EXIT_FAILURE);
-    	}		
-    	fseek(f, 0, SEEK_END);
-    	int len = ftell(f);
-    	fseek(f, 0, SEEK_SET);
-    	program = malloc(len);
-    	fread(program, 1, len, f);
-    	fclose(f);
-        if( config.bootfile ) 
-            readStorage( config.bootfile );
+        if(snapshot) {
+            // the memory comes from the snapshot, the bootfile is not read again
+            if(vmRestore(vmMain, snapshot) != 0) {
+                fprintf(stderr, "Could not restore the snapshot '%s'.\n", snapshot);
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            loadProgram(vmMain, runnable);
+            if( config.bootfile ) 
+                vmMount(vmMain, config.bootfile );
+        }
         storageloaded = true;
-        run(); 
+        struct timespec start, end;
+        timespec_get(&start, TIME_UTC);
+        while(vmRun(vmMain, 0) == VM_YIELDED)
+            ; // int 15
+        timespec_get(&end, TIME_UTC);
+        if(stats) {
+            /* one machine readable line, used by bench/ */
+            double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+            consoleFlush(&vmMain->console);
+            fprintf(stderr, "[stats] instructions=%llu seconds=%.6f allocations=%llu locations=%d\n", vmMain->steps, seconds, vmMain->mem->allocs, memLen(vmMain->mem));
+        }
         
     } else { 
        
-        realTime();
+        realTime(vmMain);
         
     }
     
-    return 0;
+    vmFlush();
+    
+    if( config.bootfile ) 
+        closeStorage( config.bootfile );
     
-}
\ No newline at end of file
+    return vmMain->faulted ? 1 : 0;
+    
+}
+
+#endif